@@ -1,30 +1,131 @@
 #pragma once
 #include "EmulatorBase.h"
+#include "ByteIO/ByteStream.h"
+#include "Math/Color.h"
+#include "NesResampler.h"
+#include <cstdint>
+#include <memory>
 #include <string>
-#include "AudioQueue.h"
+#include <vector>
 
 class NesBus;
 class NesRom;
 
+// The NES machine without any host dependencies. The host injects
+// controller state before each Tick() and pulls the finished frame
+// and the audio produced during that frame afterwards.
 class Nes : EmulatorBase
 {
 public:
-    NesBus* bus;
-    NesRom* rom;
-    AudioQueue audioSystem;
+    NesBus* bus = nullptr;
+    NesRom* rom = nullptr;
 
 public:
+    ~Nes();
+
     bool Initialize();
     bool LoadGame(const std::string& filename);
     int Tick();
-    void Present(Renderer * renderer);
 
 public:
+	// Buttons are packed A, B, Select, Start, Up, Down, Left, Right
+	// from the most to the least significant bit
+	void SetControllerState(uint8_t port, uint8_t buttons);
+
+	// 256x240 picture of the last completed frame, converted to colours
+	// on each call
+	const Math::ColorRGB<uint8_t>* GetScreen();
+
+	// The same picture as 6 bit palette indices, and the colour emphasis
+	// bits (PPUMASK >> 5) of each of its 240 scanlines
+	const uint8_t* GetIndexedScreen() const;
+	const uint8_t* GetScreenEmphasis() const;
+
+	// The console's 2KB of work RAM, where games keep their variables
+	const uint8_t* GetRam() const;
+
+	// Where the indexed picture is drawn. By default the machine has a
+	// buffer of its own, a host can instead plug in a 256x240 buffer it
+	// owns, or pass nullptr to go back to the machine's own. A machine
+	// with the picture disabled draws nothing and GetIndexedScreen()
+	// returns null, for hosts that only look at RAM.
+	void SetScreenBuffer(uint8_t* pBuffer);
+	void DisableScreen();
+
+	// Bytes one machine holds for itself, by where they are. The ROM
+	// image is shared by every machine running the game and not counted
+	// in the total.
+	struct MemoryUsage
+	{
+		size_t machine = 0;		// NesBus: CPU, PPU, APU and RAM in one block
+		size_t cartridge = 0;	// Mapper, cartridge RAM, CHR RAM and its tiles
+		size_t picture = 0;		// Indexed picture, and the RGB one once GetScreen() is used
+		size_t audio = 0;		// Samples being synthesised and the last frame's
+		size_t states = 0;		// Scratch streams for run-ahead and CopyStateFrom()
+		size_t shared = 0;		// ROM image and its decoded CHR ROM
+
+		size_t Total() const { return sizeof(Nes) + machine + cartridge + picture + audio + states; }
+	};
+	MemoryUsage GetMemoryUsage() const;
+
+	// Mono samples generated by the last Tick()
+	const int16_t* GetAudioSamples() const { return vAudioSamples.data(); }
+	size_t GetAudioSampleCount() const { return vAudioSamples.size(); }
+
+	// The APU synthesises its audio at NativeSampleRate, a sixteenth of
+	// the CPU clock, and it is resampled to the host's rate from there.
+	// Any rate works, 44.1kHz is the default.
+	static constexpr uint32_t NativeSampleRate = 111860;
 	void SetSampleFrequency(uint32_t sample_rate);
 
+	// Plays the audio slightly faster or slower, by a factor close to 1,
+	// for hosts that keep their audio queue from running dry or filling
+	// up that way. Can be changed between any two frames.
+	void SetAudioRateScale(double dScale) { resampler.SetRateScale(dScale); }
+
+	// Run-ahead hides input lag, the game's own included. After each
+	// frame the machine is saved, run nFrames further with the same
+	// input and then restored, and the picture shown is the last of
+	// those. The audio and the machine are still those of the real
+	// frame. The frames in between skip the picture and the audio.
+	void SetRunAhead(uint32_t nFrames) { nRunAhead = nFrames; }
+	uint32_t GetRunAhead() const { return nRunAhead; }
+
+	// Forking, for searches that branch from one state many times.
+	// Clone() makes a second machine in the same state, sharing the ROM
+	// rather than loading it again. CopyStateFrom() then puts any
+	// machine running the same loaded image, such as a clone, into the
+	// other's state without allocating. The picture and audio of the
+	// last frame are output rather than state and are not copied.
+	std::unique_ptr<Nes> Clone() const;
+	bool CopyStateFrom(const Nes& other);
+
+	// Save states. SaveState() appends the whole machine to the stream
+	// and LoadState() restores it from the stream's read position. A
+	// state only loads into the game and state version it was saved
+	// with; anything else is refused before the machine is touched.
+	static constexpr uint32_t StateVersion = 7;
+	bool SaveState(ByteIO::ByteStream& stream) const;
+	bool LoadState(ByteIO::ByteStream& stream);
+
 private:
-	double dAudioTime = 0.0;
-	double dAudioTimePerNESClock = 0.0;
-	double dAudioTimePerSystemSample = 0.0f;
-    double dAudioRealTime = 0.0;
+	// Emulate up to the end of the current frame
+	void runFrame(bool bPicture, bool bAudio);
+
+	uint32_t nRunAhead = 0;
+	ByteIO::ByteStream runAheadState;
+	ByteIO::ByteStream copyState;
+
+	std::vector<int16_t> vAudioSamples;
+	std::vector<Math::ColorRGB<uint8_t>> vScreen;
+
+	// A frame of audio at the APU's rate, on its way through the
+	// resampler. The samples the resampler holds on to are output
+	// rather than state, like the picture.
+	std::vector<int16_t> vNativeSamples;
+	NesResampler resampler;
+
+	// PPU Clock Frequency
+	static constexpr uint32_t MasterClockRate = 5369318;
+	uint32_t nSampleRate = 44100;
 };
\ No newline at end of file
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "NesBlipBuffer.h"
+#include "Math/FixedPoint.h"
 #include <cstdint>
 
 class NesCPU;
+class NesArchive;
 
 enum SequencerMode{
     FourStep,
@@ -19,10 +22,61 @@ public:
 	void cpuWrite(uint16_t addr, uint8_t data);
 	uint8_t cpuRead(uint16_t addr);
 	void clock(NesCPU *cpu);
+
+	// The same as calling clock() nCycles times. Between the cycles where
+	// something can be heard to change, the channels are moved along in
+	// one go, so a run costs about as much as the sound it makes.
+	void Run(NesCPU *cpu, uint64_t nCycles);
 	void reset();
+	void Serialize(NesArchive& ar);
 
 	double GetOutputSample();
 
+	// Audio is synthesised band-limited from the changes in the mixer
+	// output, see NesBlipBuffer. Its clock is the master clock, three to
+	// each APU cycle. EndAudioFrame() makes everything up to the current
+	// cycle available to ReadSamples(), which passes the samples through
+	// the console's output filters.
+	void SetSampleRate(uint32_t nClockRate, uint32_t nSampleRate);
+	void EndAudioFrame();
+	size_t SamplesAvailable() const { return blip.SamplesAvailable(); }
+	size_t ReadSamples(int16_t* pOut, size_t nMax);
+
+	// Heap memory the APU holds beside itself
+	size_t PrivateBytes() const { return blip.PrivateBytes(); }
+
+	// Run the channels without synthesising any audio from them, for
+	// frames nobody is going to hear. The frames still end as usual.
+	bool bSkipAudio = false;
+
+	// Mix with the exact formulas instead of the lookup tables, to
+	// compare the two
+	bool bMixerFormula = false;
+
+	// Run the output filters in double instead of fixed point, to
+	// compare the two
+	bool bFilterDouble = false;
+
+	// Have Run() clock every cycle one at a time, to compare the two
+	bool bEveryCycle = false;
+
+	// True while the DMC is fetching sample bytes. Every fetch steals
+	// cycles from the CPU, so the APU cannot fall behind while it is.
+	bool DMCActive() const { return dmc.enabled && dmc.current_length != 0; }
+
+	// The IRQ line, raised by the frame counter in its 4-step mode and
+	// by the DMC when a sample ends. Each stays raised until the CPU
+	// acknowledges it through $4015, $4017 or $4010.
+	bool IrqLine() const { return frame_irq || dmc.irq_flag; }
+
+	// Number of clock() calls until the frame counter raises the line,
+	// 0 if it is raised already or NoIrq if it is not going to be. A
+	// DMC sample that will raise it also returns 0: the bus keeps the
+	// APU in step with the CPU while one plays, so the line can simply
+	// be looked at after every instruction.
+	static constexpr uint64_t NoIrq = ~0ull;
+	uint64_t CyclesUntilIrq() const;
+
 private:
     struct SquareWave
     {
@@ -60,6 +114,8 @@ private:
         void step_sweep();
         void step_length();
         void step_timer();
+        void advance_timer(uint32_t ticks);
+        bool audible();
         void write_control(uint8_t data);
         void write_sweep(uint8_t data);
         void write_timer_low(uint8_t data);
@@ -93,6 +149,8 @@ private:
         void step_envelope();
         void step_length();
         void step_timer();
+        void advance_timer(uint32_t ticks);
+        bool audible();
         void write_control(uint8_t data);
         void write_mode(uint8_t data);
         void write_length_index(uint8_t data);
@@ -117,6 +175,8 @@ private:
         uint8_t signal();
         void step_length();
         void step_timer();
+        void advance_timer(uint32_t ticks);
+        bool audible();
         void step_counter();
         void write_control(uint8_t data);
         void write_timer_low(uint8_t data);
@@ -153,61 +213,92 @@ private:
         void step_reader(NesCPU *cpu);
         void step_shifter();
         void step_timer(NesCPU *cpu);
+        void advance_timer(uint32_t ticks);
+        bool audible();
         bool get_irq_flag() { return irq_flag; }
         void clear_irq_flag() { irq_flag = false; }
     };
     DMC dmc;
 
+    // A first order filter, as the console's output stage has three of:
+    //
+    //     y[n] = b0 * x[n] + b1 * x[n-1] - a1 * y[n-1]
+    //
+    // The samples are run through it in fixed point, which comes out the
+    // same bit for bit whatever the compiler and its flags, or in double
+    // to compare against.
+    using FilterValue = Math::FixedPoint<int64_t, 20>;
+
+    template <typename T>
     struct PassFilter
     {
-        double b0;
-        double b1;
-        double a1;
-        double prev_x = 0;
-        double prev_y = 0;
+        T b0;
+        T b1;
+        T a1;
+        T prev_x;
+        T prev_y;
 
     public:
-        double process(double signal)
+        static PassFilter low_pass(double samplerate, double cutoff)
         {
-            auto y = b0 * signal + b1 * prev_x - a1 * prev_y;
-            prev_y = y;
-            prev_x = signal;
-            return y;
+            auto c = samplerate / 3.14159 / cutoff;
+            auto a0i = 1.0 / (1.0 + c);
+            return PassFilter{ T(a0i), T(a0i), T((1.0 - c) * a0i), T(0), T(0) };
         }
-    };
-    
 
-    struct LowPassFilter : PassFilter
-    {
-    public:
-        LowPassFilter(double samplerate, double cutoff)
+        static PassFilter high_pass(double samplerate, double cutoff)
         {
             auto c = samplerate / 3.14159 / cutoff;
             auto a0i = 1.0 / (1.0 + c);
-            b0 = b1 = a0i;
-            a1 = (1.0 - c) * a0i;
+            return PassFilter{ T(c * a0i), T(-c * a0i), T((1.0 - c) * a0i), T(0), T(0) };
         }
-    };
 
-    struct HighPassFilter : PassFilter
-    {
-    public:
-        HighPassFilter(double samplerate, double cutoff)
+        T process(T signal)
         {
-            auto c = samplerate / 3.14159 / cutoff;
-            auto a0i = 1.0 / (1.0 + c);
-            b0 = c * a0i;
-            b1 = -c * a0i;
-            a1 = (1.0 - c) * a0i;
+            T y = b0;
+            y *= signal;
+            T t = b1;
+            t *= prev_x;
+            y += t;
+            t = a1;
+            t *= prev_y;
+            y -= t;
+            prev_x = signal;
+            prev_y = y;
+            return y;
         }
     };
 
     uint64_t cycles = 0;
-    SequencerMode sequencer_mode;
+
+    // The channel outputs the mixer last saw, packed 4 bits each for
+    // the pulses, triangle and noise and 7 for the DMC, and the level
+    // they mixed to
+    NesBlipBuffer blip;
+    uint64_t nAudioFrameStart = 0;
+    uint32_t nMixerInputs = 0;
+    int32_t nMixerLevel = 0;
+
+    // The mixer output for the given channel outputs, out of 0x7FFF
+    int32_t mixLevel(uint8_t pulse1, uint8_t pulse2, uint8_t triangle, uint8_t noise, uint8_t dmc) const;
+    static double mix(uint8_t pulse1, uint8_t pulse2, uint8_t triangle, uint8_t noise, uint8_t dmc);
+    void updateOutput();
+    // The frame sequencer, stepped at fixed CPU cycles from the start of
+    // its sequence. sequencer_value counts the steps taken so far and
+    // sequencer_next is the cycle of the next one.
+    SequencerMode sequencer_mode = FourStep;
     uint8_t sequencer_value = 0;
-    bool irq;
-    bool frame_irq;
-    PassFilter passFilters[3] = {HighPassFilter(44100, 90), HighPassFilter(44100, 440), LowPassFilter(44100, 14000)};
+    uint64_t sequencer_start = 0;
+    uint64_t sequencer_next = 0;
+    void restart_sequencer(uint64_t start);
+    bool irq = false;
+    bool frame_irq = false;
+
+    // The 90Hz and 440Hz high passes and the 14kHz low pass, at the
+    // output sample rate
+    PassFilter<FilterValue> filters[3];
+    PassFilter<double> filtersDouble[3];
+    void make_filters(uint32_t samplerate);
 
     void write_frame_counter(uint8_t data);
     void step_envelopes();
@@ -215,4 +306,10 @@ private:
     void step_lengths();
     void step_timers(NesCPU *cpu);
     void step_sequencer();
+
+    // For Run(): the first cycle after this one where an output may
+    // change or the sequencer steps, and the channels moved along to
+    // the cycle before it
+    uint64_t next_event(uint64_t end);
+    void skip_to(uint64_t cycle);
 };
\ No newline at end of file
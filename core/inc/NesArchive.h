@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ByteIO/ByteStream.h"
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Saves or loads machine state through a ByteStream. Each part of the
+// machine lists its state once, in a Serialize() function, and the same
+// list is used in both directions so the two cannot drift apart. Values
+// are raw bytes in host order, a state is not meant to move between
+// machines of different endianness.
+class NesArchive
+{
+public:
+	NesArchive(ByteIO::ByteStream& stream, bool bLoading) : stream(stream), bLoading(bLoading) {}
+
+	bool Loading() const { return bLoading; }
+
+	// False once a load has run past the end of the stream or found
+	// a value that does not fit
+	bool Ok() const { return bOk; }
+	void Fail() { bOk = false; }
+
+	void Bytes(void* pData, size_t nSize)
+	{
+		if (bLoading)
+			bOk = stream.read((char*)pData, nSize) && bOk;
+		else
+			stream.write((const char*)pData, nSize);
+	}
+
+	template <typename T>
+	void Value(T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "only plain data can be serialized as bytes");
+		Bytes(&value, sizeof(T));
+	}
+
+	// A buffer whose size is fixed by the loaded game, such as cartridge
+	// RAM. Its size is stored so a mismatch is caught rather than read
+	// into the wrong place.
+	void Buffer(std::vector<uint8_t>& v)
+	{
+		uint32_t nSize = (uint32_t)v.size();
+		Value(nSize);
+		if (nSize != v.size())
+		{
+			Fail();
+			return;
+		}
+		Bytes(v.data(), nSize);
+	}
+
+	// A buffer that is either empty or nSize bytes, such as cartridge
+	// RAM that is only allocated once it is written to. Loading gives
+	// the buffer whichever of the two sizes was saved.
+	void OptionalBuffer(std::vector<uint8_t>& v, size_t nSize)
+	{
+		uint32_t nSaved = (uint32_t)v.size();
+		Value(nSaved);
+		if (nSaved != 0 && nSaved != nSize)
+		{
+			Fail();
+			return;
+		}
+		if (bLoading)
+		{
+			if (nSaved == 0)
+				std::vector<uint8_t>().swap(v);
+			else
+				v.resize(nSaved);
+		}
+		Bytes(v.data(), nSaved);
+	}
+
+private:
+	ByteIO::ByteStream& stream;
+	bool bLoading;
+	bool bOk = true;
+};
\ No newline at end of file
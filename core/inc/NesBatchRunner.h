@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Nes;
+
+// Many headless machines running the same game, stepped together across
+// a pool of worker threads, for reinforcement learning and search.
+//
+// Each Step() hands every worker an equal share of the instances. A
+// worker that finishes its own share steals the rest of someone else's,
+// so a few slow instances do not hold the whole batch up. Instances are
+// independent of each other and a single instance only ever runs on
+// one thread at a time, so nothing inside the core needs locking.
+//
+// The machines are clones of the first one loaded and share its ROM.
+class NesBatchRunner
+{
+public:
+	static constexpr size_t FrameBytes = 256 * 240;
+	static constexpr size_t RamBytes = 2048;
+
+	// Statistics of one worker thread since the last reset
+	struct WorkerStatistics
+	{
+		int core = -1;			// Core the thread is pinned to, -1 if not pinned
+		uint64_t frames = 0;	// Frames it has emulated
+		uint64_t stolen = 0;	// Instances it took from other workers' shares
+		double seconds = 0.0;	// Time spent emulating
+
+		double FramesPerSecond() const { return seconds > 0.0 ? frames / seconds : 0.0; }
+	};
+
+	// nThreads of 0 uses one thread per hardware thread. When pinned,
+	// worker i runs on core i modulo the number of cores.
+	NesBatchRunner(const std::string& rom, size_t nInstances, uint32_t nThreads = 0, bool bPinThreads = false);
+	~NesBatchRunner();
+
+	NesBatchRunner(const NesBatchRunner&) = delete;
+	NesBatchRunner& operator=(const NesBatchRunner&) = delete;
+
+	// False if the game could not be loaded
+	bool Ok() const { return !vInstances.empty(); }
+
+	size_t Size() const { return vInstances.size(); }
+	Nes& Instance(size_t i) { return *vInstances[i]; }
+
+	// Put every instance into the state of the given one
+	void ResetAllTo(size_t nSource);
+
+	// Run every instance nFrames frames. pActions holds the controller
+	// 1 buttons for each instance, held for all of the frames. After the
+	// last frame each instance's picture, as palette indices, and RAM
+	// are copied out to pFrames and pRam if they are given, FrameBytes
+	// and RAM bytes apart, in instance order.
+	void Step(const uint8_t* pActions, uint32_t nFrames = 1, uint8_t* pFrames = nullptr, uint8_t* pRam = nullptr);
+
+	size_t Threads() const { return vWorkers.size(); }
+	std::vector<WorkerStatistics> GetStatistics() const;
+	void ResetStatistics();
+
+private:
+	struct Worker
+	{
+		std::thread thread;
+		WorkerStatistics stats;
+
+		// The share of instances not yet taken, [next, end)
+		alignas(64) std::atomic<size_t> next{ 0 };
+		size_t end = 0;
+	};
+
+	void workerMain(size_t nWorker);
+	void runShare(size_t nWorker);
+	void runInstance(size_t i);
+
+	std::vector<std::unique_ptr<Nes>> vInstances;
+	std::vector<std::unique_ptr<Worker>> vWorkers;
+
+	// The batch being stepped
+	const uint8_t* pActions = nullptr;
+	uint32_t nFrames = 0;
+	uint8_t* pFrames = nullptr;
+	uint8_t* pRam = nullptr;
+
+	// Workers wait for the generation to change, and the caller waits
+	// for the number of workers still busy to reach zero
+	std::mutex mutex;
+	std::condition_variable cvStart;
+	std::condition_variable cvDone;
+	uint64_t nGeneration = 0;
+	size_t nBusy = 0;
+	bool bQuit = false;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class NesArchive;
+
+// Band-limited synthesis of a signal that only ever changes in steps.
+// Rather than sampling the signal, every change of level is added as a
+// band-limited step at the exact clock it happened on, and the output
+// samples are the running sum of those steps. Nothing is done for the
+// clocks in between, and the output has no aliasing from the edges.
+//
+// Time is counted in clocks from the start of the current frame. A
+// frame is closed with EndFrame(), which makes every sample before it
+// available to read.
+class NesBlipBuffer
+{
+public:
+	// Steps are placed with 1/Phases sample precision and spread over
+	// Taps output samples, so the output runs Taps/2 samples late
+	static constexpr int Phases = 32;
+	static constexpr int Taps = 16;
+
+	void SetRates(uint32_t nClockRate, uint32_t nSampleRate);
+	void Clear();
+
+	// The signal changes by nDelta at nTime clocks into the frame
+	void AddDelta(uint32_t nTime, int32_t nDelta);
+
+	// Close the frame nTime clocks after it started, the next one starts there
+	void EndFrame(uint32_t nTime);
+
+	// Steps still being spread into samples that are yet to be
+	// completed, and samples not yet read
+	void Serialize(NesArchive& ar);
+
+	size_t SamplesAvailable() const { return nAvailable; }
+	size_t ReadSamples(int16_t* pOut, size_t nMax);
+
+	// Heap memory held for samples in progress
+	size_t PrivateBytes() const { return vDeltas.capacity() * sizeof(int32_t); }
+
+private:
+	// Kernel taps are fixed point with this many fraction bits
+	static constexpr int KernelBits = 12;
+
+	// The integrator leaks 1/2^BassShift of its level every sample,
+	// a high pass around 14Hz at 44.1kHz that keeps DC out of the output
+	static constexpr int BassShift = 9;
+
+	uint32_t nClockRate = 1;
+	uint32_t nSampleRate = 1;
+
+	// Start of the frame past sample nAvailable, in 1/nClockRate samples
+	uint64_t nFramePhase = 0;
+	size_t nAvailable = 0;
+	int32_t nIntegrator = 0;
+
+	std::vector<int32_t> vDeltas;
+
+	// Kernel taps for each phase, shared by every buffer
+	using KernelPhase = int16_t[Taps];
+	static const KernelPhase* kernel();
+	const KernelPhase* nKernel = kernel();
+};
\ No newline at end of file
@@ -1,22 +1,73 @@
 #pragma once
 #include "stdx/type_traits.h"
+#include "stdx/compiler.h"
 #include "NesCPU.h"
 #include "NesPPU.h"
 #include "NesAPU.h"
 #include "NesAPU2.h"
 #include "NesRom.h"
+#include <cstddef>
 
-class NesBus
+class NesArchive;
+
+// The whole console in one block, the CPU, PPU, APU and RAM held by
+// value rather than each in an allocation of its own. Members are laid
+// out by how often they are touched: the page tables and clocks that
+// every instruction uses come first, then the CPU registers and RAM,
+// then the APU and PPU. The cartridge, the picture and the audio buffer
+// live outside it.
+//
+// Byte budget, with a 64 bit build:
+//   page tables              1024
+//   clocks, deadlines, I/O     80
+//   NesCPU                     32
+//   RAM                      2048
+//   NesAPU2                   464
+//   NesPPU                   3072
+// about 6.6KB, held to ByteBudget below so that thousands of machines
+// stay cache friendly. The picture adds 60KB if the machine draws one,
+// see Nes::GetMemoryUsage() for everything else.
+class alignas(64) NesBus
 {
 public:
-    NesCPU* cpu;
-    NesPPU* ppu;
-	NesAPU2* apu;
-    NesRom* rom;
-    uint8_t cpuRam[2048] = {0};
-    uint8_t controller[2] = {0};
-
-    uint32_t sysClockCounter = 0;
+	static constexpr size_t ByteBudget = 8 * 1024;
+
+	// The CPU address space is carved into 64 pages of 1KB. Pages backed
+	// by plain memory (system RAM, PRG ROM, cartridge RAM) hold a direct
+	// pointer, so most accesses never leave these inline functions.
+	// Null pages are I/O, or ROM that is written to switch banks,
+	// and go through the full address decoding below. The cartridge
+	// pages are rebuilt whenever the mapper reports a bank switch.
+	const uint8_t* pReadPage[64] = {nullptr};
+	uint8_t* pWritePage[64] = {nullptr};
+
+	// Catch-up scheduling ==========================================
+	// Time is counted in master clock ticks, one per PPU dot, with a
+	// CPU cycle every 3 ticks. The CPU executes whole instructions and
+	// the PPU and APU are left behind until something needs them to be
+	// current: the CPU touching their registers or a mapper, an NMI
+	// coming due, or the end of the frame. Then they are clocked up to
+	// the master tick at which the instruction started.
+	uint64_t cpuClock = 0;		// CPU cycle the next instruction starts on
+	uint64_t ppuClock = 0;		// Master ticks the PPU has been clocked for
+	uint64_t apuClock = 0;		// CPU cycles the APU has been clocked for
+
+	// Predicted master ticks at which the PPU raises NMI (scanline 241,
+	// cycle 1) and completes the frame (scanline 260, cycle 340). They
+	// are refreshed whenever the PPU is caught up or written to.
+	uint64_t nmiDeadline = 0;
+	uint64_t frameDeadline = 0;
+
+	// Predicted master ticks at which the cartridge's scanline counter
+	// and the APU next raise the IRQ line, 0 while they hold it raised
+	// and NoDeadline when they are not going to. The line is only
+	// looked at once one of these has passed, see executeInstruction().
+	static constexpr uint64_t NoDeadline = ~0ull;
+	uint64_t mapperIrqDeadline = NoDeadline;
+	uint64_t apuIrqDeadline = NoDeadline;
+
+	NesRom* rom = nullptr;
+	uint8_t controller[2] = {0};
 	uint8_t controller_state[2] = {0};
 
 	// A simple form of Direct Memory Access is used to swiftly
@@ -25,29 +76,70 @@ public:
 	// the program prepares a page of memory with the sprite info required
 	// for the next frame and initiates a DMA transfer. This suspends the
 	// CPU momentarily while the PPU gets sent data at PPU clock speeds.
-	// Note here, that dma_page and dma_addr form a 16-bit address in 
-	// the CPU bus address space
+	// The page is copied as soon as it is written to 0x4014, and the
+	// CPU is suspended once the instruction has finished.
 	uint8_t dma_page = 0x00;
-	uint8_t dma_addr = 0x00;
-	uint8_t dma_data = 0x00;
 
 	// DMA transfers need to be timed accurately. In principle it takes
 	// 512 cycles to read and write the 256 bytes of the OAM memory, a
 	// read followed by a write. However, the CPU needs to be on an "even"
-	// clock cycle, so a dummy cycle of idleness may be required
-	bool dma_dummy = true;
-
-	// Finally a flag to indicate that a DMA transfer is happening
+	// clock cycle, so a dummy cycle of idleness may be required. The APU
+	// carries on through the transfer.
 	bool dma_transfer = false;
 
+	NesCPU cpu;
+	alignas(64) uint8_t cpuRam[2048] = {0};
+	NesAPU2 apu;
+	NesPPU ppu;
+
     NesBus();
 
-    void cpuWrite(uint16_t addr, uint8_t data);   
-    uint8_t cpuRead(uint16_t addr, bool bReadOnly = false);
+    // The components point back at the bus, so it stays where it is
+    NesBus(const NesBus&) = delete;
+    NesBus& operator=(const NesBus&) = delete;
+
+    void cpuWrite(uint16_t addr, uint8_t data)
+    {
+        uint8_t* page = pWritePage[addr >> 10];
+        if (STDX_likely(page != nullptr))
+            page[addr & 0x03FF] = data;
+        else
+            cpuWriteSlow(addr, data);
+    }
+
+    uint8_t cpuRead(uint16_t addr, bool bReadOnly = false)
+    {
+        const uint8_t* page = pReadPage[addr >> 10];
+        if (STDX_likely(page != nullptr))
+            return page[addr & 0x03FF];
+        return cpuReadSlow(addr, bReadOnly);
+    }
+
+    void cpuWriteSlow(uint16_t addr, uint8_t data);
+    uint8_t cpuReadSlow(uint16_t addr, bool bReadOnly = false);
+    void mapCartridgePages();
 
     bool loadRom(NesRom* rom);
     void reset();
-    void clock();
+
+    // The whole machine, the CPU, PPU, APU and cartridge included
+    void Serialize(NesArchive& ar);
+
+    // Execute instructions until the next one would start after the
+    // given master tick or the frame is complete
+    void RunUntil(uint64_t tick);
+
+    // Catch the PPU up to and including the given master tick
+    void SyncPPU(uint64_t tick);
+
+    // Clock the APU until it has seen every CPU cycle before cpu_cycle
+    void SyncAPU(uint64_t cpu_cycle);
+
+private:
+    void executeInstruction();
+    void updateDeadlines();
+    void updateApuIrqDeadline();
+    bool irqLine() { return rom->IrqState() || apu.IrqLine(); }
 
 
 };
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <map>
 
 class NesBus;
+class NesArchive;
 
 class NesCPU
 {
@@ -58,14 +59,15 @@ public:
 	uint8_t  cycles      = 0;	   // Counts how many cycles the instruction has remaining
 	uint32_t clock_count = 0;	   // A global accumulation of the number of clocks
 
+    // One table for every CPU, it never changes
     struct Instruction
     {
-        std::string name;
-        uint8_t (NesCPU::*operate)(void) = nullptr;
-        uint8_t (NesCPU::*addrmode)(void) = nullptr;
-        uint8_t cycles = 0;
+        const char* name;
+        uint8_t (NesCPU::*operate)(void);
+        uint8_t (NesCPU::*addrmode)(void);
+        uint8_t cycles;
     };
-    std::vector<Instruction> opLookup;
+    static const Instruction opLookup[256];
 
     NesBus* bus;
     void ConnectBus(NesBus* bus)
@@ -79,6 +81,7 @@ public:
     // advantage of many of the CPUs internal operations to do this.
     std::map<uint16_t, std::string> Disassemble(uint16_t nStart, uint16_t nStop);
     void Reset();
+    void Serialize(NesArchive& ar);
 
     uint8_t read(uint16_t a, bool bReadOnly = false);
     void write(uint16_t a, uint8_t d);
@@ -87,6 +90,21 @@ public:
     void doBranch();
     void clock();
 
+    // Execute one whole instruction and return how many cycles it took.
+    // StepLegacy() is the original table of member function pointers.
+    // Step() runs the same instruction set through one fused handler per
+    // opcode (see NesCPUCore.cpp) and is what Execute() uses unless
+    // NESCPU_LEGACY_CORE is defined. The two are kept side by side so
+    // they can be compared against each other.
+    uint8_t StepLegacy();
+    uint8_t Step();
+    uint8_t Execute();
+
+    // Execute a run of instructions back to back, returning the total
+    // number of cycles taken. With computed goto each handler jumps
+    // straight to the next one rather than going back through a loop.
+    uint32_t Run(uint32_t nInstructions);
+
     bool IsComplete()
     {
         return cycles == 0;
@@ -167,5 +185,8 @@ private:
     uint8_t XXX();
 
 public:
+    // Interrupts, taken between instructions. irq() is only called by
+    // the bus while the I flag is clear.
     void nmi();
+    void irq();
 };
\ No newline at end of file
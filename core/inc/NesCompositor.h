@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Composition of a whole scanline, background against sprites, into
+// palette indices. It does what NesPPU::composeDot() does for one dot,
+// for 16 or 32 pixels at a time where the CPU has the instructions for
+// it: the left edge clipping, the priority mux, sprite zero hits and the
+// palette lookup.
+//
+// The widest version the host supports is picked as the program starts,
+// by asking the CPU. Every version gives identical results.
+class NesCompositor
+{
+public:
+	enum class Level
+	{
+		Scalar,
+		SSE2,
+		AVX2,
+	};
+
+	struct Line
+	{
+		// 256 background pixels, pixel in bits 0-1 and palette in bits
+		// 2-3, already offset by fine x
+		const uint8_t* pBackground = nullptr;
+
+		// 256 sprite pixels, pixel in bits 0-1, palette in bits 2-4,
+		// priority over the background in bit 5 and sprite zero in bit 6.
+		// Transparent pixels are 0.
+		const uint8_t* pSprites = nullptr;
+
+		// PPUMASK, the background is treated as transparent when it is
+		// not rendered. Sprites not rendered are expected to be all 0.
+		bool bBackground = false;
+		bool bBackgroundLeft = false;
+		bool bSpritesLeft = false;
+
+		// The 32 palette entries, and where to write the line's palette
+		// indices. Nothing is written if pOut is null.
+		const uint8_t* pColours = nullptr;
+		uint8_t* pOut = nullptr;
+	};
+
+	// Compose the line, returning whether an opaque pixel of sprite zero
+	// landed on an opaque background pixel
+	static bool Compose(const Line& line);
+
+	// The version Compose() uses, and the best one this CPU can run
+	static Level GetLevel();
+	static Level BestLevel();
+
+	// Use a given version, for checking them against each other. Not to
+	// be changed while machines are running. Anything above BestLevel()
+	// is lowered to it.
+	static void SetLevel(Level level);
+
+	static const char* LevelName(Level level);
+};
@@ -1,22 +1,45 @@
 #pragma once
 
 #include "Math/Color.h"
+#include "stdx/compiler.h"
+#include <cstddef>
+#include <memory>
 
 class NesRom;
+class NesArchive;
 
 class NesPPU
 {
 private:		
 	uint8_t     tblName[2][1024] = {0};
-	uint8_t     tblPattern[2][4096] = {0};
 	uint8_t		tblPalette[32] = {0};
 
-	Math::ColorRGB<uint8_t>  palScreen[0x40];
-    Math::ColorRGB<uint8_t>  sprScreen[256*240];
+	// The picture as 6 bit palette indices, one byte per pixel, and the
+	// emphasis bits each scanline started with. Turned into colours by
+	// ConvertScreen() once the frame is done. The picture is drawn into
+	// either a buffer of the PPU's own, kept apart from the rest of the
+	// machine, or one the host has plugged in. A PPU with neither draws
+	// no picture at all.
+	uint8_t* pScreen = nullptr;
+	std::unique_ptr<uint8_t[]> pOwnScreen;
+	uint8_t sprScreenEmphasis[240];
 
 private:
     NesRom *rom;
 
+	// The pattern tables as 8 pages of 1KB, pointing straight into CHR
+	// memory where the cartridge maps them linearly, and the offset of
+	// each page into CHR memory for the tile cache. Null pages go
+	// through the mapper.
+	const uint8_t* pPatternPage[8] = {nullptr};
+	uint32_t nPatternOffset[8] = {0};
+
+	// The four nametables at 0x2000, 0x2400, 0x2800 and 0x2C00, each
+	// pointing at whichever 1KB table the mirroring puts there, so a
+	// nametable access is a single lookup
+	uint8_t* pNameSlot[4] = { tblName[0], tblName[0], tblName[1], tblName[1] };
+	uint8_t nametableRead(uint16_t addr) const { return pNameSlot[(addr >> 10) & 0x03][addr & 0x03FF]; }
+
 	union PPUSTATUS
 	{
 		struct
@@ -119,7 +142,7 @@ private:
 		uint8_t id;			// ID of tile from pattern memory
 		uint8_t attribute;	// Flags define how sprite should be rendered
 		uint8_t x;			// X position of sprite
-	} OAM[64];
+	} OAM[64] = {};
 
 	// A register to store the address when the CPU manually communicates
 	// with OAM via PPU registers. This is not commonly used because it 
@@ -128,15 +151,39 @@ private:
 	uint8_t oam_addr = 0x00;
 
 
-	sObjectAttributeEntry spriteScanline[8];
-	uint8_t sprite_count;
-	uint8_t sprite_shifter_pattern_lo[8];
-	uint8_t sprite_shifter_pattern_hi[8];
+	sObjectAttributeEntry spriteScanline[8] = {};
+	uint8_t sprite_count = 0;
+
+	// The selected sprites drawn into a line buffer once their patterns
+	// are fetched at dot 340, a byte per pixel: pixel in bits 0-1,
+	// palette in bits 2-4, priority over the background in bit 5 and
+	// sprite zero in bit 6. sprite_dot counts how far the sprites have
+	// moved along, standing in for their x counters and shifters, and
+	// is SpriteLineEnd while there is nothing left to draw.
+	static constexpr uint16_t SpriteLineEnd = 256;
+	uint8_t sprite_line[256] = {0};
+	uint16_t sprite_dot = SpriteLineEnd;
 
 	// Sprite Zero Collision Flags
 	bool bSpriteZeroHitPossible = false;
 	bool bSpriteZeroBeingRendered = false;
 
+	// The steps of the dot state machine, see clock()
+	void IncrementScrollX();
+	void IncrementScrollY();
+	void TransferAddressX();
+	void TransferAddressY();
+	void LoadBackgroundShifters();
+	void UpdateShifters();
+	void LoadSpriteLine();
+	void fetchDot();
+	uint8_t composeDot();
+	void advanceDot();
+
+	// Whole scanlines in one pass, see Run()
+	void renderScanline();
+	void idleScanline();
+
 	// The OAM is conveniently package above to work with, but the DMA
     // mechanism will need access to it for writing one byute at a time
 public:
@@ -145,8 +192,24 @@ public:
 
 public:
     NesPPU();
-    Math::ColorRGB<uint8_t>* GetScreen() { return sprScreen; } 
-    Math::ColorRGB<uint8_t>& GetColourFromPaletteRam(uint8_t palette, uint8_t pixel);
+
+	static constexpr size_t ScreenBytes = 256 * 240;
+
+	// Draw into a buffer of ScreenBytes the host owns, or with nullptr
+	// into one the PPU allocates itself, which is the default
+	void SetScreenBuffer(uint8_t* pBuffer);
+
+	// Draw nothing, for machines only run for their RAM. GetScreen()
+	// returns null until a buffer is set again.
+	void DisableScreen();
+
+	// Heap memory the PPU holds beside itself
+	size_t PrivateBytes() const { return pOwnScreen ? ScreenBytes : 0; }
+
+    const uint8_t* GetScreen() const { return pScreen; }
+    const uint8_t* GetScreenEmphasis() const { return sprScreenEmphasis; }
+    void ConvertScreen(Math::ColorRGB<uint8_t>* pRGB) const;
+    uint8_t GetPaletteIndex(uint8_t palette, uint8_t pixel) const;
 
 	// Communications with Main Bus
 	uint8_t cpuRead(uint16_t addr, bool rdonly = false);
@@ -161,8 +224,48 @@ public:
         this->rom = rom;
     }
 
+	// Repoint the pattern pages after a CHR bank switch
+	void mapPatternPages();
+
+	// Repoint the nametable slots after the mirroring has changed
+	void mapNametables();
+
+	// One row of the pattern tile at addr as 8 palette indices, see
+	// NesTileCache
+	uint64_t patternRow(uint16_t addr, bool bFlip);
+
 	void clock();
 	void reset();
+
+	// Registers, memories and the dot state machine. The picture is
+	// output rather than state, it is redrawn by the next frame.
+	void Serialize(NesArchive& ar);
+
+	// Advance a number of dots. Scanlines that are covered from their
+	// first dot to their last are rendered in one pass from nametable,
+	// attribute and pattern data rather than dot by dot. The bus only
+	// catches the PPU up when the CPU touches it, so a register write
+	// part way through a line always lands between two dots, and that
+	// line runs through clock() instead. The result is identical.
+	void Run(uint32_t nClocks);
+	bool bScanlineRenderer = true;
+
+	// Leave the picture alone and only do what has an effect on the
+	// machine, for frames nobody is going to see. Pixels are still
+	// composed where sprite zero could hit, as games wait on that.
+	bool bSkipPicture = false;
+
+	// Number of clock() calls until the dot at (scanline, cycle) has
+	// been processed, assuming the rendering mask is not changed on
+	// the way. Lets the bus predict when the PPU next needs attention.
+	uint32_t ClocksUntil(int16_t target_scanline, int16_t target_cycle) const;
+
+	// Number of clock() calls until the mapper's scanline counter has
+	// been clocked nCount more times, on the same assumption. NoClocks
+	// when rendering is off or the count runs past this frame's visible
+	// scanlines, the bus looks again once the frame is complete.
+	static constexpr uint32_t NoClocks = 0xFFFFFFFF;
+	uint32_t ClocksUntilCounter(uint32_t nCount) const;
 	bool nmi = false;
 	bool scanline_trigger = false;
 	bool frame_complete = false;
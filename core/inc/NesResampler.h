@@ -0,0 +1,77 @@
+#pragma once
+
+#include "NesCompositor.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Conversion of a stream of samples from one rate to another. Every output
+// sample is a windowed sinc of the Taps input samples around it, with the
+// sinc shifted to the nearest of Phases positions between two inputs and
+// cut off below the lower of the two rates' Nyquist frequencies.
+//
+// The kernel and the sums are integers, so the SSE2 and AVX2 versions,
+// picked the same way as NesCompositor's, give identical results to the
+// scalar one.
+class NesResampler
+{
+public:
+	static constexpr int Phases = 256;
+	static constexpr int Taps = 64;
+
+	using Level = NesCompositor::Level;
+
+	NesResampler();
+
+	// Designs the kernel for the pair of rates and forgets any samples
+	// still held
+	void SetRates(uint32_t nInputRate, uint32_t nOutputRate);
+
+	// Stretches the output by a factor close to 1, for hosts that steer
+	// how full their audio queue is. Takes effect from the next sample
+	// without a glitch, the kernel is left as it is.
+	void SetRateScale(double dScale);
+	double GetRateScale() const { return dScale; }
+
+	void Clear();
+
+	// The most samples Process() can return for nCount more input samples
+	size_t MaxOutput(size_t nCount) const;
+
+	// Takes all of the input and returns as many output samples as it
+	// reaches, at most nMax. The input is lined up with the output, the
+	// samples past the last one returned wait for the next call.
+	size_t Process(const int16_t* pIn, size_t nCount, int16_t* pOut, size_t nMax);
+
+	// Heap memory held for the input waiting. The kernel is shared by
+	// every resampler between the same rates.
+	size_t PrivateBytes() const { return vInput.capacity() * sizeof(int16_t); }
+
+	// The version Process() uses, and the best one this CPU can run. Not
+	// to be changed while machines are running.
+	static Level GetLevel();
+	static void SetLevel(Level level);
+
+	// Kernel taps are fixed point with this many fraction bits, and each
+	// phase adds up to exactly one
+	static constexpr int KernelBits = 14;
+
+	struct Kernel
+	{
+		alignas(32) int16_t taps[Phases][Taps];
+	};
+
+private:
+	uint32_t nInputRate = 1;
+	uint32_t nOutputRate = 1;
+	double dScale = 1.0;
+
+	// Input samples per output sample and the position of the next output
+	// in vInput, both 32.32 fixed point
+	uint64_t nStep = 1ull << 32;
+	uint64_t nPosition = 0;
+
+	std::vector<int16_t> vInput;
+	std::shared_ptr<const Kernel> pKernel;
+};
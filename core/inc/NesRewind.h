@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ByteIO/ByteStream.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Nes;
+
+// A fixed amount of memory holding as much recent history of the machine
+// as it can, as save states taken once a frame.
+//
+// The newest state is kept as it is. Every older one is stored as the
+// XOR of itself and the state after it, which is mostly zero bytes as
+// most of RAM, the nametables and OAM do not change from one frame to
+// the next, and then run-length encoded. Stepping back a frame is a
+// single decode. Every KeyframeInterval-th state is stored whole, still
+// run-length encoded, so that going further back never decodes more
+// than KeyframeInterval states.
+//
+// When the memory is full the oldest states are dropped. Nothing older
+// depends on anything newer being kept, so the history just gets shorter.
+class NesRewind
+{
+public:
+	static constexpr size_t DefaultCapacity = 8 * 1024 * 1024;
+	static constexpr uint32_t DefaultKeyframeInterval = 60;
+
+	// NTSC frames per second, for turning frames into time
+	static constexpr double FrameRate = 60.0988;
+
+	explicit NesRewind(size_t nCapacity = DefaultCapacity, uint32_t nKeyframeInterval = DefaultKeyframeInterval);
+
+	// Record the machine as it is now, normally after every Tick()
+	void Push(const Nes& nes);
+
+	// Put the machine back to how it was nFrames pushes before the most
+	// recent one, and forget everything after that. Fails, leaving the
+	// machine alone, if not that much history is held.
+	bool Rewind(Nes& nes, uint32_t nFrames = 1);
+
+	void Clear();
+
+	// States held, the newest included
+	size_t Frames() const { return vEntries.size() + (vCurrent.empty() ? 0 : 1); }
+	size_t BytesUsed() const { return nBytesUsed + vCurrent.size(); }
+
+	double SecondsRetained() const { return Frames() / FrameRate; }
+	double BytesPerSecond() const { return Frames() > 0 ? BytesUsed() / SecondsRetained() : 0.0; }
+
+	// Time the last Rewind() took, decoding and loading included
+	double LastRewindMicroseconds() const { return dLastRewindMicroseconds; }
+
+private:
+	struct Entry
+	{
+		size_t nOffset;
+		uint32_t nSize;
+		bool bKeyframe;
+	};
+
+	// Make room for nSize contiguous bytes in the ring, dropping the
+	// oldest entries as needed. Returns false if it can never fit.
+	bool reserve(size_t nSize, size_t& nOffset);
+
+	std::vector<uint8_t> vRing;
+	size_t nHead = 0;
+	size_t nBytesUsed = 0;
+	std::deque<Entry> vEntries;
+
+	uint32_t nKeyframeInterval;
+	uint64_t nPushed = 0;
+
+	std::vector<uint8_t> vCurrent;
+	std::vector<uint8_t> vCompressed;
+	ByteIO::ByteStream stream;
+
+	double dLastRewindMicroseconds = 0.0;
+};
\ No newline at end of file
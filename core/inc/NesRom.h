@@ -2,9 +2,14 @@
 
 #include <cstdint>
 #include <string>
-#include <fstream>
+#include <memory>
 #include <vector>
 
+#include "NesRomImage.h"
+#include "NesTileCache.h"
+
+class NesArchive;
+
 enum MIRROR
 {
 	HARDWARE,
@@ -12,6 +17,18 @@ enum MIRROR
 	VERTICAL,
 	ONESCREEN_LO,
 	ONESCREEN_HI,
+	FOURSCREEN,
+};
+
+// Flags raised by a mapper when a register write changes what a bus
+// address resolves to. The buses cache direct pointers into cartridge
+// and nametable memory and only rebuild them when one of these is set.
+enum MAPDIRTY : uint8_t
+{
+	MAPDIRTY_PRG = 0x01,
+	MAPDIRTY_CHR = 0x02,
+	MAPDIRTY_MIRROR = 0x04,
+	MAPDIRTY_ALL = MAPDIRTY_PRG | MAPDIRTY_CHR | MAPDIRTY_MIRROR,
 };
 
 
@@ -39,7 +56,8 @@ public:
 	// Reset mapper to known state
 	virtual void reset() = 0;
 
-	// Get Mirror mode if mapper is in control
+	// Get Mirror mode if mapper is in control. A mapper that changes it
+	// raises MAPDIRTY_MIRROR.
 	virtual MIRROR mirror() { return MIRROR::HARDWARE; }
 
 	// IRQ Interface
@@ -49,6 +67,28 @@ public:
 	// Scanline Counting
 	virtual void scanline() {}
 
+	// How many more calls to scanline() until irqState() turns true, 0
+	// if it already is and NoIrq if it is not going to, so the bus can
+	// work out when the IRQ line rises without polling
+	static constexpr uint32_t NoIrq = 0xFFFFFFFF;
+	virtual uint32_t scanlinesUntilIrq() const { return NoIrq; }
+
+	// Static RAM on the cartridge at 0x6000 -> 0x7FFF, if there is any
+	virtual uint8_t* prgRam() { return nullptr; }
+
+	// Bank registers and cartridge RAM
+	virtual void Serialize(NesArchive& ar) {}
+
+	// A mapper in the same state, for a copy of the cartridge
+	virtual std::shared_ptr<Mapper> clone() const = 0;
+
+	// Memory the mapper has allocated for itself
+	virtual size_t privateBytes() const { return 0; }
+
+public:
+	// Set on bank switches, cleared once the bus has repointed its pages
+	uint8_t nMapDirty = MAPDIRTY_ALL;
+
 protected:
 	// These are stored locally as many of the mappers require this information
 	uint8_t nPRGBanks = 0;
@@ -59,6 +99,10 @@ class NesRom
 {
 public:	
 	NesRom(const std::string& sFileName);
+
+	// Another cartridge with the same ROM image and its own mapper and
+	// CHR RAM, starting out the same
+	NesRom(const NesRom& other);
 	~NesRom();
 
 public:
@@ -72,11 +116,29 @@ private:
 	uint8_t nPRGBanks = 0;
 	uint8_t nCHRBanks = 0;
 
-	std::vector<uint8_t> vPRGMemory;
-	std::vector<uint8_t> vCHRMemory;
+	// Identifies the image a save state belongs to
+	uint32_t nChecksum = 0;
+
+	// PRG ROM, and CHR ROM where there is some, are never written and
+	// come straight from the image every cartridge of the game shares.
+	// pCHR points at either the image or this cartridge's CHR RAM.
+	std::shared_ptr<const NesRomImage> pImage;
+	const uint8_t* pPRG = nullptr;
+	size_t nPRGSize = 0;
+	const uint8_t* pCHR = nullptr;
+	size_t nCHRSize = 0;
+	std::vector<uint8_t> vCHRRam;
+
+	// The two extra nametables of a four-screen cartridge
+	std::vector<uint8_t> vNameRam;
+
+	// Point pCHR and the tile cache at CHR RAM or ROM
+	void useCHR();
 
 	std::shared_ptr<Mapper> pMapper;
 
+	NesTileCache tileCache;
+
 public:
 	// Communication with Main Bus
 	bool cpuRead(uint16_t addr, uint8_t &data);
@@ -89,8 +151,47 @@ public:
 	// Permits system rest of mapper to know state
 	void reset();
 
+	// Mapper state and CHR RAM. The ROM itself is never stored.
+	void Serialize(NesArchive& ar);
+	uint8_t MapperID() const { return nMapperID; }
+	uint32_t Checksum() const { return nChecksum; }
+
+	// Whether both cartridges are copies of one loaded image
+	bool SharesImage(const NesRom& other) const { return pImage == other.pImage; }
+
+	// Bytes this cartridge holds for itself, and those of the image it
+	// shares with others
+	size_t PrivateBytes() const;
+	size_t SharedBytes() const { return pImage ? pImage->MemoryBytes() : 0; }
+
+	// The cartridge's IRQ output, see Mapper::scanlinesUntilIrq()
+	bool IrqState() { return pMapper->irqState(); }
+	uint32_t ScanlinesUntilIrq() const { return pMapper->scanlinesUntilIrq(); }
+
 	// Get Mirror configuration
 	MIRROR Mirror();
 
+	// Resolve the cartridge half of the CPU address space (0x4000 -> 0xFFFF)
+	// into direct pointers, one per 1KB page. Pages that cannot be
+	// accessed directly are left null.
+	void MapCpuPages(const uint8_t* pRead[64], uint8_t* pWrite[64]);
+	bool PRGMapDirty() { return pMapper->nMapDirty & MAPDIRTY_PRG; }
+
+	// Resolve the pattern tables (0x0000 -> 0x1FFF) the same way, also
+	// giving the offset into CHR memory each page starts at
+	void MapPpuPages(const uint8_t* pRead[8], uint32_t nOffset[8]);
+	bool CHRMapDirty() { return pMapper->nMapDirty & MAPDIRTY_CHR; }
+
+	// Point the four nametable slots (0x2000, 0x2400, 0x2800, 0x2C00) at
+	// the 1KB tables the mirroring selects, either one of the two in the
+	// console's 2KB of VRAM or, for four-screen, the cartridge's own
+	void MapNametables(uint8_t* pSlot[4], uint8_t* pVRAM);
+	bool MirrorDirty() { return pMapper->nMapDirty & MAPDIRTY_MIRROR; }
+
+	bool MapDirty() { return pMapper->nMapDirty != 0; }
+
+	// Decoded pattern tiles, by offset into CHR memory
+	NesTileCache& GetTileCache() { return tileCache; }
+
 	std::shared_ptr<Mapper> GetMapper();
 };
\ No newline at end of file
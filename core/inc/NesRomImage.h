@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "NesTileCache.h"
+
+// The read-only contents of an iNES file: its header, PRG ROM and CHR ROM.
+//
+// The file is mapped into memory rather than read, and every cartridge
+// loaded from the same file shares the one image, so a few hundred
+// machines running the same game hold a single copy of it between them.
+// An image stays open for as long as any cartridge refers to it.
+//
+// Everything a game can write to, CHR RAM and the RAM on the cartridge,
+// belongs to the cartridge and not to the image.
+class NesRomImage
+{
+public:
+	// The image of a file, shared with anyone who already has it open.
+	// Null if the file cannot be opened.
+	static std::shared_ptr<const NesRomImage> Open(const std::string& sFileName);
+
+	~NesRomImage();
+
+	NesRomImage(const NesRomImage&) = delete;
+	NesRomImage& operator=(const NesRomImage&) = delete;
+
+	uint8_t MapperID() const { return nMapperID; }
+	uint8_t PRGBanks() const { return nPRGBanks; }
+	uint8_t CHRBanks() const { return nCHRBanks; }
+	bool VerticalMirror() const { return bVerticalMirror; }
+
+	// The cartridge carries 2KB of nametable RAM of its own, so all four
+	// nametables are separate
+	bool FourScreen() const { return bFourScreen; }
+
+	// FNV-1a over PRG and CHR ROM, identifies the game a save state belongs to
+	uint32_t Checksum() const { return nChecksum; }
+
+	const uint8_t* PRG() const { return pPRG; }
+	size_t PRGSize() const { return nPRGSize; }
+
+	// Null, with a size of 0, when the cartridge has CHR RAM instead
+	const uint8_t* CHR() const { return pCHR; }
+	size_t CHRSize() const { return nCHRSize; }
+
+	// CHR ROM decoded up front, for every cartridge to draw from
+	const NesTileCache::Shared& Tiles() const { return tiles; }
+
+	// Bytes of the file mapped, or copied where it could not be mapped
+	size_t FileBytes() const { return nFileSize; }
+	bool Mapped() const { return pView != nullptr; }
+
+	// The file and the decoded tiles together
+	size_t MemoryBytes() const
+	{
+		return sizeof(NesRomImage) + (pView != nullptr ? nFileSize : 0) + vCopy.capacity() + tiles.vTiles.capacity() * sizeof(NesTileCache::Tile) + tiles.vValid.capacity();
+	}
+
+private:
+	NesRomImage() = default;
+
+	bool load(const std::string& sFileName);
+	bool map(const std::string& sFileName);
+	void unmap();
+
+	uint8_t nMapperID = 0;
+	uint8_t nPRGBanks = 0;
+	uint8_t nCHRBanks = 0;
+	bool bVerticalMirror = false;
+	bool bFourScreen = false;
+	uint32_t nChecksum = 0;
+
+	const uint8_t* pPRG = nullptr;
+	size_t nPRGSize = 0;
+	const uint8_t* pCHR = nullptr;
+	size_t nCHRSize = 0;
+
+	NesTileCache::Shared tiles;
+
+	// The whole file, either mapped or, failing that, read into vCopy.
+	// A file shorter than its header claims is also copied, padded out
+	// with zeros.
+	const uint8_t* pView = nullptr;
+	size_t nFileSize = 0;
+	void* hMapping = nullptr;
+	std::vector<uint8_t> vCopy;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pattern tiles decoded out of their two bit planes into one 2-bit
+// palette index per byte, so a renderer can pick up a whole row of 8
+// pixels with a single load. The lowest byte of a row is the leftmost
+// pixel, and every row is also kept mirrored for horizontally flipped
+// sprites.
+//
+// Tiles are keyed by their offset into CHR memory, which does not
+// change when the mapper switches banks, so only writes to CHR RAM
+// need to throw a decoded tile away. Tiles of CHR RAM are decoded on
+// first use, CHR ROM is decoded once when it is loaded and shared by
+// every cartridge made from it.
+class NesTileCache
+{
+public:
+	struct Tile
+	{
+		uint64_t row[8];
+		uint64_t row_flipped[8];
+	};
+
+	// Every tile of a CHR ROM, already decoded
+	struct Shared
+	{
+		std::vector<Tile> vTiles;
+		std::vector<uint8_t> vValid;
+	};
+
+	static void Decode(const uint8_t* pCHR, size_t nSize, Shared& shared);
+
+	// Tiles of writable CHR memory, decoded as they are used
+	void Reset(const uint8_t* pCHR, size_t nSize);
+
+	// Tiles of CHR ROM, which must outlive the cache
+	void Reset(const Shared& shared);
+
+	// A byte of CHR memory has changed. Only CHR RAM can change.
+	void Invalidate(uint32_t offset)
+	{
+		vValid[offset >> 4] = 0;
+	}
+
+	// All of CHR memory may have changed
+	void InvalidateAll()
+	{
+		std::fill(vValid.begin(), vValid.end(), 0);
+	}
+
+	// The row at a given CHR offset, which may point at either bit plane
+	uint64_t Row(uint32_t offset, bool bFlip)
+	{
+		const uint32_t nTile = offset >> 4;
+		if (!pValid[nTile])
+			decode(nTile);
+		return bFlip ? pTiles[nTile].row_flipped[offset & 0x07] : pTiles[nTile].row[offset & 0x07];
+	}
+
+	// Memory held by this cache rather than shared
+	size_t PrivateBytes() const { return vTiles.capacity() * sizeof(Tile) + vValid.capacity(); }
+
+	// Decode a row straight from its two bit planes
+	static uint64_t DecodeRow(uint8_t lo, uint8_t hi, bool bFlip);
+
+private:
+	void decode(uint32_t nTile);
+
+	const uint8_t* pCHR = nullptr;
+
+	// Either the vectors below or someone else's shared tiles
+	const Tile* pTiles = nullptr;
+	const uint8_t* pValid = nullptr;
+
+	std::vector<Tile> vTiles;
+	std::vector<uint8_t> vValid;
+};
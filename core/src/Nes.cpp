@@ -1,89 +1,264 @@
 #include "Nes.h"
 #include "NesBus.h"
 #include "NesRom.h"
-#include "Renderer.h"
-#include "SDL.h"
-#include <chrono>
-using namespace std::chrono;
-
-std::map<SDL_Scancode, uint8_t> keyMapper = {
-    {SDL_SCANCODE_X, 0x80},
-    {SDL_SCANCODE_Z, 0x40},
-    {SDL_SCANCODE_A, 0x20},
-    {SDL_SCANCODE_S, 0x10},
-
-    {SDL_SCANCODE_UP, 0x08},
-    {SDL_SCANCODE_DOWN, 0x04},
-    {SDL_SCANCODE_LEFT, 0x02},
-    {SDL_SCANCODE_RIGHT, 0x01},
+#include "NesArchive.h"
+#include "stdx/log.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+struct StateHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t mapper;
+    uint32_t checksum;
+    uint32_t payload; // Bytes of state following the header
 };
 
+constexpr char StateMagic[4] = { 'V', 'E', 'S', 'T' };
+
+}
+
+Nes::~Nes()
+{
+    delete bus;
+    delete rom;
+}
+
 bool Nes::Initialize()
 {
     bus = new NesBus();
-    audioSystem.Initialize(44100, 1);
+    bus->apu.SetSampleRate(MasterClockRate, NativeSampleRate);
+    vNativeSamples.reserve(NativeSampleRate / 30);
     SetSampleFrequency(44100);
-
-    dAudioRealTime = duration_cast< milliseconds >(
-        system_clock::now().time_since_epoch()).count() / 1000.0;
     return true;
 }
 
 void Nes::SetSampleFrequency(uint32_t sample_rate)
 {
-	dAudioTimePerSystemSample = 1.0 / (double)sample_rate;
-	dAudioTimePerNESClock = 1.0 / 5369318.0; // PPU Clock Frequency
+	nSampleRate = sample_rate;
+	resampler.SetRates(NativeSampleRate, sample_rate);
+
+	// A frame holds ~735 samples at 44.1kHz, leave headroom for higher rates
+	vAudioSamples.reserve(sample_rate / 30);
 }
 
 bool Nes::LoadGame(const std::string& filename)
 {
-    rom = new NesRom(filename);
+    NesRom* newRom = new NesRom(filename);
+    if (!newRom->ImageValid())
+    {
+        delete newRom;
+        return false;
+    }
+
+    delete rom;
+    rom = newRom;
     bus->loadRom(rom);
     bus->reset();
+
     return true;
 }
 
+std::unique_ptr<Nes> Nes::Clone() const
+{
+    auto pClone = std::make_unique<Nes>();
+    pClone->Initialize();
+    pClone->SetSampleFrequency(nSampleRate);
+    pClone->nRunAhead = nRunAhead;
+    if (rom != nullptr)
+    {
+        pClone->rom = new NesRom(*rom);
+        pClone->bus->loadRom(pClone->rom);
+        pClone->CopyStateFrom(*this);
+    }
+    return pClone;
+}
+
+bool Nes::CopyStateFrom(const Nes& other)
+{
+    if (rom == nullptr || other.rom == nullptr || !rom->SharesImage(*other.rom))
+        return false;
+
+    // The same image, so no header is needed to check against
+    copyState.seekp((size_t)0);
+    NesArchive save(copyState, false);
+    other.bus->Serialize(save);
+
+    copyState.seekg((size_t)0);
+    NesArchive load(copyState, true);
+    bus->Serialize(load);
+    return load.Ok();
+}
+
+void Nes::SetControllerState(uint8_t port, uint8_t buttons)
+{
+    bus->controller[port & 0x01] = buttons;
+}
+
+const Math::ColorRGB<uint8_t>* Nes::GetScreen()
+{
+    vScreen.resize(256 * 240);
+    bus->ppu.ConvertScreen(vScreen.data());
+    return vScreen.data();
+}
+
+const uint8_t* Nes::GetIndexedScreen() const
+{
+    return bus->ppu.GetScreen();
+}
+
+const uint8_t* Nes::GetScreenEmphasis() const
+{
+    return bus->ppu.GetScreenEmphasis();
+}
+
+const uint8_t* Nes::GetRam() const
+{
+    return bus->cpuRam;
+}
+
+void Nes::SetScreenBuffer(uint8_t* pBuffer)
+{
+    bus->ppu.SetScreenBuffer(pBuffer);
+}
+
+void Nes::DisableScreen()
+{
+    bus->ppu.DisableScreen();
+    std::vector<Math::ColorRGB<uint8_t>>().swap(vScreen);
+}
+
+Nes::MemoryUsage Nes::GetMemoryUsage() const
+{
+    MemoryUsage usage;
+    usage.machine = sizeof(NesBus);
+    usage.picture = bus->ppu.PrivateBytes() + vScreen.capacity() * sizeof(Math::ColorRGB<uint8_t>);
+    usage.audio = bus->apu.PrivateBytes() + resampler.PrivateBytes() + (vAudioSamples.capacity() + vNativeSamples.capacity()) * sizeof(int16_t);
+    usage.states = runAheadState.capacity() + copyState.capacity();
+    if (rom != nullptr)
+    {
+        usage.cartridge = rom->PrivateBytes();
+        usage.shared = rom->SharedBytes();
+    }
+    return usage;
+}
+
 int Nes::Tick()
 {
-    bus->controller[0] = 0;
-    const uint8_t* keystates = SDL_GetKeyboardState(NULL);
-    for (auto &&i : keyMapper)
+    if (nRunAhead == 0 || rom == nullptr)
     {
-        bus->controller[0] |= (keystates[i.first] ? i.second : 0); 
+        runFrame(true, true);
+        return 0;
     }
 
-    AudioQueue::BatchWriter audioWriter(audioSystem);
-    do {
-        bus->clock();
-        // Synchronising with Audio
-        dAudioTime += dAudioTimePerNESClock;
-        if (dAudioTime >= dAudioTimePerSystemSample)
-        {
-            dAudioTime -= dAudioTimePerSystemSample;
-            double s = bus->apu->GetOutputSample();
-            int16_t sample = s * 0x7FFF;
-            audioWriter.PushSample(sample);
-
-            // calculate audio frames
-            // double timeNow = duration_cast< milliseconds >(
-            //     system_clock::now().time_since_epoch()).count() / 1000.0;
-            // int audioRealFrames = (timeNow - dAudioRealTime)/dAudioTimePerSystemSample;
-            // for(int i = 0; i < audioRealFrames; ++i) {
-            //     audioWriter.PushSample(sample);
-            //     dAudioRealTime = timeNow;
-            // }
-        }
-    } while(!bus->ppu->frame_complete);
-    bus->ppu->frame_complete = false;
-
-    // dAudioRealTime = duration_cast< milliseconds >(
-    //     system_clock::now().time_since_epoch()).count() / 1000.0;
+    runFrame(false, true);
 
+    runAheadState.seekp((size_t)0);
+    SaveState(runAheadState);
+    for (uint32_t i = 1; i <= nRunAhead; i++)
+        runFrame(i == nRunAhead, false);
+
+    runAheadState.seekg((size_t)0);
+    LoadState(runAheadState);
     return 0;
 }
 
-void Nes::Present(Renderer * renderer)
+void Nes::runFrame(bool bPicture, bool bAudio)
+{
+    bus->ppu.bSkipPicture = !bPicture;
+    bus->apu.bSkipAudio = !bAudio;
+
+    do {
+        // An instruction that switches rendering on or off can move
+        // the end of the frame, so look again once it is reached
+        const uint64_t tick = bus->frameDeadline;
+        bus->RunUntil(tick);
+        if (tick == bus->frameDeadline)
+            bus->SyncPPU(tick);
+    } while(!bus->ppu.frame_complete);
+    bus->ppu.frame_complete = false;
+
+    // Bring the APU up to the end of the frame and collect the audio
+    // it synthesised along the way
+    bus->SyncAPU(bus->cpuClock);
+    bus->apu.EndAudioFrame();
+    if (bAudio)
+    {
+        vNativeSamples.resize(bus->apu.SamplesAvailable());
+        bus->apu.ReadSamples(vNativeSamples.data(), vNativeSamples.size());
+        vAudioSamples.resize(resampler.MaxOutput(vNativeSamples.size()));
+        vAudioSamples.resize(resampler.Process(vNativeSamples.data(), vNativeSamples.size(), vAudioSamples.data(), vAudioSamples.size()));
+    }
+
+    bus->ppu.bSkipPicture = false;
+    bus->apu.bSkipAudio = false;
+}
+
+bool Nes::SaveState(ByteIO::ByteStream& stream) const
 {
-    renderer->UpdateDisplayFrame(256, 240, bus->ppu->GetScreen());
-    renderer->DisplayFrame();
+    if (rom == nullptr)
+        return false;
+
+    StateHeader header = {};
+    std::memcpy(header.magic, StateMagic, sizeof(header.magic));
+    header.version = StateVersion;
+    header.mapper = rom->MapperID();
+    header.checksum = rom->Checksum();
+
+    // The payload size is filled in once it is known
+    const size_t nHeaderPos = stream.tellp();
+    stream.write((const char*)&header, sizeof(header));
+
+    NesArchive ar(stream, false);
+    bus->Serialize(ar);
+
+    const size_t nEnd = stream.tellp();
+    header.payload = (uint32_t)(nEnd - nHeaderPos - sizeof(header));
+    stream.seekp(nHeaderPos);
+    stream.write((const char*)&header, sizeof(header));
+    stream.seekp(nEnd);
+    return true;
+}
+
+bool Nes::LoadState(ByteIO::ByteStream& stream)
+{
+    if (rom == nullptr)
+        return false;
+
+    StateHeader header;
+    if (!stream.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, StateMagic, sizeof(header.magic)) != 0)
+    {
+        LogError("Not a save state");
+        return false;
+    }
+    if (header.version != StateVersion)
+    {
+        LogError("Save state version %u is not supported, expected %u", header.version, StateVersion);
+        return false;
+    }
+    if (header.mapper != rom->MapperID() || header.checksum != rom->Checksum())
+    {
+        LogError("Save state belongs to a different game");
+        return false;
+    }
+    if (stream.size() - stream.tellg() < header.payload)
+    {
+        LogError("Save state is truncated");
+        return false;
+    }
+
+    NesArchive ar(stream, true);
+    bus->Serialize(ar);
+    if (!ar.Ok())
+    {
+        // Past the checks above this means the state was saved by a
+        // build that laid it out differently, the machine needs a reset
+        LogError("Save state is corrupt");
+        return false;
+    }
+    return true;
 }
@@ -1,5 +1,8 @@
 #include "NesAPU2.h"
 #include "NesCPU.h"
+#include "NesArchive.h"
+#include <algorithm>
+#include <cstring>
 
 const uint8_t LENGTH_TABLE[] = {  10, 254, 20,  2, 40,  4, 80,  6,
 							        160,   8, 60, 10, 14, 12, 26, 14,
@@ -37,6 +40,41 @@ const uint8_t TRIANGLE_WAVEFORM[32] = {
     8,  9,  10, 11, 12, 13, 14, 15,
 };
 
+// CPU cycles from the start of a frame sequence to each of its steps, and
+// to the start of the next sequence, for the 4 and 5-step modes on NTSC.
+// https://www.nesdev.org/wiki/APU_Frame_Counter
+const uint32_t SEQUENCER_STEPS[2][5] = {
+    { 7457, 14913, 22371, 29829, 29830 },
+    { 7457, 14913, 22371, 29829, 37281 },
+};
+const uint32_t SEQUENCER_LENGTH[2] = { 29830, 37282 };
+
+// The mixer's two non-linear curves as lookup tables, the approximation
+// from https://www.nesdev.org/wiki/APU_Mixer. The pulse table is indexed
+// by pulse1 + pulse2 and the TND table by 3 * triangle + 2 * noise + dmc,
+// and both hold levels out of MIXER_SCALE. Built by the compiler.
+const int32_t MIXER_SCALE = 0x7FFF;
+
+struct MixerTables
+{
+    int32_t pulse[31];
+    int32_t tnd[203];
+};
+
+constexpr MixerTables MakeMixerTables()
+{
+    MixerTables tables = {};
+    for (int n = 1; n < 31; n++)
+        tables.pulse[n] = (int32_t)(95.52 / (8128.0 / n + 100.0) * MIXER_SCALE);
+    for (int n = 1; n < 203; n++)
+        tables.tnd[n] = (int32_t)(163.67 / (24329.0 / n + 100.0) * MIXER_SCALE);
+    return tables;
+}
+
+constexpr MixerTables MIXER_TABLES = MakeMixerTables();
+static_assert(MIXER_TABLES.pulse[0] == 0 && MIXER_TABLES.tnd[0] == 0, "Silence must mix to 0");
+static_assert(MIXER_TABLES.pulse[30] + MIXER_TABLES.tnd[202] <= MIXER_SCALE, "The mixer must not clip");
+
 void NesAPU2::SquareWave::reset()
 {
     enabled = false;
@@ -166,6 +204,34 @@ void NesAPU2::SquareWave::step_timer()
     }
 }
 
+// The same as calling step_timer() the given number of times. The timer
+// counts down to 0 and reloads on the tick after, so it goes round every
+// timer_period + 2 ticks.
+void NesAPU2::SquareWave::advance_timer(uint32_t ticks)
+{
+    if (ticks <= timer_value) {
+        timer_value -= ticks;
+        return;
+    }
+
+    ticks -= timer_value + 1;
+    const uint32_t length = timer_period + 2;
+    timer_value = timer_period + 1 - ticks % length;
+    duty_value = (duty_value + 1 + ticks / length) % 8;
+}
+
+// Whether the output can change when the timer next steps the duty
+// cycle, which it cannot while the channel is muted for any reason
+// other than the duty cycle itself
+bool NesAPU2::SquareWave::audible()
+{
+    if (!enabled || length_value == 0 || timer_period < 8 || timer_period > 0x7ff) {
+        return false;
+    }
+
+    return (envelope_enabled ? envelope_volume : constant_volume) != 0;
+}
+
 // $4000/$4004
 //
 // A channel's first register controls the envelope:
@@ -318,6 +384,35 @@ void NesAPU2::Noise::step_timer()
     }
 }
 
+// The same as calling step_timer() the given number of times. The shift
+// register is clocked once for every time the timer goes round, every
+// timer_period + 1 ticks.
+void NesAPU2::Noise::advance_timer(uint32_t ticks)
+{
+    if (ticks <= timer_value) {
+        timer_value -= ticks;
+        return;
+    }
+
+    ticks -= timer_value + 1;
+    const uint32_t length = timer_period + 1;
+    timer_value = timer_period - ticks % length;
+    for (uint32_t n = ticks / length + 1; n > 0; n--) {
+        auto feedback = (shift_register & 1) ^ ((shift_register >> shift_mode) & 1);
+        shift_register >>= 1;
+        shift_register |= feedback << 14;
+    }
+}
+
+bool NesAPU2::Noise::audible()
+{
+    if (!enabled || length_value == 0) {
+        return false;
+    }
+
+    return (envelope_enabled ? envelope_volume : constant_volume) != 0;
+}
+
 // $400c
 void NesAPU2::Noise::write_control(uint8_t val)
 {
@@ -399,6 +494,30 @@ void NesAPU2::TriangleWave::step_timer()
     }
 }
 
+// The same as calling step_timer() the given number of times, going
+// round every timer_period + 2 ticks like the square waves
+void NesAPU2::TriangleWave::advance_timer(uint32_t ticks)
+{
+    if (ticks <= timer_value) {
+        timer_value -= ticks;
+        return;
+    }
+
+    ticks -= timer_value + 1;
+    const uint32_t length = timer_period + 2;
+    timer_value = timer_period + 1 - ticks % length;
+    if (length_value > 0 && counter_value > 0) {
+        duty_value = (duty_value + 1 + ticks / length) % 32;
+    }
+}
+
+// The sequencer only moves while both counters are running, and the
+// output is 0 while either is not
+bool NesAPU2::TriangleWave::audible()
+{
+    return enabled && length_value > 0 && counter_value > 0;
+}
+
 void NesAPU2::TriangleWave::step_counter()
 {
     if (counter_reload) {
@@ -594,8 +713,44 @@ void NesAPU2::DMC::step_timer(NesCPU *cpu)
     }
 }
 
+// The same as calling step_timer() the given number of times while no
+// sample bytes are left to fetch. The shifter has at most 8 bits left.
+void NesAPU2::DMC::advance_timer(uint32_t ticks)
+{
+    if (!enabled) {
+        return;
+    }
+
+    if (ticks <= timer_value) {
+        timer_value -= ticks;
+        return;
+    }
+
+    ticks -= timer_value + 1;
+    const uint32_t length = timer_period + 1;
+    timer_value = timer_period - ticks % length;
+    for (uint32_t n = ticks / length + 1; n > 0 && bit_count != 0; n--) {
+        step_shifter();
+    }
+}
+
+bool NesAPU2::DMC::audible()
+{
+    return enabled && bit_count != 0;
+}
+
 NesAPU2::NesAPU2()
 {
+    // reset() leaves some fields alone, and the padding between fields
+    // goes into save states too, so start from zero for states of the
+    // same machine to be byte for byte the same
+    std::memset(&square1, 0, sizeof(square1));
+    std::memset(&square2, 0, sizeof(square2));
+    std::memset(&noise, 0, sizeof(noise));
+    std::memset(&triangle, 0, sizeof(triangle));
+    std::memset(&dmc, 0, sizeof(dmc));
+    restart_sequencer(cycles);
+    make_filters(44100);
 }
 
 NesAPU2::~NesAPU2()
@@ -610,6 +765,46 @@ void NesAPU2::reset()
     noise.reset();
     triangle.reset();
     dmc.reset();
+
+    restart_sequencer(cycles);
+
+    blip.Clear();
+    nAudioFrameStart = cycles;
+    nMixerInputs = 0;
+    nMixerLevel = 0;
+    for (int i = 0; i < 3; i++) {
+        filters[i].prev_x = filters[i].prev_y = FilterValue(0);
+        filtersDouble[i].prev_x = filtersDouble[i].prev_y = 0.0;
+    }
+}
+
+void NesAPU2::Serialize(NesArchive& ar)
+{
+    ar.Value(square1);
+    ar.Value(square2);
+    ar.Value(noise);
+    ar.Value(triangle);
+    ar.Value(dmc);
+
+    ar.Value(cycles);
+    ar.Value(sequencer_mode);
+    ar.Value(sequencer_value);
+    ar.Value(sequencer_start);
+    if (ar.Loading())
+        sequencer_next = sequencer_start + SEQUENCER_STEPS[sequencer_mode][sequencer_value];
+    ar.Value(irq);
+    ar.Value(frame_irq);
+
+    ar.Value(nAudioFrameStart);
+    ar.Value(nMixerInputs);
+    ar.Value(nMixerLevel);
+    blip.Serialize(ar);
+    for (int i = 0; i < 3; i++) {
+        ar.Value(filters[i].prev_x);
+        ar.Value(filters[i].prev_y);
+        ar.Value(filtersDouble[i].prev_x);
+        ar.Value(filtersDouble[i].prev_y);
+    }
 }
 
 void NesAPU2::cpuWrite(uint16_t addr, uint8_t data)
@@ -719,8 +914,15 @@ void NesAPU2::write_frame_counter(uint8_t data)
     sequencer_mode = (data & 0b10000000) == 0 ? SequencerMode::FourStep : SequencerMode::FiveStep;
 
     // IRQ inhibit flag. If this is set, we DON'T want to generate an IRQ.
-    // Hello, double-negatives.
+    // Hello, double-negatives. Setting it also acknowledges one that
+    // has already been raised.
     irq = (data & 0b01000000) == 0;
+    if (!irq)
+        frame_irq = false;
+
+    // The sequence starts over 3 or 4 cycles after the write, depending
+    // on whether it lands on an APU cycle, which is every other CPU cycle
+    restart_sequencer(cycles + ((cycles & 1) ? 4 : 3));
 
     // If the mode flag is clear, the 4-step sequence is selected,
     // otherwise the 5-step sequence is selected and the sequencer is
@@ -769,92 +971,60 @@ void NesAPU2::step_timers(NesCPU *cpu)
     }
 }
 
+void NesAPU2::restart_sequencer(uint64_t start)
+{
+    sequencer_start = start;
+    sequencer_value = 0;
+    sequencer_next = sequencer_start + SEQUENCER_STEPS[sequencer_mode][0];
+}
+
 void NesAPU2::step_sequencer()
 {
-    switch (sequencer_mode)
-    {
-    case SequencerMode::FiveStep:
-        sequencer_value = (sequencer_value+1)%5;
-        // mode 1: 5-step
-        // ---------------------------------------
-        //     - - - - -   IRQ flag (never set)
-        //     l - l - -   length counter + sweep
-        //     e e e e -   envelope + linear counter
-        switch (sequencer_value)
-        {
-        case 1:
-        case 3:
-            step_envelopes();
-            step_sweeps();
-            step_lengths();
-            break;
-        case 0:
-        case 2:
-            step_envelopes();
-            break;
-        default:
-            break;
-        }
-        break;
-    case SequencerMode::FourStep:
-        sequencer_value = (sequencer_value+1)%4;
-        // mode 0: 4-step
-        // ---------------------------------------
-        //     - - - f     IRQ flag
-        //     - l - l     length counter + sweep
-        //     e e e e     envelope + linear counter
-        switch (sequencer_value)
-        {
-        case 1:
-            step_envelopes();
-            step_sweeps();
-            step_lengths();
-            break;
-        case 3:
-            step_envelopes();
-            step_sweeps();
-            step_lengths();
-            if (irq) {
-                frame_irq = true;
-            }
-            break;
-        case 0:
-        case 2:
-            step_envelopes();
-            break;
-        default:
-            break;
-        }    
-        break;
-    default:
-        break;
+    // mode 0: 4-step              mode 1: 5-step
+    // ------------------------    --------------------------------------
+    //     - - - f                     - - - - -   IRQ flag (never set)
+    //     - l - l                     - l - - l   length counter + sweep
+    //     e e e e                     e e e - e   envelope + linear counter
+    const bool bFiveStep = sequencer_mode == SequencerMode::FiveStep;
+    const uint8_t nSteps = bFiveStep ? 5 : 4;
+    sequencer_value++;
+
+    if (!(bFiveStep && sequencer_value == 4))
+        step_envelopes();
+    if (sequencer_value == 2 || sequencer_value == nSteps) {
+        step_sweeps();
+        step_lengths();
     }
+    if (!bFiveStep && sequencer_value == 4 && irq) {
+        frame_irq = true;
+    }
+
+    // The last step starts the next sequence
+    if (sequencer_value == nSteps) {
+        sequencer_start += SEQUENCER_LENGTH[sequencer_mode];
+        sequencer_value = 0;
+    }
+    sequencer_next = sequencer_start + SEQUENCER_STEPS[sequencer_mode][sequencer_value];
 }
 
 void NesAPU2::clock(NesCPU *cpu)
 {
-    double cycle1 = (double)cycles;
     cycles += 1;
-    double cycle2 = (double)cycles;
 
     step_timers(cpu);
 
     // https://wiki.nesdev.com/w/index.php/APU_Frame_Counter
     //
-    // The sequencer is stepped at a rate of 240Hz or 192Hz, depending on
-    // the mode. The way this happens is that we check if the previous
-    // cycle and the current cycle crosses a multiple of 240. And if it
-    // does, the sequencer is clocked.
-    //
-    // The five-step sequence is clocked at 192Hz, but this is achieved by
-    // doing nothing on one of the steps, as 192 is 4/5 of 240.
-    double sequencer_rate = 1789773.0 / 240.0;
-    uint32_t f1 = (uint32_t)(cycle1 / sequencer_rate);
-    uint32_t f2 = (uint32_t)(cycle2 / sequencer_rate);
-    if (f1 != f2) {
+    // The sequencer is stepped at roughly 240Hz, on fixed cycles from the
+    // start of its sequence. The five-step sequence does nothing on one
+    // of its steps.
+    if (cycles >= sequencer_next) {
         step_sequencer();
     }
 
+    if (!bSkipAudio)
+        updateOutput();
+
     // The sampling rate is 44.1kHz. The way we do this is the same as the
     // sequencer (see explanation above).
     // double sample_rate = 1789773.0 / 44100.0;
@@ -867,26 +1037,176 @@ void NesAPU2::clock(NesCPU *cpu)
     // res.trigger_irq = self.frame_irq || self.dmc.irq_flag();   
 }
 
+void NesAPU2::Run(NesCPU *cpu, uint64_t nCycles)
+{
+    const uint64_t end = cycles + nCycles;
+
+    // Registers written since the last run are heard from its first cycle
+    if (cycles < end) {
+        clock(cpu);
+    }
+
+    while (cycles < end) {
+        // Every sample byte is fetched on a cycle of its own, stealing
+        // from the CPU, so while there are some left go one at a time
+        if (DMCActive() || bEveryCycle) {
+            clock(cpu);
+            continue;
+        }
+
+        skip_to(next_event(end) - 1);
+        clock(cpu);
+    }
+}
+
+uint64_t NesAPU2::next_event(uint64_t end)
+{
+    uint64_t event = end < sequencer_next ? end : sequencer_next;
+    if (!bSkipAudio) {
+        // The triangle's timer ticks on every cycle and the others on
+        // even cycles, starting from the next one
+        const uint64_t even = (cycles + 2) & ~1ull;
+        if (triangle.audible() && cycles + triangle.timer_value + 1 < event) {
+            event = cycles + triangle.timer_value + 1;
+        }
+        if (square1.audible() && even + 2ull * square1.timer_value < event) {
+            event = even + 2ull * square1.timer_value;
+        }
+        if (square2.audible() && even + 2ull * square2.timer_value < event) {
+            event = even + 2ull * square2.timer_value;
+        }
+        if (noise.audible() && even + 2ull * noise.timer_value < event) {
+            event = even + 2ull * noise.timer_value;
+        }
+        if (dmc.audible() && even + 2ull * dmc.timer_value < event) {
+            event = even + 2ull * dmc.timer_value;
+        }
+    }
+    return event > cycles ? event : cycles + 1;
+}
+
+void NesAPU2::skip_to(uint64_t cycle)
+{
+    if (cycle <= cycles) {
+        return;
+    }
+
+    const uint32_t ticks = (uint32_t)(cycle - cycles);
+    const uint32_t even_ticks = (uint32_t)(cycle / 2 - cycles / 2);
+    triangle.advance_timer(ticks);
+    square1.advance_timer(even_ticks);
+    square2.advance_timer(even_ticks);
+    noise.advance_timer(even_ticks);
+    dmc.advance_timer(even_ticks);
+    cycles = cycle;
+}
+
+uint64_t NesAPU2::CyclesUntilIrq() const
+{
+    if (IrqLine() || (dmc.irq_enabled && DMCActive()))
+        return 0;
+    if (!irq || sequencer_mode != SequencerMode::FourStep)
+        return NoIrq;
+
+    // The flag is raised by the fourth step, on the cycle clock() reaches it
+    const uint64_t nCycle = sequencer_start + SEQUENCER_STEPS[SequencerMode::FourStep][3];
+    return nCycle > cycles ? nCycle - cycles : 1;
+}
+
+void NesAPU2::SetSampleRate(uint32_t nClockRate, uint32_t nSampleRate)
+{
+    blip.SetRates(nClockRate, nSampleRate);
+    nAudioFrameStart = cycles;
+    nMixerInputs = 0;
+    nMixerLevel = 0;
+    make_filters(nSampleRate);
+}
+
+void NesAPU2::make_filters(uint32_t samplerate)
+{
+    // https://www.nesdev.org/wiki/APU_Mixer
+    filters[0] = PassFilter<FilterValue>::high_pass(samplerate, 90);
+    filters[1] = PassFilter<FilterValue>::high_pass(samplerate, 440);
+    filters[2] = PassFilter<FilterValue>::low_pass(samplerate, 14000);
+    filtersDouble[0] = PassFilter<double>::high_pass(samplerate, 90);
+    filtersDouble[1] = PassFilter<double>::high_pass(samplerate, 440);
+    filtersDouble[2] = PassFilter<double>::low_pass(samplerate, 14000);
+}
+
+size_t NesAPU2::ReadSamples(int16_t* pOut, size_t nMax)
+{
+    const size_t nCount = blip.ReadSamples(pOut, nMax);
+    for (size_t i = 0; i < nCount; i++) {
+        int64_t sample;
+        if (bFilterDouble) {
+            sample = (int64_t)filtersDouble[2].process(filtersDouble[1].process(filtersDouble[0].process(pOut[i])));
+        } else {
+            sample = (int64_t)filters[2].process(filters[1].process(filters[0].process(FilterValue(pOut[i]))));
+        }
+        pOut[i] = (int16_t)std::clamp<int64_t>(sample, -32768, 32767);
+    }
+    return nCount;
+}
+
+void NesAPU2::EndAudioFrame()
+{
+    blip.EndFrame((uint32_t)(cycles - nAudioFrameStart) * 3);
+    nAudioFrameStart = cycles;
+}
+
+void NesAPU2::updateOutput()
+{
+    // Channel outputs only change on a few of the cycles, and only then
+    // is there anything to mix and hand to the blip buffer
+    const uint8_t p1 = square1.signal();
+    const uint8_t p2 = square2.signal();
+    const uint8_t t = triangle.signal();
+    const uint8_t n = noise.signal();
+    const uint8_t d = dmc.signal();
+    const uint32_t inputs = p1 | (p2 << 4) | (t << 8) | (n << 12) | (d << 16);
+    if (inputs == nMixerInputs)
+        return;
+
+    nMixerInputs = inputs;
+    const int32_t level = mixLevel(p1, p2, t, n, d);
+    blip.AddDelta((uint32_t)(cycles - nAudioFrameStart) * 3, level - nMixerLevel);
+    nMixerLevel = level;
+}
+
 double NesAPU2::GetOutputSample()
+{
+    return (double)mixLevel(square1.signal(), square2.signal(), triangle.signal(), noise.signal(), dmc.signal()) / MIXER_SCALE;
+}
+
+int32_t NesAPU2::mixLevel(uint8_t pulse1, uint8_t pulse2, uint8_t triangle, uint8_t noise, uint8_t dmc) const
+{
+    if (bMixerFormula)
+        return (int32_t)(mix(pulse1, pulse2, triangle, noise, dmc) * MIXER_SCALE);
+    return MIXER_TABLES.pulse[pulse1 + pulse2] + MIXER_TABLES.tnd[3 * triangle + 2 * noise + dmc];
+}
+
+double NesAPU2::mix(uint8_t pulse1, uint8_t pulse2, uint8_t triangle, uint8_t noise, uint8_t dmc)
 {
     // https://www.nesdev.org/wiki/APU_Mixer
-    double pulse = square1.signal() + square2.signal();
-    double n = noise.signal();
-    double tr = triangle.signal();
-    double dmc = this->dmc.signal();
+    double pulse = pulse1 + pulse2;
+    double n = noise;
+    double tr = triangle;
 
     //** linear approximation
     // double pulse_out = 0.00752 * pulse;
     // double tnd_out = 0.00851 * tr + 0.00494 * n + 0.00335 * dmc;
     
-    double pulse_out = 95.88 / (100.0 + (8128.0 / pulse));
-    double tnd_out = 159.79 / (100.0
+    // Silent channels would divide by zero
+    double pulse_out = 0.0;
+    if (pulse1 + pulse2 != 0)
+        pulse_out = 95.88 / (100.0 + (8128.0 / pulse));
+    double tnd_out = 0.0;
+    if (triangle + noise + dmc != 0)
+        tnd_out = 159.79 / (100.0
                             + (1.0 / (  (tr / 8227.0)
                                         + (n / 12241.0)
                                         + (dmc / 22638.0))));
     double out = pulse_out + tnd_out;                                        
 
     return out;
-    // return passFilters[2].process(passFilters[1].process(passFilters[0].process(out)));
-    // return passFilters[0].process(passFilters[1].process(passFilters[2].process(pulse_val)));
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "NesBatchRunner.h"
+#include "Nes.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace
+{
+
+bool pinToCore(std::thread& thread, int core)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core) != 0;
+#else
+	return false;
+#endif
+}
+
+}
+
+NesBatchRunner::NesBatchRunner(const std::string& rom, size_t nInstances, uint32_t nThreads, bool bPinThreads)
+{
+	if (nInstances == 0)
+		return;
+
+	auto pFirst = std::make_unique<Nes>();
+	pFirst->Initialize();
+	if (!pFirst->LoadGame(rom))
+		return;
+
+	vInstances.reserve(nInstances);
+	vInstances.push_back(std::move(pFirst));
+	while (vInstances.size() < nInstances)
+		vInstances.push_back(vInstances.front()->Clone());
+
+	const uint32_t nCores = std::max(std::thread::hardware_concurrency(), 1u);
+	if (nThreads == 0)
+		nThreads = nCores;
+	nThreads = (uint32_t)std::min<size_t>(nThreads, nInstances);
+
+	for (uint32_t i = 0; i < nThreads; i++)
+		vWorkers.push_back(std::make_unique<Worker>());
+	for (uint32_t i = 0; i < nThreads; i++)
+	{
+		Worker& worker = *vWorkers[i];
+		worker.thread = std::thread(&NesBatchRunner::workerMain, this, (size_t)i);
+		if (bPinThreads && pinToCore(worker.thread, (int)(i % nCores)))
+			worker.stats.core = (int)(i % nCores);
+	}
+}
+
+NesBatchRunner::~NesBatchRunner()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bQuit = true;
+	}
+	cvStart.notify_all();
+	for (auto& pWorker : vWorkers)
+		pWorker->thread.join();
+}
+
+void NesBatchRunner::ResetAllTo(size_t nSource)
+{
+	for (size_t i = 0; i < vInstances.size(); i++)
+	{
+		if (i != nSource)
+			vInstances[i]->CopyStateFrom(*vInstances[nSource]);
+	}
+}
+
+void NesBatchRunner::Step(const uint8_t* pActions, uint32_t nFrames, uint8_t* pFrames, uint8_t* pRam)
+{
+	if (vWorkers.empty())
+		return;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	this->pActions = pActions;
+	this->nFrames = nFrames;
+	this->pFrames = pFrames;
+	this->pRam = pRam;
+
+	// Equal shares to begin with
+	const size_t nWorkers = vWorkers.size();
+	for (size_t w = 0; w < nWorkers; w++)
+	{
+		vWorkers[w]->next.store(vInstances.size() * w / nWorkers, std::memory_order_relaxed);
+		vWorkers[w]->end = vInstances.size() * (w + 1) / nWorkers;
+	}
+
+	nBusy = nWorkers;
+	nGeneration++;
+	cvStart.notify_all();
+	cvDone.wait(lock, [this] { return nBusy == 0; });
+}
+
+std::vector<NesBatchRunner::WorkerStatistics> NesBatchRunner::GetStatistics() const
+{
+	// Workers only touch their statistics inside Step()
+	std::vector<WorkerStatistics> vStats;
+	for (const auto& pWorker : vWorkers)
+		vStats.push_back(pWorker->stats);
+	return vStats;
+}
+
+void NesBatchRunner::ResetStatistics()
+{
+	for (auto& pWorker : vWorkers)
+	{
+		const int core = pWorker->stats.core;
+		pWorker->stats = WorkerStatistics{};
+		pWorker->stats.core = core;
+	}
+}
+
+void NesBatchRunner::workerMain(size_t nWorker)
+{
+	uint64_t nSeen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cvStart.wait(lock, [&] { return bQuit || nGeneration != nSeen; });
+			if (bQuit)
+				return;
+			nSeen = nGeneration;
+		}
+
+		runShare(nWorker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--nBusy == 0)
+			cvDone.notify_one();
+	}
+}
+
+void NesBatchRunner::runShare(size_t nWorker)
+{
+	Worker& self = *vWorkers[nWorker];
+	const auto start = std::chrono::steady_clock::now();
+
+	uint64_t nRun = 0;
+	for (size_t i; (i = self.next.fetch_add(1, std::memory_order_relaxed)) < self.end; )
+	{
+		runInstance(i);
+		nRun++;
+	}
+
+	// Then help the others, starting with the next worker along
+	for (size_t k = 1; k < vWorkers.size(); k++)
+	{
+		Worker& victim = *vWorkers[(nWorker + k) % vWorkers.size()];
+		for (size_t i; (i = victim.next.fetch_add(1, std::memory_order_relaxed)) < victim.end; )
+		{
+			runInstance(i);
+			nRun++;
+			self.stats.stolen++;
+		}
+	}
+
+	self.stats.frames += nRun * nFrames;
+	self.stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void NesBatchRunner::runInstance(size_t i)
+{
+	Nes& nes = *vInstances[i];
+	nes.SetControllerState(0, pActions != nullptr ? pActions[i] : 0);
+	for (uint32_t f = 0; f < nFrames; f++)
+		nes.Tick();
+
+	if (pFrames != nullptr)
+		std::memcpy(pFrames + i * FrameBytes, nes.GetIndexedScreen(), FrameBytes);
+	if (pRam != nullptr)
+		std::memcpy(pRam + i * RamBytes, nes.GetRam(), RamBytes);
+}
@@ -0,0 +1,146 @@
+#include "NesBlipBuffer.h"
+#include "NesArchive.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// A windowed sinc for each sub-sample position of a step. It does not
+// depend on the rates, so one table serves every buffer.
+struct Kernel
+{
+	int16_t taps[NesBlipBuffer::Phases][NesBlipBuffer::Taps];
+
+	Kernel(int nKernelBits)
+	{
+		constexpr int Phases = NesBlipBuffer::Phases;
+		constexpr int Taps = NesBlipBuffer::Taps;
+
+		// Cut off a little below Nyquist so the window's transition band
+		// stays clear of the folding frequency
+		const double pi = 3.14159265358979323846;
+		const double cutoff = 0.9;
+		for (int p = 0; p < Phases; p++)
+		{
+			double sinc_taps[Taps];
+			double sum = 0.0;
+			for (int i = 0; i < Taps; i++)
+			{
+				const double t = i - (Taps / 2 - 1) - (double)p / Phases;
+				const double x = pi * cutoff * t;
+				const double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+				const double window = 0.42 + 0.5 * std::cos(2.0 * pi * t / Taps) + 0.08 * std::cos(4.0 * pi * t / Taps);
+				sinc_taps[i] = sinc * window;
+				sum += sinc_taps[i];
+			}
+
+			// Every phase must add exactly one unit to the integrator, or a
+			// step would leave a residue that slowly builds up
+			int32_t total = 0;
+			int nLargest = 0;
+			for (int i = 0; i < Taps; i++)
+			{
+				taps[p][i] = (int16_t)std::lround(sinc_taps[i] / sum * (1 << nKernelBits));
+				total += taps[p][i];
+				if (taps[p][i] > taps[p][nLargest])
+					nLargest = i;
+			}
+			taps[p][nLargest] += (int16_t)((1 << nKernelBits) - total);
+		}
+	}
+};
+
+}
+
+const NesBlipBuffer::KernelPhase* NesBlipBuffer::kernel()
+{
+	static const Kernel k(KernelBits);
+	return k.taps;
+}
+
+void NesBlipBuffer::SetRates(uint32_t nClockRate, uint32_t nSampleRate)
+{
+	this->nClockRate = nClockRate;
+	this->nSampleRate = nSampleRate;
+
+	Clear();
+}
+
+void NesBlipBuffer::Clear()
+{
+	// Room for a few frames worth of samples, the host should be
+	// reading them after every frame
+	vDeltas.assign(nSampleRate / 10 + Taps, 0);
+	nFramePhase = 0;
+	nAvailable = 0;
+	nIntegrator = 0;
+}
+
+void NesBlipBuffer::AddDelta(uint32_t nTime, int32_t nDelta)
+{
+	const uint64_t nPos = nFramePhase + (uint64_t)nTime * nSampleRate;
+	const size_t nIndex = nAvailable + (size_t)(nPos / nClockRate);
+	if (nIndex + Taps > vDeltas.size())
+		return;
+
+	const int nPhase = (int)((nPos % nClockRate) * Phases / nClockRate);
+	int32_t* pOut = vDeltas.data() + nIndex;
+	for (int i = 0; i < Taps; i++)
+		pOut[i] += nKernel[nPhase][i] * nDelta;
+}
+
+void NesBlipBuffer::EndFrame(uint32_t nTime)
+{
+	const uint64_t nPos = nFramePhase + (uint64_t)nTime * nSampleRate;
+	nAvailable = std::min(nAvailable + (size_t)(nPos / nClockRate), vDeltas.size() - Taps);
+	nFramePhase = nPos % nClockRate;
+}
+
+void NesBlipBuffer::Serialize(NesArchive& ar)
+{
+	uint32_t nRate = nSampleRate;
+	uint32_t nPending = (uint32_t)nAvailable + Taps;
+	ar.Value(nRate);
+	ar.Value(nFramePhase);
+	ar.Value(nPending);
+	ar.Value(nIntegrator);
+
+	// A state saved at another sample rate still has to be read past,
+	// but its samples cannot be used
+	if (ar.Loading() && (nRate != nSampleRate || nPending > vDeltas.size()))
+	{
+		std::vector<int32_t> vSkip(nPending);
+		ar.Bytes(vSkip.data(), nPending * sizeof(int32_t));
+		Clear();
+		return;
+	}
+
+	ar.Bytes(vDeltas.data(), nPending * sizeof(int32_t));
+	if (ar.Loading())
+	{
+		nAvailable = nPending - Taps;
+		std::fill(vDeltas.begin() + nPending, vDeltas.end(), 0);
+	}
+}
+
+size_t NesBlipBuffer::ReadSamples(int16_t* pOut, size_t nMax)
+{
+	const size_t nCount = std::min(nMax, nAvailable);
+	for (size_t i = 0; i < nCount; i++)
+	{
+		nIntegrator += vDeltas[i];
+		const int32_t s = nIntegrator >> KernelBits;
+		pOut[i] = (int16_t)std::clamp<int32_t>(s, -32768, 32767);
+		nIntegrator -= nIntegrator >> BassShift;
+	}
+
+	// Move the samples still to come, and the tails of the steps
+	// reaching past them, to the front
+	const size_t nRemaining = nAvailable - nCount + Taps;
+	std::memmove(vDeltas.data(), vDeltas.data() + nCount, nRemaining * sizeof(int32_t));
+	std::fill_n(vDeltas.data() + nRemaining, nCount, 0);
+	nAvailable -= nCount;
+	return nCount;
+}
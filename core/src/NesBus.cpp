@@ -1,15 +1,43 @@
 #include "NesBus.h"
+#include "NesArchive.h"
+#include <algorithm>
+
+// See the layout notes in NesBus.h before letting this grow
+static_assert(sizeof(NesBus) <= NesBus::ByteBudget, "NesBus has outgrown its byte budget");
+static_assert(alignof(NesBus) == 64, "NesBus should start on a cache line");
 
 NesBus::NesBus()
 {
-    cpu = new NesCPU();
-    ppu = new NesPPU();
-    apu = new NesAPU2();
-    cpu->ConnectBus(this);
+    cpu.ConnectBus(this);
+
+    // 2KB of system RAM, mirrored four times through 0x0000 -> 0x1FFF
+    for (int page = 0x00; page < 0x08; page++)
+    {
+        pReadPage[page] = cpuRam + (page & 0x01) * 0x0400;
+        pWritePage[page] = cpuRam + (page & 0x01) * 0x0400;
+    }
+}
+
+void NesBus::mapCartridgePages()
+{
+    if (rom->PRGMapDirty())
+        rom->MapCpuPages(pReadPage, pWritePage);
+    if (rom->CHRMapDirty())
+        ppu.mapPatternPages();
+    if (rom->MirrorDirty())
+        ppu.mapNametables();
 }
 
-void NesBus::cpuWrite(uint16_t addr, uint8_t data)
+void NesBus::cpuWriteSlow(uint16_t addr, uint8_t data)
 {
+    // Whatever is being written to must first be brought up to the
+    // moment this instruction started. Mapper registers can switch the
+    // pattern memory the PPU is drawing from.
+    if ((addr >= 0x2000 && addr <= 0x3FFF) || addr >= 0x4020)
+        SyncPPU(cpuClock * 3);
+    else if (addr >= 0x4000 && addr <= 0x4017)
+        SyncAPU(cpuClock);
+
     if (rom->cpuWrite(addr, data))
     {
         // The cartridge "sees all" and has the facility to veto
@@ -34,26 +62,40 @@ void NesBus::cpuWrite(uint16_t addr, uint8_t data)
         // and these are repeated throughout this range. We can
         // use bitwise AND operation to mask the bottom 3 bits, 
         // which is the equivalent of addr % 8.
-        ppu->cpuWrite(addr & 0x0007, data);
+        ppu.cpuWrite(addr & 0x0007, data);
+
+        // Switching rendering on or off moves the odd frame dot skip
+        updateDeadlines();
     }
     else if ((addr >= 0x4000 && addr <= 0x4013) || addr == 0x4015 || addr == 0x4017) //  NES APU
 	{
-		apu->cpuWrite(addr, data);
+		apu.cpuWrite(addr, data);
+		updateApuIrqDeadline();
 	}
     else if (addr == 0x4014)
     {
-        // A write to this address initiates a DMA transfer
+        // A write to this address initiates a DMA transfer. The
+        // page is copied straight away, the CPU pays for it after
+        // this instruction.
         dma_page = data;
-        dma_addr = 0x00;
-        dma_transfer = true;						
+        for (uint16_t dma_addr = 0x00; dma_addr < 0x100; dma_addr++)
+            ppu.WritePAM(dma_addr, cpuRead(dma_page << 8 | dma_addr));
+        dma_transfer = true;
     }
     else if (addr >= 0x4016 && addr <= 0x4017)
     {
         controller_state[addr & 0x0001] = controller[addr & 0x0001];
     }
+
+    // Mapper registers live under the cartridge ROM, so this write
+    // may have switched banks or changed the IRQ counter
+    if (rom->MapDirty())
+        mapCartridgePages();
+    if (addr >= 0x4020)
+        updateDeadlines();
 }
 
-uint8_t NesBus::cpuRead(uint16_t addr, bool bReadOnly)
+uint8_t NesBus::cpuReadSlow(uint16_t addr, bool bReadOnly)
 {
     uint8_t data = 0x00;
     if (rom->cpuRead(addr, data))
@@ -68,12 +110,15 @@ uint8_t NesBus::cpuRead(uint16_t addr, bool bReadOnly)
     else if (addr >= 0x2000 && addr <= 0x3FFF)
     {
         // PPU Address range, mirrored every 8
-        data = ppu->cpuRead(addr & 0x0007, bReadOnly);
+        SyncPPU(cpuClock * 3);
+        data = ppu.cpuRead(addr & 0x0007, bReadOnly);
     }
    	else if (addr == 0x4015)
 	{
 		// APU Read Status
-		data = apu->cpuRead(addr);
+		SyncAPU(cpuClock);
+		data = apu.cpuRead(addr);
+		updateApuIrqDeadline();
 	}
     else if (addr >= 0x4016 && addr <= 0x4017)
     {
@@ -87,92 +132,189 @@ uint8_t NesBus::cpuRead(uint16_t addr, bool bReadOnly)
 bool NesBus::loadRom(NesRom* rom)
 {
     this->rom = rom;
-    this->ppu->loadRom(rom);
+    this->ppu.loadRom(rom);
+    mapCartridgePages();
     return true;
 }
 
 void NesBus::reset()
 {
-    cpu->Reset();
-    ppu->reset();
-    apu->reset();
+    cpu.Reset();
+    ppu.reset();
+    apu.reset();
     rom->reset();
-    sysClockCounter = 0;
+    mapCartridgePages();
+
+    // The CPU spends 8 cycles resetting before its first instruction
+    cpu.cycles = 0;
+    cpuClock = 8;
+    ppuClock = 0;
+    apuClock = 0;
+    dma_transfer = false;
+    updateDeadlines();
+    updateApuIrqDeadline();
 }
-void NesBus::clock()
+
+void NesBus::Serialize(NesArchive& ar)
 {
-    // Clocking. The heart and soul of an emulator. The running
-    // frequency is controlled by whatever calls this function.
-    // So here we "divide" the clock as necessary and call
-    // the peripheral devices clock() function at the correct
-    // times.
-
-    // The fastest clock frequency the digital system cares
-    // about is equivalent to the PPU clock. So the PPU is clocked
-    // each time this function is called.
-    ppu->clock();
-
-    // The CPU runs 3 times slower than the PPU so we only call its
-    // clock() function every 3 times this function is called. We
-    // have a global counter to keep track of this.
-    if (sysClockCounter % 3 == 0)
-    {
-        // Is the system performing a DMA transfer form CPU memory to 
-        // OAM memory on PPU?...
-        if (dma_transfer)
+    cpu.Serialize(ar);
+    ppu.Serialize(ar);
+    apu.Serialize(ar);
+    rom->Serialize(ar);
+
+    ar.Value(cpuRam);
+    ar.Value(controller);
+    ar.Value(controller_state);
+    ar.Value(cpuClock);
+    ar.Value(ppuClock);
+    ar.Value(apuClock);
+    ar.Value(dma_page);
+    ar.Value(dma_transfer);
+
+    if (ar.Loading())
+    {
+        mapCartridgePages();
+        updateDeadlines();
+        updateApuIrqDeadline();
+    }
+}
+
+void NesBus::RunUntil(uint64_t tick)
+{
+    // An instruction belongs to the frame in which it starts
+    while (cpuClock * 3 <= std::min(tick, frameDeadline))
+        executeInstruction();
+}
+
+void NesBus::executeInstruction()
+{
+    // While a DMC sample is playing the APU is kept in step with the
+    // CPU, as each byte it fetches stalls the CPU by a few cycles and
+    // pushes back the start of this instruction
+    if (apu.DMCActive())
+    {
+        uint64_t nStart;
+        do {
+            nStart = cpuClock;
+            SyncAPU(cpuClock);
+        } while (cpuClock != nStart);
+    }
+
+    const uint64_t nStart = cpuClock;
+    uint64_t nEnd = nStart + cpu.Execute();
+
+    // The CPU next clocks the cycle after the instruction started,
+    // unless it was suspended for an OAM DMA
+    uint64_t nResume = nStart + 1;
+    if (dma_transfer)
+    {
+        const uint64_t nLength = (nStart + 1) & 1 ? 513 : 514;
+        dma_transfer = false;
+        nResume += nLength;
+        nEnd += nLength;
+    }
+
+    // The PPU is capable of emitting an interrupt to indicate the
+    // vertical blanking period has been entered. If this happens while
+    // the instruction is still counting down its cycles, the remainder
+    // are abandoned and the CPU starts servicing the interrupt on its
+    // next clock. A register read can also have raised it already, on
+    // the very tick the instruction started.
+    uint64_t nNmiTick = nStart * 3;
+    if (nmiDeadline < nEnd * 3)
+    {
+        nNmiTick = nmiDeadline;
+        SyncPPU(nmiDeadline);
+    }
+    if (ppu.nmi)
+    {
+        ppu.nmi = false;
+        cpu.nmi();
+        nEnd = std::max(nNmiTick / 3 + 1, nResume) + 8;
+    }
+
+    // IRQ is a level rather than an edge. The cartridge and the APU are
+    // only caught up to see whether they raised it once their predicted
+    // deadlines say they will have, then, as for NMI, an interrupt raised
+    // before the instruction finished is taken straight after it. While
+    // the line stays raised its deadlines are 0, and it is taken as soon
+    // as the I flag is cleared.
+    else if (std::min(mapperIrqDeadline, apuIrqDeadline) < nEnd * 3)
+    {
+        uint64_t nIrqTick = nStart * 3;
+        if (mapperIrqDeadline < nEnd * 3 && mapperIrqDeadline >= ppuClock)
+        {
+            nIrqTick = mapperIrqDeadline;
+            SyncPPU(mapperIrqDeadline);
+        }
+        if (apuIrqDeadline < nEnd * 3 && apuIrqDeadline / 3 >= apuClock)
+        {
+            // A DMC fetch on the way would stall the instruction
+            const uint64_t nClock = cpuClock;
+            nIrqTick = std::max(nIrqTick, apuIrqDeadline);
+            SyncAPU(apuIrqDeadline / 3 + 1);
+            nEnd += cpuClock - nClock;
+            nResume += cpuClock - nClock;
+            cpuClock = nClock;
+        }
+        if (irqLine() && !cpu.GetFlag(NesCPU::I))
         {
-            // ...Yes! We need to wait until the next even CPU clock cycle
-            // before it starts...
-            if (dma_dummy)
-            {
-                // ...So hang around in here each clock until 1 or 2 cycles
-                // have elapsed...
-                if (sysClockCounter % 2 == 1)
-                {
-                    // ...and finally allow DMA to start
-                    dma_dummy = false;
-                }
-            }
-            else
-            {
-                // DMA can take place!
-                if (sysClockCounter % 2 == 0)
-                {
-                    // On even clock cycles, read from CPU bus
-                    dma_data = cpuRead(dma_page << 8 | dma_addr);
-                }
-                else
-                {
-                    // On odd clock cycles, write to PPU OAM
-                    ppu->WritePAM(dma_addr, dma_data);
-                    // Increment the lo byte of the address
-                    dma_addr++;
-                    // If this wraps around, we know that 256
-                    // bytes have been written, so end the DMA
-                    // transfer, and proceed as normal
-                    if (dma_addr == 0x00)
-                    {
-                        dma_transfer = false;
-                        dma_dummy = true;
-                    }
-                }
-            }
-        } else {
-            cpu->clock();
-            // clock the APU
-            apu->clock(cpu);
+            cpu.irq();
+            nEnd = std::max(nIrqTick / 3 + 1, nResume) + 7;
         }
     }
 
-    // The PPU is capable of emitting an interrupt to indicate the
-    // vertical blanking period has been entered. If it has, we need
-    // to send that irq to the CPU.
-    if (ppu->nmi)
+    cpu.cycles = 0;
+    cpuClock = nEnd;
+}
+
+void NesBus::SyncPPU(uint64_t tick)
+{
+    if (tick < ppuClock)
+        return;
+
+    ppu.Run((uint32_t)(tick + 1 - ppuClock));
+    ppuClock = tick + 1;
+    updateDeadlines();
+}
+
+void NesBus::SyncAPU(uint64_t cpu_cycle)
+{
+    // DMC fetches add their stall to the CPU's remaining cycles,
+    // which may be in use by an instruction that is still executing
+    const uint8_t nCycles = cpu.cycles;
+    if (apuClock < cpu_cycle)
     {
-        ppu->nmi = false;
-        cpu->nmi();
+        apu.Run(&cpu, cpu_cycle - apuClock);
+        apuClock = cpu_cycle;
     }
+    cpuClock += cpu.cycles - nCycles;
+    cpu.cycles = nCycles;
+    updateApuIrqDeadline();
+}
+
+void NesBus::updateDeadlines()
+{
+    nmiDeadline = ppuClock + ppu.ClocksUntil(241, 1) - 1;
+    frameDeadline = ppuClock + ppu.ClocksUntil(260, 340) - 1;
 
+    const uint32_t nLines = rom->ScanlinesUntilIrq();
+    const uint32_t nClocks = nLines == Mapper::NoIrq || nLines == 0 ? NesPPU::NoClocks : ppu.ClocksUntilCounter(nLines);
+    if (nLines == 0)
+        mapperIrqDeadline = 0;
+    else if (nClocks == NesPPU::NoClocks)
+        mapperIrqDeadline = NoDeadline;
+    else
+        mapperIrqDeadline = ppuClock + nClocks - 1;
+}
 
-    sysClockCounter++;
+void NesBus::updateApuIrqDeadline()
+{
+    const uint64_t nCycles = apu.CyclesUntilIrq();
+    if (nCycles == 0)
+        apuIrqDeadline = 0;
+    else if (nCycles == NesAPU2::NoIrq)
+        apuIrqDeadline = NoDeadline;
+    else
+        apuIrqDeadline = (apuClock + nCycles - 1) * 3;
 }
\ No newline at end of file
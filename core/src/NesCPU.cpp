@@ -1,268 +1,18 @@
 #include "NesCPU.h"
 #include "NesBus.h"
+#include "NesCPUOpcodes.h"
+#include "NesArchive.h"
 #include "Util/Hex.h"
 
+#define NESCPU_LOOKUP(op, name, operate, mode, cyc) { name, &NesCPU::operate, &NesCPU::mode, cyc },
+const NesCPU::Instruction NesCPU::opLookup[256] =
+{
+    NES_CPU_OPCODES(NESCPU_LOOKUP)
+};
+#undef NESCPU_LOOKUP
+
 NesCPU::NesCPU()
 {
-    opLookup = 
-    {
-        { "BRK", &NesCPU::BRK, &NesCPU::IMM, 7 },
-        { "ORA", &NesCPU::ORA, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 3 },
-        { "ORA", &NesCPU::ORA, &NesCPU::ZP0, 3 },
-        { "ASL", &NesCPU::ASL, &NesCPU::ZP0, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "PHP", &NesCPU::PHP, &NesCPU::IMP, 3 },
-        { "ORA", &NesCPU::ORA, &NesCPU::IMM, 2 },
-        { "ASL", &NesCPU::ASL, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "ORA", &NesCPU::ORA, &NesCPU::ABS, 4 },
-        { "ASL", &NesCPU::ASL, &NesCPU::ABS, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "BPL", &NesCPU::BPL, &NesCPU::REL, 2 },
-        { "ORA", &NesCPU::ORA, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "ORA", &NesCPU::ORA, &NesCPU::ZPX, 4 },
-        { "ASL", &NesCPU::ASL, &NesCPU::ZPX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "CLC", &NesCPU::CLC, &NesCPU::IMP, 2 },
-        { "ORA", &NesCPU::ORA, &NesCPU::ABY, 4 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "ORA", &NesCPU::ORA, &NesCPU::ABX, 4 },
-        { "ASL", &NesCPU::ASL, &NesCPU::ABX, 7 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "JSR", &NesCPU::JSR, &NesCPU::ABS, 6 },
-        { "AND", &NesCPU::AND, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "BIT", &NesCPU::BIT, &NesCPU::ZP0, 3 },
-        { "AND", &NesCPU::AND, &NesCPU::ZP0, 3 },
-        { "ROL", &NesCPU::ROL, &NesCPU::ZP0, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "PLP", &NesCPU::PLP, &NesCPU::IMP, 4 },
-        { "AND", &NesCPU::AND, &NesCPU::IMM, 2 },
-        { "ROL", &NesCPU::ROL, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "BIT", &NesCPU::BIT, &NesCPU::ABS, 4 },
-        { "AND", &NesCPU::AND, &NesCPU::ABS, 4 },
-        { "ROL", &NesCPU::ROL, &NesCPU::ABS, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "BMI", &NesCPU::BMI, &NesCPU::REL, 2 },
-        { "AND", &NesCPU::AND, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "AND", &NesCPU::AND, &NesCPU::ZPX, 4 },
-        { "ROL", &NesCPU::ROL, &NesCPU::ZPX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "SEC", &NesCPU::SEC, &NesCPU::IMP, 2 },
-        { "AND", &NesCPU::AND, &NesCPU::ABY, 4 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "AND", &NesCPU::AND, &NesCPU::ABX, 4 },
-        { "ROL", &NesCPU::ROL, &NesCPU::ABX, 7 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "RTI", &NesCPU::RTI, &NesCPU::IMP, 6 },
-        { "EOR", &NesCPU::EOR, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 3 },
-        { "EOR", &NesCPU::EOR, &NesCPU::ZP0, 3 },
-        { "LSR", &NesCPU::LSR, &NesCPU::ZP0, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "PHA", &NesCPU::PHA, &NesCPU::IMP, 3 },
-        { "EOR", &NesCPU::EOR, &NesCPU::IMM, 2 },
-        { "LSR", &NesCPU::LSR, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "JMP", &NesCPU::JMP, &NesCPU::ABS, 3 },
-        { "EOR", &NesCPU::EOR, &NesCPU::ABS, 4 },
-        { "LSR", &NesCPU::LSR, &NesCPU::ABS, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "BVC", &NesCPU::BVC, &NesCPU::REL, 2 },
-        { "EOR", &NesCPU::EOR, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "EOR", &NesCPU::EOR, &NesCPU::ZPX, 4 },
-        { "LSR", &NesCPU::LSR, &NesCPU::ZPX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "CLI", &NesCPU::CLI, &NesCPU::IMP, 2 },
-        { "EOR", &NesCPU::EOR, &NesCPU::ABY, 4 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "EOR", &NesCPU::EOR, &NesCPU::ABX, 4 },
-        { "LSR", &NesCPU::LSR, &NesCPU::ABX, 7 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "RTS", &NesCPU::RTS, &NesCPU::IMP, 6 },
-        { "ADC", &NesCPU::ADC, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 3 },
-        { "ADC", &NesCPU::ADC, &NesCPU::ZP0, 3 },
-        { "ROR", &NesCPU::ROR, &NesCPU::ZP0, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "PLA", &NesCPU::PLA, &NesCPU::IMP, 4 },
-        { "ADC", &NesCPU::ADC, &NesCPU::IMM, 2 },
-        { "ROR", &NesCPU::ROR, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "JMP", &NesCPU::JMP, &NesCPU::IND, 5 },
-        { "ADC", &NesCPU::ADC, &NesCPU::ABS, 4 },
-        { "ROR", &NesCPU::ROR, &NesCPU::ABS, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "BVS", &NesCPU::BVS, &NesCPU::REL, 2 },
-        { "ADC", &NesCPU::ADC, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "ADC", &NesCPU::ADC, &NesCPU::ZPX, 4 },
-        { "ROR", &NesCPU::ROR, &NesCPU::ZPX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "SEI", &NesCPU::SEI, &NesCPU::IMP, 2 },
-        { "ADC", &NesCPU::ADC, &NesCPU::ABY, 4 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "ADC", &NesCPU::ADC, &NesCPU::ABX, 4 },
-        { "ROR", &NesCPU::ROR, &NesCPU::ABX, 7 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "STA", &NesCPU::STA, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "STY", &NesCPU::STY, &NesCPU::ZP0, 3 },
-        { "STA", &NesCPU::STA, &NesCPU::ZP0, 3 },
-        { "STX", &NesCPU::STX, &NesCPU::ZP0, 3 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 3 },
-        { "DEY", &NesCPU::DEY, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "TXA", &NesCPU::TXA, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "STY", &NesCPU::STY, &NesCPU::ABS, 4 },
-        { "STA", &NesCPU::STA, &NesCPU::ABS, 4 },
-        { "STX", &NesCPU::STX, &NesCPU::ABS, 4 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 4 },
-        { "BCC", &NesCPU::BCC, &NesCPU::REL, 2 },
-        { "STA", &NesCPU::STA, &NesCPU::IZY, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "STY", &NesCPU::STY, &NesCPU::ZPX, 4 },
-        { "STA", &NesCPU::STA, &NesCPU::ZPX, 4 },
-        { "STX", &NesCPU::STX, &NesCPU::ZPY, 4 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 4 },
-        { "TYA", &NesCPU::TYA, &NesCPU::IMP, 2 },
-        { "STA", &NesCPU::STA, &NesCPU::ABY, 5 },
-        { "TXS", &NesCPU::TXS, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 5 },
-        { "STA", &NesCPU::STA, &NesCPU::ABX, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "LDY", &NesCPU::LDY, &NesCPU::IMM, 2 },
-        { "LDA", &NesCPU::LDA, &NesCPU::IZX, 6 },
-        { "LDX", &NesCPU::LDX, &NesCPU::IMM, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "LDY", &NesCPU::LDY, &NesCPU::ZP0, 3 },
-        { "LDA", &NesCPU::LDA, &NesCPU::ZP0, 3 },
-        { "LDX", &NesCPU::LDX, &NesCPU::ZP0, 3 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 3 },
-        { "TAY", &NesCPU::TAY, &NesCPU::IMP, 2 },
-        { "LDA", &NesCPU::LDA, &NesCPU::IMM, 2 },
-        { "TAX", &NesCPU::TAX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "LDY", &NesCPU::LDY, &NesCPU::ABS, 4 },
-        { "LDA", &NesCPU::LDA, &NesCPU::ABS, 4 },
-        { "LDX", &NesCPU::LDX, &NesCPU::ABS, 4 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 4 },
-        { "BCS", &NesCPU::BCS, &NesCPU::REL, 2 },
-        { "LDA", &NesCPU::LDA, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "LDY", &NesCPU::LDY, &NesCPU::ZPX, 4 },
-        { "LDA", &NesCPU::LDA, &NesCPU::ZPX, 4 },
-        { "LDX", &NesCPU::LDX, &NesCPU::ZPY, 4 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 4 },
-        { "CLV", &NesCPU::CLV, &NesCPU::IMP, 2 },
-        { "LDA", &NesCPU::LDA, &NesCPU::ABY, 4 },
-        { "TSX", &NesCPU::TSX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 4 },
-        { "LDY", &NesCPU::LDY, &NesCPU::ABX, 4 },
-        { "LDA", &NesCPU::LDA, &NesCPU::ABX, 4 },
-        { "LDX", &NesCPU::LDX, &NesCPU::ABY, 4 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 4 },
-        { "CPY", &NesCPU::CPY, &NesCPU::IMM, 2 },
-        { "CMP", &NesCPU::CMP, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "CPY", &NesCPU::CPY, &NesCPU::ZP0, 3 },
-        { "CMP", &NesCPU::CMP, &NesCPU::ZP0, 3 },
-        { "DEC", &NesCPU::DEC, &NesCPU::ZP0, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "INY", &NesCPU::INY, &NesCPU::IMP, 2 },
-        { "CMP", &NesCPU::CMP, &NesCPU::IMM, 2 },
-        { "DEX", &NesCPU::DEX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "CPY", &NesCPU::CPY, &NesCPU::ABS, 4 },
-        { "CMP", &NesCPU::CMP, &NesCPU::ABS, 4 },
-        { "DEC", &NesCPU::DEC, &NesCPU::ABS, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "BNE", &NesCPU::BNE, &NesCPU::REL, 2 },
-        { "CMP", &NesCPU::CMP, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "CMP", &NesCPU::CMP, &NesCPU::ZPX, 4 },
-        { "DEC", &NesCPU::DEC, &NesCPU::ZPX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "CLD", &NesCPU::CLD, &NesCPU::IMP, 2 },
-        { "CMP", &NesCPU::CMP, &NesCPU::ABY, 4 },
-        { "NOP", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "CMP", &NesCPU::CMP, &NesCPU::ABX, 4 },
-        { "DEC", &NesCPU::DEC, &NesCPU::ABX, 7 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "CPX", &NesCPU::CPX, &NesCPU::IMM, 2 },
-        { "SBC", &NesCPU::SBC, &NesCPU::IZX, 6 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "CPX", &NesCPU::CPX, &NesCPU::ZP0, 3 },
-        { "SBC", &NesCPU::SBC, &NesCPU::ZP0, 3 },
-        { "INC", &NesCPU::INC, &NesCPU::ZP0, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 5 },
-        { "INX", &NesCPU::INX, &NesCPU::IMP, 2 },
-        { "SBC", &NesCPU::SBC, &NesCPU::IMM, 2 },
-        { "NOP", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::SBC, &NesCPU::IMP, 2 },
-        { "CPX", &NesCPU::CPX, &NesCPU::ABS, 4 },
-        { "SBC", &NesCPU::SBC, &NesCPU::ABS, 4 },
-        { "INC", &NesCPU::INC, &NesCPU::ABS, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "BEQ", &NesCPU::BEQ, &NesCPU::REL, 2 },
-        { "SBC", &NesCPU::SBC, &NesCPU::IZY, 5 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 8 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "SBC", &NesCPU::SBC, &NesCPU::ZPX, 4 },
-        { "INC", &NesCPU::INC, &NesCPU::ZPX, 6 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 6 },
-        { "SED", &NesCPU::SED, &NesCPU::IMP, 2 },
-        { "SBC", &NesCPU::SBC, &NesCPU::ABY, 4 },
-        { "NOP", &NesCPU::NOP, &NesCPU::IMP, 2 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-        { "???", &NesCPU::NOP, &NesCPU::IMP, 4 },
-        { "SBC", &NesCPU::SBC, &NesCPU::ABX, 4 },
-        { "INC", &NesCPU::INC, &NesCPU::ABX, 7 },
-        { "???", &NesCPU::XXX, &NesCPU::IMP, 7 },
-    };
 }
 
 // This is the disassembly function. Its workings are not required for emulation.
@@ -298,7 +48,7 @@ std::map<uint16_t, std::string> NesCPU::Disassemble(uint16_t nStart, uint16_t nS
         // Read instruction, and get its readable name
         uint8_t opcode = read(addr, true);
         addr++;
-        sInst += opLookup[opcode].name + " ";
+        sInst += std::string(opLookup[opcode].name) + " ";
 
         // Get oprands from desired locations, and form the
         // instruction based upon its addressing mode. These
@@ -410,6 +160,23 @@ void NesCPU::Reset()
     cycles = 8;
 }
 
+void NesCPU::Serialize(NesArchive& ar)
+{
+    ar.Value(a);
+    ar.Value(x);
+    ar.Value(y);
+    ar.Value(stkp);
+    ar.Value(pc);
+    ar.Value(status);
+    ar.Value(fetched);
+    ar.Value(temp);
+    ar.Value(addr_abs);
+    ar.Value(addr_rel);
+    ar.Value(opcode);
+    ar.Value(cycles);
+    ar.Value(clock_count);
+}
+
 uint8_t NesCPU::read(uint16_t a, bool bReadOnly)
 {
     return bus->cpuRead(a, bReadOnly);
@@ -438,6 +205,16 @@ void NesCPU::doBranch()
     pc = addr_abs;
 }
 
+// The instruction core this build was configured with
+uint8_t NesCPU::Execute()
+{
+#if defined NESCPU_LEGACY_CORE
+    return StepLegacy();
+#else
+    return Step();
+#endif
+}
+
 void NesCPU::clock()
 {
     // Each instruction requires a variable number of clock cycles to execute.
@@ -452,60 +229,67 @@ void NesCPU::clock()
     // the next one is ready to be executed.
     if (cycles == 0)
     {
-        // Read next instruction uint8_t. This 8-bit value is used to index
-        // the translation table to get the relevant information about
-        // how to implement the instruction
-        opcode = read(pc);
+        cycles = Execute();
+    }
+    
+    // Increment global clock count - This is actually unused unless logging is enabled
+    // but I've kept it in because its a handy watch variable for debugging
+    clock_count++;
+
+    // Decrement the number of cycles remaining for this instruction
+    cycles--;
+}
+
+uint8_t NesCPU::StepLegacy()
+{
+    // Read next instruction uint8_t. This 8-bit value is used to index
+    // the translation table to get the relevant information about
+    // how to implement the instruction
+    opcode = read(pc);
 
 // #ifdef LOGMODE
-//         uint16_t log_pc = pc;
+//     uint16_t log_pc = pc;
 // #endif
-        
-        // Always set the unused status flag bit to 1
-        SetFlag(U, true);
-        
-        // Increment program counter, we read the opcode uint8_t
-        pc++;
+    
+    // Always set the unused status flag bit to 1
+    SetFlag(U, true);
+    
+    // Increment program counter, we read the opcode uint8_t
+    pc++;
 
-        // Get Starting number of cycles
-        cycles = opLookup[opcode].cycles;
+    // Get Starting number of cycles
+    cycles = opLookup[opcode].cycles;
 
-        // Perform fetch of intermmediate data using the
-        // required addressing mode
-        uint8_t additional_cycle1 = (this->*opLookup[opcode].addrmode)();
+    // Perform fetch of intermmediate data using the
+    // required addressing mode
+    uint8_t additional_cycle1 = (this->*opLookup[opcode].addrmode)();
 
-        // Perform operation
-        uint8_t additional_cycle2 = (this->*opLookup[opcode].operate)();
+    // Perform operation
+    uint8_t additional_cycle2 = (this->*opLookup[opcode].operate)();
 
-        // The addressmode and opcode may have altered the number
-        // of cycles this instruction requires before its completed
-        cycles += additional_cycle1 & additional_cycle2;
+    // The addressmode and opcode may have altered the number
+    // of cycles this instruction requires before its completed
+    cycles += additional_cycle1 & additional_cycle2;
 
-        // Always set the unused status flag bit to 1
-        SetFlag(U, true);
+    // Always set the unused status flag bit to 1
+    SetFlag(U, true);
 
 // #ifdef LOGMODE
-//         // This logger dumps every cycle the entire processor state for analysis.
-//         // This can be used for debugging the emulation, but has little utility
-//         // during emulation. Its also very slow, so only use if you have to.
-//         if (logfile == nullptr)	logfile = fopen("olc6502.txt", "wt");
-//         if (logfile != nullptr)
-//         {
-//             fprintf(logfile, "%10d:%02d PC:%04X %s A:%02X X:%02X Y:%02X %s%s%s%s%s%s%s%s STKP:%02X\n",
-//                 clock_count, 0, log_pc, "XXX", a, x, y,	
-//                 GetFlag(N) ? "N" : ".",	GetFlag(V) ? "V" : ".",	GetFlag(U) ? "U" : ".",	
-//                 GetFlag(B) ? "B" : ".",	GetFlag(D) ? "D" : ".",	GetFlag(I) ? "I" : ".",	
-//                 GetFlag(Z) ? "Z" : ".",	GetFlag(C) ? "C" : ".",	stkp);
-//         }
+//     // This logger dumps every cycle the entire processor state for analysis.
+//     // This can be used for debugging the emulation, but has little utility
+//     // during emulation. Its also very slow, so only use if you have to.
+//     if (logfile == nullptr)	logfile = fopen("olc6502.txt", "wt");
+//     if (logfile != nullptr)
+//     {
+//         fprintf(logfile, "%10d:%02d PC:%04X %s A:%02X X:%02X Y:%02X %s%s%s%s%s%s%s%s STKP:%02X\n",
+//             clock_count, 0, log_pc, "XXX", a, x, y,	
+//             GetFlag(N) ? "N" : ".",	GetFlag(V) ? "V" : ".",	GetFlag(U) ? "U" : ".",	
+//             GetFlag(B) ? "B" : ".",	GetFlag(D) ? "D" : ".",	GetFlag(I) ? "I" : ".",	
+//             GetFlag(Z) ? "Z" : ".",	GetFlag(C) ? "C" : ".",	stkp);
+//     }
 // #endif
-    }
-    
-    // Increment global clock count - This is actually unused unless logging is enabled
-    // but I've kept it in because its a handy watch variable for debugging
-    clock_count++;
 
-    // Decrement the number of cycles remaining for this instruction
-    cycles--;
+    return cycles;
 }
 
 // Addressing Modes =============================================
@@ -1439,18 +1223,41 @@ uint8_t NesCPU::XXX()
     return 0;
 }
 
-void NesCPU::nmi()
+void NesCPU::irq()
 {
     write(0x0100 + stkp, (pc >> 8) & 0x00FF);
     stkp--;
     write(0x0100 + stkp, pc & 0x00FF);
     stkp--;
 
+    // The status pushed is the one interrupted, I is only set after
     SetFlag(B, 0);
     SetFlag(U, 1);
+    write(0x0100 + stkp, status);
+    stkp--;
     SetFlag(I, 1);
+
+    addr_abs = 0xFFFE;
+    uint16_t lo = read(addr_abs + 0);
+    uint16_t hi = read(addr_abs + 1);
+    pc = (hi << 8) | lo;
+
+    cycles = 7;
+}
+
+void NesCPU::nmi()
+{
+    write(0x0100 + stkp, (pc >> 8) & 0x00FF);
+    stkp--;
+    write(0x0100 + stkp, pc & 0x00FF);
+    stkp--;
+
+    // The status pushed is the one interrupted, I is only set after
+    SetFlag(B, 0);
+    SetFlag(U, 1);
     write(0x0100 + stkp, status);
     stkp--;
+    SetFlag(I, 1);
 
     addr_abs = 0xFFFA;
     uint16_t lo = read(addr_abs + 0);
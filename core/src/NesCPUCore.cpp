@@ -0,0 +1,570 @@
+#include "NesCPU.h"
+#include "NesBus.h"
+#include "NesCPUOpcodes.h"
+
+// The fused interpreter. Where StepLegacy() looks up an addressing mode
+// function and an operation function for every instruction and calls
+// both through member pointers, here every opcode gets its own handler,
+// stamped out at compile time from NES_CPU_OPCODES. The addressing mode
+// is a template argument, so the handler is one straight run of code
+// with the operand fetch inlined into the operation.
+//
+// Behaviour, including the quirks of the legacy core, is kept identical
+// instruction for instruction. VeryEmuBench verify runs both in lockstep.
+//
+// The handlers are dispatched either through a switch, or through a
+// table of label addresses (computed goto, GCC and Clang only) which
+// lets every handler jump straight to the next. Define NESCPU_DISPATCH_SWITCH
+// or NESCPU_DISPATCH_GOTO to choose, otherwise the best available is used.
+#if !defined NESCPU_DISPATCH_SWITCH && !defined NESCPU_DISPATCH_GOTO
+#if defined __GNUC__
+#define NESCPU_DISPATCH_GOTO
+#else
+#define NESCPU_DISPATCH_SWITCH
+#endif
+#endif
+
+namespace fused
+{
+
+enum class Mode { IMP, IMM, ZP0, ZPX, ZPY, REL, ABS, ABX, ABY, IND, IZX, IZY };
+
+inline uint8_t Read(NesCPU& cpu, uint16_t addr)
+{
+    return cpu.bus->cpuRead(addr);
+}
+
+inline void Write(NesCPU& cpu, uint16_t addr, uint8_t data)
+{
+    cpu.bus->cpuWrite(addr, data);
+}
+
+inline void SetFlag(NesCPU& cpu, uint8_t flag, bool v)
+{
+    cpu.status = v ? (cpu.status | flag) : (cpu.status & ~flag);
+}
+
+inline void SetZN(NesCPU& cpu, uint8_t value)
+{
+    cpu.status = (cpu.status & ~(NesCPU::Z | NesCPU::N)) | (value == 0x00 ? NesCPU::Z : 0) | (value & NesCPU::N);
+}
+
+inline void Push(NesCPU& cpu, uint8_t data)
+{
+    Write(cpu, 0x0100 + cpu.stkp, data);
+    cpu.stkp--;
+}
+
+inline uint8_t Pop(NesCPU& cpu)
+{
+    cpu.stkp++;
+    return Read(cpu, 0x0100 + cpu.stkp);
+}
+
+// Addressing Modes =============================================
+// Consume the operand bytes and resolve the effective address. Indexed
+// modes report whether the index crossed a page, which costs a cycle for
+// the instructions that only read their operand.
+template <Mode M>
+inline uint16_t Address(NesCPU& cpu, uint8_t& crossed)
+{
+    if constexpr (M == Mode::IMP)
+    {
+        return 0;
+    }
+    else if constexpr (M == Mode::IMM)
+    {
+        return cpu.pc++;
+    }
+    else if constexpr (M == Mode::ZP0)
+    {
+        return Read(cpu, cpu.pc++);
+    }
+    else if constexpr (M == Mode::ZPX)
+    {
+        return (Read(cpu, cpu.pc++) + cpu.x) & 0x00FF;
+    }
+    else if constexpr (M == Mode::ZPY)
+    {
+        return (Read(cpu, cpu.pc++) + cpu.y) & 0x00FF;
+    }
+    else if constexpr (M == Mode::REL)
+    {
+        uint16_t rel = Read(cpu, cpu.pc++);
+        if (rel & 0x80)
+            rel |= 0xFF00;
+        return rel;
+    }
+    else if constexpr (M == Mode::ABS)
+    {
+        uint16_t lo = Read(cpu, cpu.pc++);
+        uint16_t hi = Read(cpu, cpu.pc++);
+        return (hi << 8) | lo;
+    }
+    else if constexpr (M == Mode::ABX || M == Mode::ABY)
+    {
+        uint16_t lo = Read(cpu, cpu.pc++);
+        uint16_t hi = Read(cpu, cpu.pc++);
+        uint16_t addr = ((hi << 8) | lo) + (M == Mode::ABX ? cpu.x : cpu.y);
+        crossed = (addr & 0xFF00) != (hi << 8);
+        return addr;
+    }
+    else if constexpr (M == Mode::IND)
+    {
+        uint16_t ptr_lo = Read(cpu, cpu.pc++);
+        uint16_t ptr_hi = Read(cpu, cpu.pc++);
+        uint16_t ptr = (ptr_hi << 8) | ptr_lo;
+
+        // Simulate page boundary hardware bug
+        if (ptr_lo == 0x00FF)
+            return Read(cpu, ptr & 0xFF00) << 8 | Read(cpu, ptr);
+        return Read(cpu, ptr + 1) << 8 | Read(cpu, ptr);
+    }
+    else if constexpr (M == Mode::IZX)
+    {
+        uint16_t t = Read(cpu, cpu.pc++);
+        uint16_t lo = Read(cpu, (t + cpu.x) & 0x00FF);
+        uint16_t hi = Read(cpu, (t + cpu.x + 1) & 0x00FF);
+        return (hi << 8) | lo;
+    }
+    else if constexpr (M == Mode::IZY)
+    {
+        uint16_t t = Read(cpu, cpu.pc++);
+        uint16_t lo = Read(cpu, t & 0x00FF);
+        uint16_t hi = Read(cpu, (t + 1) & 0x00FF);
+        uint16_t addr = ((hi << 8) | lo) + cpu.y;
+        crossed = (addr & 0xFF00) != (hi << 8);
+        return addr;
+    }
+}
+
+// Implied instructions work on the accumulator
+template <Mode M>
+inline uint8_t Operand(NesCPU& cpu, uint16_t addr)
+{
+    if constexpr (M == Mode::IMP)
+        return cpu.a;
+    else
+        return Read(cpu, addr);
+}
+
+template <Mode M>
+inline void Store(NesCPU& cpu, uint16_t addr, uint8_t data)
+{
+    if constexpr (M == Mode::IMP)
+        cpu.a = data;
+    else
+        Write(cpu, addr, data);
+}
+
+template <Mode M>
+inline uint8_t Branch(NesCPU& cpu, bool taken)
+{
+    uint8_t crossed = 0;
+    uint16_t rel = Address<Mode::REL>(cpu, crossed);
+    if (!taken)
+        return 0;
+
+    uint16_t target = cpu.pc + rel;
+    uint8_t extra = ((target & 0xFF00) != (cpu.pc & 0xFF00)) ? 2 : 1;
+    cpu.pc = target;
+    return extra;
+}
+
+// Opcodes ======================================================
+// Each returns the cycles it needs on top of the base count.
+
+template <Mode M>
+inline uint8_t ADC(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint8_t value = Operand<M>(cpu, Address<M>(cpu, crossed));
+    uint16_t temp = cpu.a + value + (cpu.status & NesCPU::C);
+    SetFlag(cpu, NesCPU::C, temp > 255);
+    SetFlag(cpu, NesCPU::V, ((~(cpu.a ^ value)) & (cpu.a ^ temp)) & 0x0080);
+    cpu.a = temp & 0x00FF;
+    SetZN(cpu, cpu.a);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t SBC(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t value = Operand<M>(cpu, Address<M>(cpu, crossed)) ^ 0x00FF;
+    uint16_t temp = cpu.a + value + (cpu.status & NesCPU::C);
+    SetFlag(cpu, NesCPU::C, temp & 0xFF00);
+    SetFlag(cpu, NesCPU::V, (temp ^ cpu.a) & (temp ^ value) & 0x0080);
+    cpu.a = temp & 0x00FF;
+    SetZN(cpu, cpu.a);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t AND(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.a &= Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetZN(cpu, cpu.a);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t EOR(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.a ^= Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetZN(cpu, cpu.a);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t ORA(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.a |= Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetZN(cpu, cpu.a);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t LDA(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.a = Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetZN(cpu, cpu.a);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t LDX(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.x = Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetZN(cpu, cpu.x);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t LDY(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.y = Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetZN(cpu, cpu.y);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t Compare(NesCPU& cpu, uint8_t reg)
+{
+    uint8_t crossed = 0;
+    uint8_t value = Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetFlag(cpu, NesCPU::C, reg >= value);
+    SetZN(cpu, reg - value);
+    return crossed;
+}
+
+template <Mode M>
+inline uint8_t CMP(NesCPU& cpu)
+{
+    return Compare<M>(cpu, cpu.a);
+}
+
+// Unlike CMP, the index compares never take the extra cycle
+template <Mode M>
+inline uint8_t CPX(NesCPU& cpu)
+{
+    Compare<M>(cpu, cpu.x);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t CPY(NesCPU& cpu)
+{
+    Compare<M>(cpu, cpu.y);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t BIT(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint8_t value = Operand<M>(cpu, Address<M>(cpu, crossed));
+    SetFlag(cpu, NesCPU::Z, (cpu.a & value) == 0x00);
+    SetFlag(cpu, NesCPU::N, value & (1 << 7));
+    SetFlag(cpu, NesCPU::V, value & (1 << 6));
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t ASL(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    uint16_t temp = Operand<M>(cpu, addr) << 1;
+    SetFlag(cpu, NesCPU::C, temp & 0xFF00);
+    SetZN(cpu, temp & 0x00FF);
+    Store<M>(cpu, addr, temp & 0x00FF);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t LSR(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    uint8_t value = Operand<M>(cpu, addr);
+    SetFlag(cpu, NesCPU::C, value & 0x01);
+    SetZN(cpu, value >> 1);
+    Store<M>(cpu, addr, value >> 1);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t ROL(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    uint16_t temp = (uint16_t)(Operand<M>(cpu, addr) << 1) | (cpu.status & NesCPU::C);
+    SetFlag(cpu, NesCPU::C, temp & 0xFF00);
+    SetZN(cpu, temp & 0x00FF);
+    Store<M>(cpu, addr, temp & 0x00FF);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t ROR(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    uint8_t value = Operand<M>(cpu, addr);
+    uint8_t temp = (value >> 1) | ((cpu.status & NesCPU::C) << 7);
+    SetFlag(cpu, NesCPU::C, value & 0x01);
+    SetZN(cpu, temp);
+    Store<M>(cpu, addr, temp);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t DEC(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    uint8_t temp = Operand<M>(cpu, addr) - 1;
+    Write(cpu, addr, temp);
+    SetZN(cpu, temp);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t INC(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    uint8_t temp = Operand<M>(cpu, addr) + 1;
+    Write(cpu, addr, temp);
+    SetZN(cpu, temp);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t STA(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    Write(cpu, Address<M>(cpu, crossed), cpu.a);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t STX(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    Write(cpu, Address<M>(cpu, crossed), cpu.x);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t STY(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    Write(cpu, Address<M>(cpu, crossed), cpu.y);
+    return 0;
+}
+
+template <Mode M> inline uint8_t BCC(NesCPU& cpu) { return Branch<M>(cpu, !(cpu.status & NesCPU::C)); }
+template <Mode M> inline uint8_t BCS(NesCPU& cpu) { return Branch<M>(cpu, cpu.status & NesCPU::C); }
+template <Mode M> inline uint8_t BNE(NesCPU& cpu) { return Branch<M>(cpu, !(cpu.status & NesCPU::Z)); }
+template <Mode M> inline uint8_t BEQ(NesCPU& cpu) { return Branch<M>(cpu, cpu.status & NesCPU::Z); }
+template <Mode M> inline uint8_t BPL(NesCPU& cpu) { return Branch<M>(cpu, !(cpu.status & NesCPU::N)); }
+template <Mode M> inline uint8_t BMI(NesCPU& cpu) { return Branch<M>(cpu, cpu.status & NesCPU::N); }
+template <Mode M> inline uint8_t BVC(NesCPU& cpu) { return Branch<M>(cpu, !(cpu.status & NesCPU::V)); }
+template <Mode M> inline uint8_t BVS(NesCPU& cpu) { return Branch<M>(cpu, cpu.status & NesCPU::V); }
+
+template <Mode M> inline uint8_t CLC(NesCPU& cpu) { cpu.status &= ~NesCPU::C; return 0; }
+template <Mode M> inline uint8_t CLD(NesCPU& cpu) { cpu.status &= ~NesCPU::D; return 0; }
+template <Mode M> inline uint8_t CLI(NesCPU& cpu) { cpu.status &= ~NesCPU::I; return 0; }
+template <Mode M> inline uint8_t CLV(NesCPU& cpu) { cpu.status &= ~NesCPU::V; return 0; }
+template <Mode M> inline uint8_t SEC(NesCPU& cpu) { cpu.status |= NesCPU::C; return 0; }
+template <Mode M> inline uint8_t SED(NesCPU& cpu) { cpu.status |= NesCPU::D; return 0; }
+template <Mode M> inline uint8_t SEI(NesCPU& cpu) { cpu.status |= NesCPU::I; return 0; }
+
+template <Mode M> inline uint8_t DEX(NesCPU& cpu) { SetZN(cpu, --cpu.x); return 0; }
+template <Mode M> inline uint8_t DEY(NesCPU& cpu) { SetZN(cpu, --cpu.y); return 0; }
+template <Mode M> inline uint8_t INX(NesCPU& cpu) { SetZN(cpu, ++cpu.x); return 0; }
+template <Mode M> inline uint8_t INY(NesCPU& cpu) { SetZN(cpu, ++cpu.y); return 0; }
+
+template <Mode M> inline uint8_t TAX(NesCPU& cpu) { cpu.x = cpu.a; SetZN(cpu, cpu.x); return 0; }
+template <Mode M> inline uint8_t TAY(NesCPU& cpu) { cpu.y = cpu.a; SetZN(cpu, cpu.y); return 0; }
+template <Mode M> inline uint8_t TSX(NesCPU& cpu) { cpu.x = cpu.stkp; SetZN(cpu, cpu.x); return 0; }
+template <Mode M> inline uint8_t TXA(NesCPU& cpu) { cpu.a = cpu.x; SetZN(cpu, cpu.a); return 0; }
+template <Mode M> inline uint8_t TXS(NesCPU& cpu) { cpu.stkp = cpu.x; return 0; }
+template <Mode M> inline uint8_t TYA(NesCPU& cpu) { cpu.a = cpu.y; SetZN(cpu, cpu.a); return 0; }
+
+template <Mode M> inline uint8_t NOP(NesCPU& cpu) { return 0; }
+template <Mode M> inline uint8_t XXX(NesCPU& cpu) { return 0; }
+
+template <Mode M>
+inline uint8_t JMP(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    cpu.pc = Address<M>(cpu, crossed);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t JSR(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    uint16_t addr = Address<M>(cpu, crossed);
+    cpu.pc--;
+    Push(cpu, cpu.pc >> 8);
+    Push(cpu, cpu.pc & 0x00FF);
+    cpu.pc = addr;
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t RTS(NesCPU& cpu)
+{
+    cpu.pc = Pop(cpu);
+    cpu.pc |= (uint16_t)Pop(cpu) << 8;
+    cpu.pc++;
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t BRK(NesCPU& cpu)
+{
+    uint8_t crossed = 0;
+    Address<M>(cpu, crossed);
+    cpu.pc++;
+    cpu.status |= NesCPU::I;
+    Push(cpu, cpu.pc >> 8);
+    Push(cpu, cpu.pc & 0x00FF);
+    Push(cpu, cpu.status | NesCPU::B);
+    cpu.status &= ~NesCPU::B;
+    cpu.pc = (uint16_t)Read(cpu, 0xFFFE) | ((uint16_t)Read(cpu, 0xFFFF) << 8);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t RTI(NesCPU& cpu)
+{
+    cpu.status = Pop(cpu) & ~(NesCPU::B | NesCPU::U);
+    cpu.pc = Pop(cpu);
+    cpu.pc |= (uint16_t)Pop(cpu) << 8;
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t PHA(NesCPU& cpu)
+{
+    Push(cpu, cpu.a);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t PHP(NesCPU& cpu)
+{
+    Push(cpu, cpu.status | NesCPU::B | NesCPU::U);
+    cpu.status &= ~(NesCPU::B | NesCPU::U);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t PLA(NesCPU& cpu)
+{
+    cpu.a = Pop(cpu);
+    SetZN(cpu, cpu.a);
+    return 0;
+}
+
+template <Mode M>
+inline uint8_t PLP(NesCPU& cpu)
+{
+    cpu.status = Pop(cpu) | NesCPU::U;
+    return 0;
+}
+
+}
+
+uint8_t NesCPU::Step()
+{
+    return (uint8_t)Run(1);
+}
+
+uint32_t NesCPU::Run(uint32_t nInstructions)
+{
+    uint32_t nCycles = 0;
+
+#if defined NESCPU_DISPATCH_GOTO
+
+    #define NESCPU_LABEL(op, name, operate, mode, cyc) &&op_##op,
+    static void* const dispatch[256] = { NES_CPU_OPCODES(NESCPU_LABEL) };
+    #undef NESCPU_LABEL
+
+    // Fetch the next opcode and jump straight into its handler. The
+    // unused status flag always reads back as 1.
+    #define NESCPU_NEXT() \
+        if (nInstructions-- == 0) \
+            return nCycles; \
+        opcode = bus->cpuRead(pc++); \
+        status |= U; \
+        goto *dispatch[opcode]
+
+    #define NESCPU_HANDLER(op, name, operate, mode, cyc) \
+        op_##op: \
+            nCycles += cyc + fused::operate<fused::Mode::mode>(*this); \
+            status |= U; \
+            NESCPU_NEXT();
+
+    NESCPU_NEXT();
+    NES_CPU_OPCODES(NESCPU_HANDLER)
+
+    #undef NESCPU_HANDLER
+    #undef NESCPU_NEXT
+
+#else
+
+    #define NESCPU_CASE(op, name, operate, mode, cyc) \
+        case op: nCycles += cyc + fused::operate<fused::Mode::mode>(*this); break;
+
+    while (nInstructions-- > 0)
+    {
+        opcode = bus->cpuRead(pc++);
+        status |= U;
+
+        switch (opcode)
+        {
+            NES_CPU_OPCODES(NESCPU_CASE)
+        }
+
+        status |= U;
+    }
+
+    #undef NESCPU_CASE
+
+    return nCycles;
+
+#endif
+}
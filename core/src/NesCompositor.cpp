@@ -0,0 +1,239 @@
+#include "NesCompositor.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NESCOMPOSITOR_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// The SIMD versions are built for their instruction set whatever the
+// compiler is targeting, and only run once the CPU has been asked
+#if defined(NESCOMPOSITOR_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NESCOMPOSITOR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NESCOMPOSITOR_TARGET(isa)
+#endif
+
+namespace
+{
+
+using Line = NesCompositor::Line;
+using Level = NesCompositor::Level;
+
+// One pixel at a time, as composeDot() does it
+bool composeScalar(const Line& line)
+{
+	const int nBackgroundLeft = line.bBackground ? (line.bBackgroundLeft ? 0 : 8) : 256;
+	const int nSpritesLeft = line.bSpritesLeft ? 0 : 8;
+
+	bool bHit = false;
+	for (int x = 0; x < 256; x++)
+	{
+		const uint8_t bg = x >= nBackgroundLeft ? line.pBackground[x] : 0;
+		const uint8_t fg = x >= nSpritesLeft ? line.pSprites[x] : 0;
+
+		uint8_t composed = 0x00;
+		if ((bg & 0x03) == 0)
+			composed = fg & 0x1F;
+		else if ((fg & 0x03) == 0)
+			composed = bg;
+		else
+		{
+			composed = (fg & 0x20) ? (fg & 0x1F) : bg;
+			bHit |= (fg & 0x40) != 0;
+		}
+		if (line.pOut != nullptr)
+			line.pOut[x] = line.pColours[composed];
+	}
+	return bHit;
+}
+
+#if defined(NESCOMPOSITOR_X86)
+
+// 16 pixels at a time. Without a byte shuffle the palette lookup is
+// left to a scalar loop.
+NESCOMPOSITOR_TARGET("sse2")
+bool composeSSE2(const Line& line)
+{
+	const __m128i vNone = _mm_setzero_si128();
+	const __m128i vPixel = _mm_set1_epi8(0x03);
+	const __m128i vColour = _mm_set1_epi8(0x1F);
+	const __m128i vPriority = _mm_set1_epi8(0x20);
+	const __m128i vSpriteZero = _mm_set1_epi8(0x40);
+	const __m128i vBackground = line.bBackground ? _mm_set1_epi8(-1) : vNone;
+	const __m128i vLeft = _mm_set_epi64x(-1, 0); // Clears the first 8 pixels
+
+	__m128i vHit = vNone;
+	alignas(16) uint8_t composed[16];
+	for (int x = 0; x < 256; x += 16)
+	{
+		__m128i bg = _mm_and_si128(_mm_loadu_si128((const __m128i*)(line.pBackground + x)), vBackground);
+		__m128i fg = _mm_loadu_si128((const __m128i*)(line.pSprites + x));
+		if (x == 0)
+		{
+			if (!line.bBackgroundLeft)
+				bg = _mm_and_si128(bg, vLeft);
+			if (!line.bSpritesLeft)
+				fg = _mm_and_si128(fg, vLeft);
+		}
+
+		// The sprite wins where it is opaque, and either in front or
+		// over a transparent background
+		const __m128i bgClear = _mm_cmpeq_epi8(_mm_and_si128(bg, vPixel), vNone);
+		const __m128i fgClear = _mm_cmpeq_epi8(_mm_and_si128(fg, vPixel), vNone);
+		const __m128i fgFront = _mm_cmpeq_epi8(_mm_and_si128(fg, vPriority), vPriority);
+		const __m128i useFg = _mm_andnot_si128(fgClear, _mm_or_si128(bgClear, fgFront));
+		const __m128i vOut = _mm_or_si128(
+			_mm_and_si128(useFg, _mm_and_si128(fg, vColour)),
+			_mm_andnot_si128(useFg, _mm_andnot_si128(bgClear, bg)));
+
+		// Both opaque, whichever is in front
+		vHit = _mm_or_si128(vHit, _mm_andnot_si128(fgClear, _mm_andnot_si128(bgClear, _mm_and_si128(fg, vSpriteZero))));
+
+		if (line.pOut != nullptr)
+		{
+			_mm_store_si128((__m128i*)composed, vOut);
+			for (int i = 0; i < 16; i++)
+				line.pOut[x + i] = line.pColours[composed[i]];
+		}
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(vHit, vNone)) != 0xFFFF;
+}
+
+// 32 pixels at a time, looking up both halves of the palette with a
+// byte shuffle each and picking between them on bit 4
+NESCOMPOSITOR_TARGET("avx2")
+bool composeAVX2(const Line& line)
+{
+	const __m256i vNone = _mm256_setzero_si256();
+	const __m256i vPixel = _mm256_set1_epi8(0x03);
+	const __m256i vColour = _mm256_set1_epi8(0x1F);
+	const __m256i vHigh = _mm256_set1_epi8(0x10);
+	const __m256i vPriority = _mm256_set1_epi8(0x20);
+	const __m256i vSpriteZero = _mm256_set1_epi8(0x40);
+	const __m256i vBackground = line.bBackground ? _mm256_set1_epi8(-1) : vNone;
+	const __m256i vLeft = _mm256_set_epi64x(-1, -1, -1, 0);
+
+	__m256i vLow = vNone, vHighColours = vNone;
+	if (line.pOut != nullptr)
+	{
+		vLow = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)line.pColours));
+		vHighColours = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(line.pColours + 16)));
+	}
+
+	__m256i vHit = vNone;
+	for (int x = 0; x < 256; x += 32)
+	{
+		__m256i bg = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(line.pBackground + x)), vBackground);
+		__m256i fg = _mm256_loadu_si256((const __m256i*)(line.pSprites + x));
+		if (x == 0)
+		{
+			if (!line.bBackgroundLeft)
+				bg = _mm256_and_si256(bg, vLeft);
+			if (!line.bSpritesLeft)
+				fg = _mm256_and_si256(fg, vLeft);
+		}
+
+		const __m256i bgClear = _mm256_cmpeq_epi8(_mm256_and_si256(bg, vPixel), vNone);
+		const __m256i fgClear = _mm256_cmpeq_epi8(_mm256_and_si256(fg, vPixel), vNone);
+		const __m256i fgFront = _mm256_cmpeq_epi8(_mm256_and_si256(fg, vPriority), vPriority);
+		const __m256i useFg = _mm256_andnot_si256(fgClear, _mm256_or_si256(bgClear, fgFront));
+		const __m256i vOut = _mm256_blendv_epi8(_mm256_andnot_si256(bgClear, bg), _mm256_and_si256(fg, vColour), useFg);
+
+		vHit = _mm256_or_si256(vHit, _mm256_andnot_si256(fgClear, _mm256_andnot_si256(bgClear, _mm256_and_si256(fg, vSpriteZero))));
+
+		if (line.pOut != nullptr)
+		{
+			const __m256i vUpper = _mm256_cmpeq_epi8(_mm256_and_si256(vOut, vHigh), vHigh);
+			const __m256i vIndex = _mm256_blendv_epi8(_mm256_shuffle_epi8(vLow, vOut), _mm256_shuffle_epi8(vHighColours, vOut), vUpper);
+			_mm256_storeu_si256((__m256i*)(line.pOut + x), vIndex);
+		}
+	}
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(vHit, vNone)) != -1;
+}
+
+#endif
+
+Level detect()
+{
+#if defined(NESCOMPOSITOR_X86)
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int nMax = info[0];
+	__cpuid(info, 1);
+	const bool bSSE2 = (info[3] & (1 << 26)) != 0;
+
+	// AVX2 also needs the OS to save the upper halves of the registers
+	const bool bOSXSave = (info[2] & (1 << 27)) != 0;
+	bool bAVX2 = false;
+	if (nMax >= 7 && bOSXSave && (_xgetbv(0) & 0x06) == 0x06)
+	{
+		__cpuidex(info, 7, 0);
+		bAVX2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	const bool bSSE2 = __builtin_cpu_supports("sse2");
+	const bool bAVX2 = __builtin_cpu_supports("avx2");
+#endif
+	if (bAVX2)
+		return Level::AVX2;
+	if (bSSE2)
+		return Level::SSE2;
+#endif
+	return Level::Scalar;
+}
+
+using ComposeFunction = bool (*)(const Line&);
+
+ComposeFunction function(Level level)
+{
+	switch (level)
+	{
+#if defined(NESCOMPOSITOR_X86)
+	case Level::AVX2: return composeAVX2;
+	case Level::SSE2: return composeSSE2;
+#endif
+	default: return composeScalar;
+	}
+}
+
+const Level nBestLevel = detect();
+Level nLevel = nBestLevel;
+ComposeFunction pCompose = function(nBestLevel);
+
+}
+
+bool NesCompositor::Compose(const Line& line)
+{
+	return pCompose(line);
+}
+
+NesCompositor::Level NesCompositor::GetLevel()
+{
+	return nLevel;
+}
+
+NesCompositor::Level NesCompositor::BestLevel()
+{
+	return nBestLevel;
+}
+
+void NesCompositor::SetLevel(Level level)
+{
+	nLevel = (int)level > (int)nBestLevel ? nBestLevel : level;
+	pCompose = function(nLevel);
+}
+
+const char* NesCompositor::LevelName(Level level)
+{
+	switch (level)
+	{
+	case Level::AVX2: return "AVX2";
+	case Level::SSE2: return "SSE2";
+	default: return "scalar";
+	}
+}
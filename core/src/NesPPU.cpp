@@ -1,80 +1,161 @@
 #include "NesPPU.h"
 #include "NesRom.h"
+#include "NesArchive.h"
+#include "NesCompositor.h"
+#include <cstring>
+
+namespace
+{
+
+// The 64 colours the PPU can output
+const Math::ColorRGB<uint8_t> palScreen[0x40] =
+{
+	{ 84, 84, 84 },
+	{ 0, 30, 116 },
+	{ 8, 16, 144 },
+	{ 48, 0, 136 },
+	{ 68, 0, 100 },
+	{ 92, 0, 48 },
+	{ 84, 4, 0 },
+	{ 60, 24, 0 },
+	{ 32, 42, 0 },
+	{ 8, 58, 0 },
+	{ 0, 64, 0 },
+	{ 0, 60, 0 },
+	{ 0, 50, 60 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+
+	{ 152, 150, 152 },
+	{ 8, 76, 196 },
+	{ 48, 50, 236 },
+	{ 92, 30, 228 },
+	{ 136, 20, 176 },
+	{ 160, 20, 100 },
+	{ 152, 34, 32 },
+	{ 120, 60, 0 },
+	{ 84, 90, 0 },
+	{ 40, 114, 0 },
+	{ 8, 124, 0 },
+	{ 0, 118, 40 },
+	{ 0, 102, 120 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+
+	{ 236, 238, 236 },
+	{ 76, 154, 236 },
+	{ 120, 124, 236 },
+	{ 176, 98, 236 },
+	{ 228, 84, 236 },
+	{ 236, 88, 180 },
+	{ 236, 106, 100 },
+	{ 212, 136, 32 },
+	{ 160, 170, 0 },
+	{ 116, 196, 0 },
+	{ 76, 208, 32 },
+	{ 56, 204, 108 },
+	{ 56, 180, 204 },
+	{ 60, 60, 60 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+
+	{ 236, 238, 236 },
+	{ 168, 204, 236 },
+	{ 188, 188, 236 },
+	{ 212, 178, 236 },
+	{ 236, 174, 236 },
+	{ 236, 174, 212 },
+	{ 236, 180, 176 },
+	{ 228, 196, 144 },
+	{ 204, 210, 120 },
+	{ 180, 222, 120 },
+	{ 168, 226, 144 },
+	{ 152, 226, 180 },
+	{ 160, 214, 228 },
+	{ 160, 162, 160 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+};
+
+// palScreen as seen through each combination of the colour emphasis
+// bits of the mask register, indexed by PPUMASK >> 5. Shared by every
+// PPU, as the palette never changes.
+struct OutputPalettes
+{
+	Math::ColorRGB<uint8_t> colours[8][0x40];
+
+	OutputPalettes()
+	{
+		// Each emphasis bit darkens the two colour channels it does not
+		// name. Bit 5 is red, bit 6 green and bit 7 blue.
+		for (uint8_t e = 0; e < 8; e++)
+			for (uint8_t c = 0; c < 0x40; c++)
+				for (uint8_t ch = 0; ch < 3; ch++)
+				{
+					const uint8_t v = palScreen[c][ch];
+					colours[e][c][ch] = (e & ~(1 << ch)) ? (uint8_t)((v * 746 + 500) / 1000) : v;
+				}
+	}
+};
+
+const OutputPalettes palOutput;
+
+// A scanline without sprites
+const uint8_t noSprites[256] = {0};
+
+}
 
 NesPPU::NesPPU()
 {
-   	palScreen[0x00] = {84, 84, 84};
-	palScreen[0x01] = {0, 30, 116};
-	palScreen[0x02] = {8, 16, 144};
-	palScreen[0x03] = {48, 0, 136};
-	palScreen[0x04] = {68, 0, 100};
-	palScreen[0x05] = {92, 0, 48};
-	palScreen[0x06] = {84, 4, 0};
-	palScreen[0x07] = {60, 24, 0};
-	palScreen[0x08] = {32, 42, 0};
-	palScreen[0x09] = {8, 58, 0};
-	palScreen[0x0A] = {0, 64, 0};
-	palScreen[0x0B] = {0, 60, 0};
-	palScreen[0x0C] = {0, 50, 60};
-	palScreen[0x0D] = {0, 0, 0};
-	palScreen[0x0E] = {0, 0, 0};
-	palScreen[0x0F] = {0, 0, 0};
-
-	palScreen[0x10] = {152, 150, 152};
-	palScreen[0x11] = {8, 76, 196};
-	palScreen[0x12] = {48, 50, 236};
-	palScreen[0x13] = {92, 30, 228};
-	palScreen[0x14] = {136, 20, 176};
-	palScreen[0x15] = {160, 20, 100};
-	palScreen[0x16] = {152, 34, 32};
-	palScreen[0x17] = {120, 60, 0};
-	palScreen[0x18] = {84, 90, 0};
-	palScreen[0x19] = {40, 114, 0};
-	palScreen[0x1A] = {8, 124, 0};
-	palScreen[0x1B] = {0, 118, 40};
-	palScreen[0x1C] = {0, 102, 120};
-	palScreen[0x1D] = {0, 0, 0};
-	palScreen[0x1E] = {0, 0, 0};
-	palScreen[0x1F] = {0, 0, 0};
-
-	palScreen[0x20] = {236, 238, 236};
-	palScreen[0x21] = {76, 154, 236};
-	palScreen[0x22] = {120, 124, 236};
-	palScreen[0x23] = {176, 98, 236};
-	palScreen[0x24] = {228, 84, 236};
-	palScreen[0x25] = {236, 88, 180};
-	palScreen[0x26] = {236, 106, 100};
-	palScreen[0x27] = {212, 136, 32};
-	palScreen[0x28] = {160, 170, 0};
-	palScreen[0x29] = {116, 196, 0};
-	palScreen[0x2A] = {76, 208, 32};
-	palScreen[0x2B] = {56, 204, 108};
-	palScreen[0x2C] = {56, 180, 204};
-	palScreen[0x2D] = {60, 60, 60};
-	palScreen[0x2E] = {0, 0, 0};
-	palScreen[0x2F] = {0, 0, 0};
-
-	palScreen[0x30] = {236, 238, 236};
-	palScreen[0x31] = {168, 204, 236};
-	palScreen[0x32] = {188, 188, 236};
-	palScreen[0x33] = {212, 178, 236};
-	palScreen[0x34] = {236, 174, 236};
-	palScreen[0x35] = {236, 174, 212};
-	palScreen[0x36] = {236, 180, 176};
-	palScreen[0x37] = {228, 196, 144};
-	palScreen[0x38] = {204, 210, 120};
-	palScreen[0x39] = {180, 222, 120};
-	palScreen[0x3A] = {168, 226, 144};
-	palScreen[0x3B] = {152, 226, 180};
-	palScreen[0x3C] = {160, 214, 228};
-	palScreen[0x3D] = {160, 162, 160};
-	palScreen[0x3E] = {0, 0, 0};
-	palScreen[0x3F] = {0, 0, 0};
+	SetScreenBuffer(nullptr);
+	std::memset(sprScreenEmphasis, 0, sizeof(sprScreenEmphasis));
+}
+
+void NesPPU::SetScreenBuffer(uint8_t* pBuffer)
+{
+	if (pBuffer == nullptr)
+	{
+		if (pOwnScreen == nullptr)
+			pOwnScreen = std::make_unique<uint8_t[]>(ScreenBytes);
+		pBuffer = pOwnScreen.get();
+	}
+	else
+	{
+		pOwnScreen.reset();
+	}
+	pScreen = pBuffer;
+}
+
+void NesPPU::DisableScreen()
+{
+	pOwnScreen.reset();
+	pScreen = nullptr;
+}
+
+uint8_t NesPPU::GetPaletteIndex(uint8_t palette, uint8_t pixel) const
+{
+	// Palette memory is internal to the PPU, the cartridge never sees
+	// these reads, so skip ppuRead and apply its mirroring here
+	uint8_t addr = (palette << 2) | pixel;
+	if ((addr & 0x13) == 0x10) addr &= 0x0F;
+	return tblPalette[addr] & (mask.grayscale ? 0x30 : 0x3F);
 }
 
-Math::ColorRGB<uint8_t>& NesPPU::GetColourFromPaletteRam(uint8_t palette, uint8_t pixel)
+void NesPPU::ConvertScreen(Math::ColorRGB<uint8_t>* pRGB) const
 {
-    return palScreen[ppuRead(0x3F00 + (palette << 2) + pixel) & 0x3F];
+	if (pScreen == nullptr)
+		return;
+
+	for (int y = 0; y < 240; y++)
+	{
+		const Math::ColorRGB<uint8_t>* pal = palOutput.colours[sprScreenEmphasis[y]];
+		const uint8_t* pIndex = pScreen + y * 256;
+		for (int x = 0; x < 256; x++)
+			pRGB[x] = pal[pIndex[x]];
+		pRGB += 256;
+	}
 }
 
 
@@ -257,44 +338,25 @@ uint8_t NesPPU::ppuRead(uint16_t addr, bool rdonly)
 	uint8_t data = 0x00;
 	addr &= 0x3FFF;
 
-	if (rom->ppuRead(addr, data))
+	if (addr < 0x2000)
 	{
-
+		const uint8_t* page = pPatternPage[addr >> 10];
+		if (STDX_likely(page != nullptr))
+			return page[addr & 0x03FF];
 	}
-	else if (addr >= 0x0000 && addr <= 0x1FFF)
+	else if (addr <= 0x3EFF)
 	{
-		// If the cartridge cant map the address, have
-		// a physical location ready here
-		data = tblPattern[(addr & 0x1000) >> 12][addr & 0x0FFF];
+		return nametableRead(addr);
 	}
-	else if (addr >= 0x2000 && addr <= 0x3EFF)
+
+	if (rom->ppuRead(addr, data))
 	{
-		addr &= 0x0FFF;
 
-		if (rom->Mirror() == MIRROR::VERTICAL)
-		{
-			// Vertical
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				data = tblName[1][addr & 0x03FF];
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				data = tblName[1][addr & 0x03FF];
-		}
-		else if (rom->Mirror() == MIRROR::HORIZONTAL)
-		{
-			// Horizontal
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				data = tblName[0][addr & 0x03FF];
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				data = tblName[1][addr & 0x03FF];
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				data = tblName[1][addr & 0x03FF];
-		}
+	}
+	else if (addr >= 0x0000 && addr <= 0x1FFF)
+	{
+		// Every mapper maps the pattern tables, there is
+		// nothing on the console itself to read
 	}
 	else if (addr >= 0x3F00 && addr <= 0x3FFF)
 	{
@@ -313,41 +375,19 @@ void NesPPU::ppuWrite(uint16_t addr, uint8_t data)
 {
 	addr &= 0x3FFF;
 
+	if (addr >= 0x2000 && addr <= 0x3EFF)
+	{
+		pNameSlot[(addr >> 10) & 0x03][addr & 0x03FF] = data;
+		return;
+	}
+
 	if (rom->ppuWrite(addr, data))
 	{
 
 	}
 	else if (addr >= 0x0000 && addr <= 0x1FFF)
 	{
-		tblPattern[(addr & 0x1000) >> 12][addr & 0x0FFF] = data;
-	}
-	else if (addr >= 0x2000 && addr <= 0x3EFF)
-	{
-		addr &= 0x0FFF;
-		if (rom->Mirror() == MIRROR::VERTICAL)
-		{
-			// Vertical
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				tblName[1][addr & 0x03FF] = data;
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				tblName[1][addr & 0x03FF] = data;
-		}
-		else if (rom->Mirror() == MIRROR::HORIZONTAL)
-		{
-			// Horizontal
-			if (addr >= 0x0000 && addr <= 0x03FF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0400 && addr <= 0x07FF)
-				tblName[0][addr & 0x03FF] = data;
-			if (addr >= 0x0800 && addr <= 0x0BFF)
-				tblName[1][addr & 0x03FF] = data;
-			if (addr >= 0x0C00 && addr <= 0x0FFF)
-				tblName[1][addr & 0x03FF] = data;
-		}
+		// Writes to CHR ROM go nowhere
 	}
 	else if (addr >= 0x3F00 && addr <= 0x3FFF)
 	{
@@ -361,6 +401,26 @@ void NesPPU::ppuWrite(uint16_t addr, uint8_t data)
 }
 
 
+void NesPPU::mapPatternPages()
+{
+	rom->MapPpuPages(pPatternPage, nPatternOffset);
+}
+
+void NesPPU::mapNametables()
+{
+	rom->MapNametables(pNameSlot, tblName[0]);
+}
+
+uint64_t NesPPU::patternRow(uint16_t addr, bool bFlip)
+{
+	addr &= 0x1FF7;
+	if (STDX_likely(pPatternPage[addr >> 10] != nullptr))
+		return rom->GetTileCache().Row(nPatternOffset[addr >> 10] + (addr & 0x03FF), bFlip);
+
+	// Not directly mapped, so decode it from whatever the bus returns
+	return NesTileCache::DecodeRow(ppuRead(addr), ppuRead(addr + 8), bFlip);
+}
+
 void NesPPU::WritePAM(uint32_t offset, uint8_t value)
 {
     auto o1 = offset/4;
@@ -398,656 +458,692 @@ void NesPPU::reset()
 	odd_frame = false;
 }
 
-void NesPPU::clock()
+void NesPPU::Serialize(NesArchive& ar)
 {
-	// As we progress through scanlines and cycles, the PPU is effectively
-	// a state machine going through the motions of fetching background 
-	// information and sprite information, compositing them into a pixel
-	// to be output.
+	ar.Value(tblName);
+	ar.Value(tblPalette);
+
+	ar.Value(status);
+	ar.Value(mask);
+	ar.Value(control);
+	ar.Value(vram_addr);
+	ar.Value(tram_addr);
+	ar.Value(fine_x);
+	ar.Value(address_latch);
+	ar.Value(ppu_data_buffer);
+	ar.Value(scanline);
+	ar.Value(cycle);
+	ar.Value(odd_frame);
+
+	ar.Value(bg_next_tile_id);
+	ar.Value(bg_next_tile_attrib);
+	ar.Value(bg_next_tile_lsb);
+	ar.Value(bg_next_tile_msb);
+	ar.Value(bg_shifter_pattern_lo);
+	ar.Value(bg_shifter_pattern_hi);
+	ar.Value(bg_shifter_attrib_lo);
+	ar.Value(bg_shifter_attrib_hi);
+
+	ar.Value(OAM);
+	ar.Value(oam_addr);
+	ar.Value(spriteScanline);
+	ar.Value(sprite_count);
+	ar.Value(sprite_line);
+	ar.Value(sprite_dot);
+	ar.Value(bSpriteZeroHitPossible);
+	ar.Value(bSpriteZeroBeingRendered);
+
+	ar.Value(nmi);
+	ar.Value(scanline_trigger);
+	ar.Value(frame_complete);
+}
 
-	// The lambda functions (functions inside functions) contain the various
-	// actions to be performed depending upon the output of the state machine
-	// for a given scanline/cycle combination
+uint32_t NesPPU::ClocksUntil(int16_t target_scanline, int16_t target_cycle) const
+{
+	// Dots are numbered from the start of the pre-render scanline
+	constexpr uint32_t nDotsPerFrame = 262 * 341;
+	const uint32_t nFrom = (scanline + 1) * 341 + cycle;
+	const uint32_t nTo = (target_scanline + 1) * 341 + target_cycle;
+	const uint32_t nSkipDot = 341; // Scanline 0, cycle 0
+	const bool bRendering = mask.render_background || mask.render_sprites;
+
+	uint32_t nClocks = nTo - nFrom + 1;
+	if (nTo >= nFrom)
+	{
+		// Odd frames skip the first dot of scanline 0 while rendering
+		if (nFrom <= nSkipDot && nTo >= nSkipDot && odd_frame && bRendering)
+			nClocks--;
+	}
+	else
+	{
+		// Wraps into the next frame, which has the other parity
+		nClocks += nDotsPerFrame;
+		if (nFrom <= nSkipDot && odd_frame && bRendering)
+			nClocks--;
+		else if (nTo >= nSkipDot && !odd_frame && bRendering)
+			nClocks--;
+	}
+	return nClocks;
+}
+
+uint32_t NesPPU::ClocksUntilCounter(uint32_t nCount) const
+{
+	if (!(mask.render_background || mask.render_sprites) || nCount == 0)
+		return NoClocks;
+
+	// The counter is clocked by dot 259 of the pre-render scanline and
+	// of each visible one, see advanceDot(). Past the visible scanlines
+	// the next clock is on the pre-render scanline of the next frame,
+	// which ClocksUntil() wraps around to.
+	int32_t line = cycle < 260 ? scanline : scanline + 1;
+	if (line >= 240)
+		line = -1;
+	line += (int32_t)nCount - 1;
+	if (line >= 240)
+		return NoClocks;
+	return ClocksUntil((int16_t)line, 259);
+}
 
-	// ==============================================================================
-	// Increment the background tile "pointer" one tile/column horizontally
-	auto IncrementScrollX = [&]()
+// The functions below contain the various actions to be performed depending
+// upon the output of the state machine for a given scanline/cycle combination
+
+// ==============================================================================
+// Increment the background tile "pointer" one tile/column horizontally
+void NesPPU::IncrementScrollX()
+{
+	// Note: pixel perfect scrolling horizontally is handled by the 
+	// data shifters. Here we are operating in the spatial domain of 
+	// tiles, 8x8 pixel blocks.
+	
+	// Ony if rendering is enabled
+	if (mask.render_background || mask.render_sprites)
 	{
-		// Note: pixel perfect scrolling horizontally is handled by the 
-		// data shifters. Here we are operating in the spatial domain of 
-		// tiles, 8x8 pixel blocks.
-		
-		// Ony if rendering is enabled
-		if (mask.render_background || mask.render_sprites)
+		// A single name table is 32x30 tiles. As we increment horizontally
+		// we may cross into a neighbouring nametable, or wrap around to
+		// a neighbouring nametable
+		if (vram_addr.coarse_x == 31)
 		{
-			// A single name table is 32x30 tiles. As we increment horizontally
-			// we may cross into a neighbouring nametable, or wrap around to
-			// a neighbouring nametable
-			if (vram_addr.coarse_x == 31)
-			{
-				// Leaving nametable so wrap address round
-				vram_addr.coarse_x = 0;
-				// Flip target nametable bit
-				vram_addr.nametable_x = ~vram_addr.nametable_x;
-			}
-			else
-			{
-				// Staying in current nametable, so just increment
-				vram_addr.coarse_x++;
-			}
+			// Leaving nametable so wrap address round
+			vram_addr.coarse_x = 0;
+			// Flip target nametable bit
+			vram_addr.nametable_x = ~vram_addr.nametable_x;
 		}
-	};
+		else
+		{
+			// Staying in current nametable, so just increment
+			vram_addr.coarse_x++;
+		}
+	}
+}
 
-	// ==============================================================================
-	// Increment the background tile "pointer" one scanline vertically
-	auto IncrementScrollY = [&]()
+// ==============================================================================
+// Increment the background tile "pointer" one scanline vertically
+void NesPPU::IncrementScrollY()
+{
+	// Incrementing vertically is more complicated. The visible nametable
+	// is 32x30 tiles, but in memory there is enough room for 32x32 tiles.
+	// The bottom two rows of tiles are in fact not tiles at all, they
+	// contain the "attribute" information for the entire table. This is
+	// information that describes which palettes are used for different 
+	// regions of the nametable.
+	
+	// In addition, the NES doesnt scroll vertically in chunks of 8 pixels
+	// i.e. the height of a tile, it can perform fine scrolling by using
+	// the fine_y component of the register. This means an increment in Y
+	// first adjusts the fine offset, but may need to adjust the whole
+	// row offset, since fine_y is a value 0 to 7, and a row is 8 pixels high
+
+	// Ony if rendering is enabled
+	if (mask.render_background || mask.render_sprites)
 	{
-		// Incrementing vertically is more complicated. The visible nametable
-		// is 32x30 tiles, but in memory there is enough room for 32x32 tiles.
-		// The bottom two rows of tiles are in fact not tiles at all, they
-		// contain the "attribute" information for the entire table. This is
-		// information that describes which palettes are used for different 
-		// regions of the nametable.
-		
-		// In addition, the NES doesnt scroll vertically in chunks of 8 pixels
-		// i.e. the height of a tile, it can perform fine scrolling by using
-		// the fine_y component of the register. This means an increment in Y
-		// first adjusts the fine offset, but may need to adjust the whole
-		// row offset, since fine_y is a value 0 to 7, and a row is 8 pixels high
-
-		// Ony if rendering is enabled
-		if (mask.render_background || mask.render_sprites)
+		// If possible, just increment the fine y offset
+		if (vram_addr.fine_y < 7)
+		{
+			vram_addr.fine_y++;
+		}
+		else
 		{
-			// If possible, just increment the fine y offset
-			if (vram_addr.fine_y < 7)
+			// If we have gone beyond the height of a row, we need to
+			// increment the row, potentially wrapping into neighbouring
+			// vertical nametables. Dont forget however, the bottom two rows
+			// do not contain tile information. The coarse y offset is used
+			// to identify which row of the nametable we want, and the fine
+			// y offset is the specific "scanline"
+
+			// Reset fine y offset
+			vram_addr.fine_y = 0;
+
+			// Check if we need to swap vertical nametable targets
+			if (vram_addr.coarse_y == 29)
+			{
+				// We do, so reset coarse y offset
+				vram_addr.coarse_y = 0;
+				// And flip the target nametable bit
+				vram_addr.nametable_y = ~vram_addr.nametable_y;
+			}
+			else if (vram_addr.coarse_y == 31)
 			{
-				vram_addr.fine_y++;
+				// In case the pointer is in the attribute memory, we
+				// just wrap around the current nametable
+				vram_addr.coarse_y = 0;
 			}
 			else
 			{
-				// If we have gone beyond the height of a row, we need to
-				// increment the row, potentially wrapping into neighbouring
-				// vertical nametables. Dont forget however, the bottom two rows
-				// do not contain tile information. The coarse y offset is used
-				// to identify which row of the nametable we want, and the fine
-				// y offset is the specific "scanline"
-
-				// Reset fine y offset
-				vram_addr.fine_y = 0;
-
-				// Check if we need to swap vertical nametable targets
-				if (vram_addr.coarse_y == 29)
-				{
-					// We do, so reset coarse y offset
-					vram_addr.coarse_y = 0;
-					// And flip the target nametable bit
-					vram_addr.nametable_y = ~vram_addr.nametable_y;
-				}
-				else if (vram_addr.coarse_y == 31)
-				{
-					// In case the pointer is in the attribute memory, we
-					// just wrap around the current nametable
-					vram_addr.coarse_y = 0;
-				}
-				else
-				{
-					// None of the above boundary/wrapping conditions apply
-					// so just increment the coarse y offset
-					vram_addr.coarse_y++;
-				}
+				// None of the above boundary/wrapping conditions apply
+				// so just increment the coarse y offset
+				vram_addr.coarse_y++;
 			}
 		}
-	};
+	}
+}
 
-	// ==============================================================================
-	// Transfer the temporarily stored horizontal nametable access information
-	// into the "pointer". Note that fine x scrolling is not part of the "pointer"
-	// addressing mechanism
-	auto TransferAddressX = [&]()
+// ==============================================================================
+// Transfer the temporarily stored horizontal nametable access information
+// into the "pointer". Note that fine x scrolling is not part of the "pointer"
+// addressing mechanism
+void NesPPU::TransferAddressX()
+{
+	// Ony if rendering is enabled
+	if (mask.render_background || mask.render_sprites)
 	{
-		// Ony if rendering is enabled
-		if (mask.render_background || mask.render_sprites)
-		{
-			vram_addr.nametable_x = tram_addr.nametable_x;
-			vram_addr.coarse_x    = tram_addr.coarse_x;
-		}
-	};
+		vram_addr.nametable_x = tram_addr.nametable_x;
+		vram_addr.coarse_x    = tram_addr.coarse_x;
+	}
+}
 
-	// ==============================================================================
-	// Transfer the temporarily stored vertical nametable access information
-	// into the "pointer". Note that fine y scrolling is part of the "pointer"
-	// addressing mechanism
-	auto TransferAddressY = [&]()
+// ==============================================================================
+// Transfer the temporarily stored vertical nametable access information
+// into the "pointer". Note that fine y scrolling is part of the "pointer"
+// addressing mechanism
+void NesPPU::TransferAddressY()
+{
+	// Ony if rendering is enabled
+	if (mask.render_background || mask.render_sprites)
 	{
-		// Ony if rendering is enabled
-		if (mask.render_background || mask.render_sprites)
-		{
-			vram_addr.fine_y      = tram_addr.fine_y;
-			vram_addr.nametable_y = tram_addr.nametable_y;
-			vram_addr.coarse_y    = tram_addr.coarse_y;
-		}
-	};
+		vram_addr.fine_y      = tram_addr.fine_y;
+		vram_addr.nametable_y = tram_addr.nametable_y;
+		vram_addr.coarse_y    = tram_addr.coarse_y;
+	}
+}
 
 
-	// ==============================================================================
-	// Prime the "in-effect" background tile shifters ready for outputting next
-	// 8 pixels in scanline.
-	auto LoadBackgroundShifters = [&]()
-	{	
-		// Each PPU update we calculate one pixel. These shifters shift 1 bit along
-		// feeding the pixel compositor with the binary information it needs. Its
-		// 16 bits wide, because the top 8 bits are the current 8 pixels being drawn
-		// and the bottom 8 bits are the next 8 pixels to be drawn. Naturally this means
-		// the required bit is always the MSB of the shifter. However, "fine x" scrolling
-		// plays a part in this too, whcih is seen later, so in fact we can choose
-		// any one of the top 8 bits.
-		bg_shifter_pattern_lo = (bg_shifter_pattern_lo & 0xFF00) | bg_next_tile_lsb;
-		bg_shifter_pattern_hi = (bg_shifter_pattern_hi & 0xFF00) | bg_next_tile_msb;
-
-		// Attribute bits do not change per pixel, rather they change every 8 pixels
-		// but are synchronised with the pattern shifters for convenience, so here
-		// we take the bottom 2 bits of the attribute word which represent which 
-		// palette is being used for the current 8 pixels and the next 8 pixels, and 
-		// "inflate" them to 8 bit words.
-		bg_shifter_attrib_lo  = (bg_shifter_attrib_lo & 0xFF00) | ((bg_next_tile_attrib & 0b01) ? 0xFF : 0x00);
-		bg_shifter_attrib_hi  = (bg_shifter_attrib_hi & 0xFF00) | ((bg_next_tile_attrib & 0b10) ? 0xFF : 0x00);
-	};
+// ==============================================================================
+// Prime the "in-effect" background tile shifters ready for outputting next
+// 8 pixels in scanline.
+void NesPPU::LoadBackgroundShifters()
+{	
+	// Each PPU update we calculate one pixel. These shifters shift 1 bit along
+	// feeding the pixel compositor with the binary information it needs. Its
+	// 16 bits wide, because the top 8 bits are the current 8 pixels being drawn
+	// and the bottom 8 bits are the next 8 pixels to be drawn. Naturally this means
+	// the required bit is always the MSB of the shifter. However, "fine x" scrolling
+	// plays a part in this too, whcih is seen later, so in fact we can choose
+	// any one of the top 8 bits.
+	bg_shifter_pattern_lo = (bg_shifter_pattern_lo & 0xFF00) | bg_next_tile_lsb;
+	bg_shifter_pattern_hi = (bg_shifter_pattern_hi & 0xFF00) | bg_next_tile_msb;
+
+	// Attribute bits do not change per pixel, rather they change every 8 pixels
+	// but are synchronised with the pattern shifters for convenience, so here
+	// we take the bottom 2 bits of the attribute word which represent which 
+	// palette is being used for the current 8 pixels and the next 8 pixels, and 
+	// "inflate" them to 8 bit words.
+	bg_shifter_attrib_lo  = (bg_shifter_attrib_lo & 0xFF00) | ((bg_next_tile_attrib & 0b01) ? 0xFF : 0x00);
+	bg_shifter_attrib_hi  = (bg_shifter_attrib_hi & 0xFF00) | ((bg_next_tile_attrib & 0b10) ? 0xFF : 0x00);
+}
 
 
-	// ==============================================================================
-	// Every cycle the shifters storing pattern and attribute information shift
-	// their contents by 1 bit. This is because every cycle, the output progresses
-	// by 1 pixel. This means relatively, the state of the shifter is in sync
-	// with the pixels being drawn for that 8 pixel section of the scanline.
-	auto UpdateShifters = [&]()
+// ==============================================================================
+// Every cycle the shifters storing pattern and attribute information shift
+// their contents by 1 bit. This is because every cycle, the output progresses
+// by 1 pixel. This means relatively, the state of the shifter is in sync
+// with the pixels being drawn for that 8 pixel section of the scanline.
+void NesPPU::UpdateShifters()
+{
+	if (mask.render_background)
 	{
-		if (mask.render_background)
-		{
-			// Shifting background tile pattern row
-			bg_shifter_pattern_lo <<= 1;
-			bg_shifter_pattern_hi <<= 1;
-
-			// Shifting palette attributes by 1
-			bg_shifter_attrib_lo <<= 1;
-			bg_shifter_attrib_hi <<= 1;
-		}
-
-		if (mask.render_sprites && cycle >= 1 && cycle < 258)
-		{
-			for (int i = 0; i < sprite_count; i++)
-			{
-				if (spriteScanline[i].x > 0)
-				{
-					spriteScanline[i].x--;
-				}
-				else
-				{
-					sprite_shifter_pattern_lo[i] <<= 1;
-					sprite_shifter_pattern_hi[i] <<= 1;
-				}
-			}
-		}
-	};
+		// Shifting background tile pattern row
+		bg_shifter_pattern_lo <<= 1;
+		bg_shifter_pattern_hi <<= 1;
 
-	
-
-	// All but 1 of the secanlines is visible to the user. The pre-render scanline
-	// at -1, is used to configure the "shifters" for the first visible scanline, 0.
-	if (scanline >= -1 && scanline < 240)
-	{		
-		// Background Rendering ======================================================
+		// Shifting palette attributes by 1
+		bg_shifter_attrib_lo <<= 1;
+		bg_shifter_attrib_hi <<= 1;
+	}
 
-		if (scanline == 0 && cycle == 0 && odd_frame && (mask.render_background || mask.render_sprites))
-		{
-			// "Odd Frame" cycle skip
-			cycle = 1;
-		}
+	// The sprites move along their line buffer instead
+	if (mask.render_sprites && cycle >= 1 && cycle < 258 && sprite_dot < SpriteLineEnd)
+		sprite_dot++;
+}
 
-		if (scanline == -1 && cycle == 1)
-		{
-			// Effectively start of new frame, so clear vertical blank flag
-			status.vertical_blank = 0;
+// Background and sprite fetches of the pre-render and visible scanlines
+void NesPPU::fetchDot()
+{
+	// Background Rendering ======================================================
 
-			// Clear sprite overflow flag
-			status.sprite_overflow = 0;
-			
-			// Clear the sprite zero hit flag
-			status.sprite_zero_hit = 0;
+	if (scanline == 0 && cycle == 0 && odd_frame && (mask.render_background || mask.render_sprites))
+	{
+		// "Odd Frame" cycle skip
+		cycle = 1;
+	}
 
-			// Clear Shifters
-			for (int i = 0; i < 8; i++)
-			{
-				sprite_shifter_pattern_lo[i] = 0;
-				sprite_shifter_pattern_hi[i] = 0;
-			}
-		}
+	if (scanline == -1 && cycle == 1)
+	{
+		// Effectively start of new frame, so clear vertical blank flag
+		status.vertical_blank = 0;
 
+		// Clear sprite overflow flag
+		status.sprite_overflow = 0;
+		
+		// Clear the sprite zero hit flag
+		status.sprite_zero_hit = 0;
 
-		if ((cycle >= 2 && cycle < 258) || (cycle >= 321 && cycle < 338))
-		{
-			UpdateShifters();
-			
-			
-			// In these cycles we are collecting and working with visible data
-			// The "shifters" have been preloaded by the end of the previous
-			// scanline with the data for the start of this scanline. Once we
-			// leave the visible region, we go dormant until the shifters are
-			// preloaded for the next scanline.
-
-			// Fortunately, for background rendering, we go through a fairly
-			// repeatable sequence of events, every 2 clock cycles.
-			switch ((cycle - 1) % 8)
-			{
-			case 0:
-				// Load the current background tile pattern and attributes into the "shifter"
-				LoadBackgroundShifters();
-
-				// Fetch the next background tile ID
-				// "(vram_addr.reg & 0x0FFF)" : Mask to 12 bits that are relevant
-				// "| 0x2000"                 : Offset into nametable space on PPU address bus
-				bg_next_tile_id = ppuRead(0x2000 | (vram_addr.reg & 0x0FFF));
-
-				// Explanation:
-				// The bottom 12 bits of the loopy register provide an index into
-				// the 4 nametables, regardless of nametable mirroring configuration.
-				// nametable_y(1) nametable_x(1) coarse_y(5) coarse_x(5)
-				//
-				// Consider a single nametable is a 32x32 array, and we have four of them
-				//   0                1
-				// 0 +----------------+----------------+
-				//   |                |                |
-				//   |                |                |
-				//   |    (32x32)     |    (32x32)     |
-				//   |                |                |
-				//   |                |                |
-				// 1 +----------------+----------------+
-				//   |                |                |
-				//   |                |                |
-				//   |    (32x32)     |    (32x32)     |
-				//   |                |                |
-				//   |                |                |
-				//   +----------------+----------------+
-				//
-				// This means there are 4096 potential locations in this array, which 
-				// just so happens to be 2^12!
-				break;
-			case 2:
-				// Fetch the next background tile attribute. OK, so this one is a bit
-				// more involved :P
-
-				// Recall that each nametable has two rows of cells that are not tile 
-				// information, instead they represent the attribute information that
-				// indicates which palettes are applied to which area on the screen.
-				// Importantly (and frustratingly) there is not a 1 to 1 correspondance
-				// between background tile and palette. Two rows of tile data holds
-				// 64 attributes. Therfore we can assume that the attributes affect
-				// 8x8 zones on the screen for that nametable. Given a working resolution
-				// of 256x240, we can further assume that each zone is 32x32 pixels
-				// in screen space, or 4x4 tiles. Four system palettes are allocated
-				// to background rendering, so a palette can be specified using just
-				// 2 bits. The attribute byte therefore can specify 4 distinct palettes.
-				// Therefore we can even further assume that a single palette is
-				// applied to a 2x2 tile combination of the 4x4 tile zone. The very fact
-				// that background tiles "share" a palette locally is the reason why
-				// in some games you see distortion in the colours at screen edges.
-
-				// As before when choosing the tile ID, we can use the bottom 12 bits of
-				// the loopy register, but we need to make the implementation "coarser"
-				// because instead of a specific tile, we want the attribute byte for a 
-				// group of 4x4 tiles, or in other words, we divide our 32x32 address
-				// by 4 to give us an equivalent 8x8 address, and we offset this address
-				// into the attribute section of the target nametable.
-
-				// Reconstruct the 12 bit loopy address into an offset into the
-				// attribute memory
-
-				// "(vram_addr.coarse_x >> 2)"        : integer divide coarse x by 4, 
-				//                                      from 5 bits to 3 bits
-				// "((vram_addr.coarse_y >> 2) << 3)" : integer divide coarse y by 4, 
-				//                                      from 5 bits to 3 bits,
-				//                                      shift to make room for coarse x
-
-				// Result so far: YX00 00yy yxxx
-
-				// All attribute memory begins at 0x03C0 within a nametable, so OR with
-				// result to select target nametable, and attribute byte offset. Finally
-				// OR with 0x2000 to offset into nametable address space on PPU bus.				
-				bg_next_tile_attrib = ppuRead(0x23C0 | (vram_addr.nametable_y << 11) 
-					                                 | (vram_addr.nametable_x << 10) 
-					                                 | ((vram_addr.coarse_y >> 2) << 3) 
-					                                 | (vram_addr.coarse_x >> 2));
-				
-				// Right we've read the correct attribute byte for a specified address,
-				// but the byte itself is broken down further into the 2x2 tile groups
-				// in the 4x4 attribute zone.
-
-				// The attribute byte is assembled thus: BR(76) BL(54) TR(32) TL(10)
-				//
-				// +----+----+			    +----+----+
-				// | TL | TR |			    | ID | ID |
-				// +----+----+ where TL =   +----+----+
-				// | BL | BR |			    | ID | ID |
-				// +----+----+			    +----+----+
-				//
-				// Since we know we can access a tile directly from the 12 bit address, we
-				// can analyse the bottom bits of the coarse coordinates to provide us with
-				// the correct offset into the 8-bit word, to yield the 2 bits we are
-				// actually interested in which specifies the palette for the 2x2 group of
-				// tiles. We know if "coarse y % 4" < 2 we are in the top half else bottom half.
-				// Likewise if "coarse x % 4" < 2 we are in the left half else right half.
-				// Ultimately we want the bottom two bits of our attribute word to be the
-				// palette selected. So shift as required...				
-				if (vram_addr.coarse_y & 0x02) bg_next_tile_attrib >>= 4;
-				if (vram_addr.coarse_x & 0x02) bg_next_tile_attrib >>= 2;
-				bg_next_tile_attrib &= 0x03;
-				break;
-
-				// Compared to the last two, the next two are the easy ones... :P
-
-			case 4: 
-				// Fetch the next background tile LSB bit plane from the pattern memory
-				// The Tile ID has been read from the nametable. We will use this id to 
-				// index into the pattern memory to find the correct sprite (assuming
-				// the sprites lie on 8x8 pixel boundaries in that memory, which they do
-				// even though 8x16 sprites exist, as background tiles are always 8x8).
-				//
-				// Since the sprites are effectively 1 bit deep, but 8 pixels wide, we 
-				// can represent a whole sprite row as a single byte, so offsetting
-				// into the pattern memory is easy. In total there is 8KB so we need a 
-				// 13 bit address.
-
-				// "(control.pattern_background << 12)"  : the pattern memory selector 
-				//                                         from control register, either 0K
-				//                                         or 4K offset
-				// "((uint16_t)bg_next_tile_id << 4)"    : the tile id multiplied by 16, as
-				//                                         2 lots of 8 rows of 8 bit pixels
-				// "(vram_addr.fine_y)"                  : Offset into which row based on
-				//                                         vertical scroll offset
-				// "+ 0"                                 : Mental clarity for plane offset
-				// Note: No PPU address bus offset required as it starts at 0x0000
-				bg_next_tile_lsb = ppuRead((control.pattern_background << 12) 
-					                       + ((uint16_t)bg_next_tile_id << 4) 
-					                       + (vram_addr.fine_y) + 0);
-
-				break;
-			case 6:
-				// Fetch the next background tile MSB bit plane from the pattern memory
-				// This is the same as above, but has a +8 offset to select the next bit plane
-				bg_next_tile_msb = ppuRead((control.pattern_background << 12)
-					                       + ((uint16_t)bg_next_tile_id << 4)
-					                       + (vram_addr.fine_y) + 8);
-				break;
-			case 7:
-				// Increment the background tile "pointer" to the next tile horizontally
-				// in the nametable memory. Note this may cross nametable boundaries which
-				// is a little complex, but essential to implement scrolling
-				IncrementScrollX();
-				break;
-			}
-		}
+		// Clear Shifters
+		sprite_dot = SpriteLineEnd;
+	}
 
-		// End of a visible scanline, so increment downwards...
-		if (cycle == 256)
-		{
-			IncrementScrollY();
-		}
 
-		//...and reset the x position
-		if (cycle == 257)
+	if ((cycle >= 2 && cycle < 258) || (cycle >= 321 && cycle < 338))
+	{
+		UpdateShifters();
+		
+		
+		// In these cycles we are collecting and working with visible data
+		// The "shifters" have been preloaded by the end of the previous
+		// scanline with the data for the start of this scanline. Once we
+		// leave the visible region, we go dormant until the shifters are
+		// preloaded for the next scanline.
+
+		// Fortunately, for background rendering, we go through a fairly
+		// repeatable sequence of events, every 2 clock cycles.
+		switch ((cycle - 1) % 8)
 		{
+		case 0:
+			// Load the current background tile pattern and attributes into the "shifter"
 			LoadBackgroundShifters();
-			TransferAddressX();
-		}
 
-		// Superfluous reads of tile id at end of scanline
-		if (cycle == 338 || cycle == 340)
-		{
-			bg_next_tile_id = ppuRead(0x2000 | (vram_addr.reg & 0x0FFF));
-		}
+			// Fetch the next background tile ID
+			// "(vram_addr.reg & 0x0FFF)" : Mask to 12 bits that are relevant
+			// "| 0x2000"                 : Offset into nametable space on PPU address bus
+			bg_next_tile_id = nametableRead(0x2000 | (vram_addr.reg & 0x0FFF));
+
+			// Explanation:
+			// The bottom 12 bits of the loopy register provide an index into
+			// the 4 nametables, regardless of nametable mirroring configuration.
+			// nametable_y(1) nametable_x(1) coarse_y(5) coarse_x(5)
+			//
+			// Consider a single nametable is a 32x32 array, and we have four of them
+			//   0                1
+			// 0 +----------------+----------------+
+			//   |                |                |
+			//   |                |                |
+			//   |    (32x32)     |    (32x32)     |
+			//   |                |                |
+			//   |                |                |
+			// 1 +----------------+----------------+
+			//   |                |                |
+			//   |                |                |
+			//   |    (32x32)     |    (32x32)     |
+			//   |                |                |
+			//   |                |                |
+			//   +----------------+----------------+
+			//
+			// This means there are 4096 potential locations in this array, which 
+			// just so happens to be 2^12!
+			break;
+		case 2:
+			// Fetch the next background tile attribute. OK, so this one is a bit
+			// more involved :P
+
+			// Recall that each nametable has two rows of cells that are not tile 
+			// information, instead they represent the attribute information that
+			// indicates which palettes are applied to which area on the screen.
+			// Importantly (and frustratingly) there is not a 1 to 1 correspondance
+			// between background tile and palette. Two rows of tile data holds
+			// 64 attributes. Therfore we can assume that the attributes affect
+			// 8x8 zones on the screen for that nametable. Given a working resolution
+			// of 256x240, we can further assume that each zone is 32x32 pixels
+			// in screen space, or 4x4 tiles. Four system palettes are allocated
+			// to background rendering, so a palette can be specified using just
+			// 2 bits. The attribute byte therefore can specify 4 distinct palettes.
+			// Therefore we can even further assume that a single palette is
+			// applied to a 2x2 tile combination of the 4x4 tile zone. The very fact
+			// that background tiles "share" a palette locally is the reason why
+			// in some games you see distortion in the colours at screen edges.
+
+			// As before when choosing the tile ID, we can use the bottom 12 bits of
+			// the loopy register, but we need to make the implementation "coarser"
+			// because instead of a specific tile, we want the attribute byte for a 
+			// group of 4x4 tiles, or in other words, we divide our 32x32 address
+			// by 4 to give us an equivalent 8x8 address, and we offset this address
+			// into the attribute section of the target nametable.
+
+			// Reconstruct the 12 bit loopy address into an offset into the
+			// attribute memory
+
+			// "(vram_addr.coarse_x >> 2)"        : integer divide coarse x by 4, 
+			//                                      from 5 bits to 3 bits
+			// "((vram_addr.coarse_y >> 2) << 3)" : integer divide coarse y by 4, 
+			//                                      from 5 bits to 3 bits,
+			//                                      shift to make room for coarse x
+
+			// Result so far: YX00 00yy yxxx
+
+			// All attribute memory begins at 0x03C0 within a nametable, so OR with
+			// result to select target nametable, and attribute byte offset. Finally
+			// OR with 0x2000 to offset into nametable address space on PPU bus.				
+			bg_next_tile_attrib = nametableRead(0x23C0 | (vram_addr.nametable_y << 11) 
+				                                 | (vram_addr.nametable_x << 10) 
+				                                 | ((vram_addr.coarse_y >> 2) << 3) 
+				                                 | (vram_addr.coarse_x >> 2));
+			
+			// Right we've read the correct attribute byte for a specified address,
+			// but the byte itself is broken down further into the 2x2 tile groups
+			// in the 4x4 attribute zone.
+
+			// The attribute byte is assembled thus: BR(76) BL(54) TR(32) TL(10)
+			//
+			// +----+----+			    +----+----+
+			// | TL | TR |			    | ID | ID |
+			// +----+----+ where TL =   +----+----+
+			// | BL | BR |			    | ID | ID |
+			// +----+----+			    +----+----+
+			//
+			// Since we know we can access a tile directly from the 12 bit address, we
+			// can analyse the bottom bits of the coarse coordinates to provide us with
+			// the correct offset into the 8-bit word, to yield the 2 bits we are
+			// actually interested in which specifies the palette for the 2x2 group of
+			// tiles. We know if "coarse y % 4" < 2 we are in the top half else bottom half.
+			// Likewise if "coarse x % 4" < 2 we are in the left half else right half.
+			// Ultimately we want the bottom two bits of our attribute word to be the
+			// palette selected. So shift as required...				
+			if (vram_addr.coarse_y & 0x02) bg_next_tile_attrib >>= 4;
+			if (vram_addr.coarse_x & 0x02) bg_next_tile_attrib >>= 2;
+			bg_next_tile_attrib &= 0x03;
+			break;
 
-		if (scanline == -1 && cycle >= 280 && cycle < 305)
-		{
-			// End of vertical blank period so reset the Y address ready for rendering
-			TransferAddressY();
-		}
+			// Compared to the last two, the next two are the easy ones... :P
+
+		case 4: 
+			// Fetch the next background tile LSB bit plane from the pattern memory
+			// The Tile ID has been read from the nametable. We will use this id to 
+			// index into the pattern memory to find the correct sprite (assuming
+			// the sprites lie on 8x8 pixel boundaries in that memory, which they do
+			// even though 8x16 sprites exist, as background tiles are always 8x8).
+			//
+			// Since the sprites are effectively 1 bit deep, but 8 pixels wide, we 
+			// can represent a whole sprite row as a single byte, so offsetting
+			// into the pattern memory is easy. In total there is 8KB so we need a 
+			// 13 bit address.
+
+			// "(control.pattern_background << 12)"  : the pattern memory selector 
+			//                                         from control register, either 0K
+			//                                         or 4K offset
+			// "((uint16_t)bg_next_tile_id << 4)"    : the tile id multiplied by 16, as
+			//                                         2 lots of 8 rows of 8 bit pixels
+			// "(vram_addr.fine_y)"                  : Offset into which row based on
+			//                                         vertical scroll offset
+			// "+ 0"                                 : Mental clarity for plane offset
+			// Note: No PPU address bus offset required as it starts at 0x0000
+			bg_next_tile_lsb = ppuRead((control.pattern_background << 12) 
+				                       + ((uint16_t)bg_next_tile_id << 4) 
+				                       + (vram_addr.fine_y) + 0);
 
+			break;
+		case 6:
+			// Fetch the next background tile MSB bit plane from the pattern memory
+			// This is the same as above, but has a +8 offset to select the next bit plane
+			bg_next_tile_msb = ppuRead((control.pattern_background << 12)
+				                       + ((uint16_t)bg_next_tile_id << 4)
+				                       + (vram_addr.fine_y) + 8);
+			break;
+		case 7:
+			// Increment the background tile "pointer" to the next tile horizontally
+			// in the nametable memory. Note this may cross nametable boundaries which
+			// is a little complex, but essential to implement scrolling
+			IncrementScrollX();
+			break;
+		}
+	}
 
-		// Foreground Rendering ========================================================
-		// I'm gonna cheat a bit here, which may reduce compatibility, but greatly
-		// simplifies delivering an intuitive understanding of what exactly is going
-		// on. The PPU loads sprite information successively during the region that
-		// background tiles are not being drawn. Instead, I'm going to perform
-		// all sprite evaluation in one hit. THE NES DOES NOT DO IT LIKE THIS! This makes
-		// it easier to see the process of sprite evaluation.
-		if (cycle == 257 && scanline >= 0)
-		{
-			// We've reached the end of a visible scanline. It is now time to determine
-			// which sprites are visible on the next scanline, and preload this info
-			// into buffers that we can work with while the scanline scans the row.
+	// End of a visible scanline, so increment downwards...
+	if (cycle == 256)
+	{
+		IncrementScrollY();
+	}
 
-			// Firstly, clear out the sprite memory. This memory is used to store the
-			// sprites to be rendered. It is not the OAM.
-			std::memset(spriteScanline, 0xFF, 8 * sizeof(sObjectAttributeEntry));
+	//...and reset the x position
+	if (cycle == 257)
+	{
+		LoadBackgroundShifters();
+		TransferAddressX();
+	}
 
-			// The NES supports a maximum number of sprites per scanline. Nominally
-			// this is 8 or fewer sprites. This is why in some games you see sprites
-			// flicker or disappear when the scene gets busy.
-			sprite_count = 0;
+	// Superfluous reads of tile id at end of scanline
+	if (cycle == 338 || cycle == 340)
+	{
+		bg_next_tile_id = nametableRead(0x2000 | (vram_addr.reg & 0x0FFF));
+	}
 
-			// Secondly, clear out any residual information in sprite pattern shifters
-			for (uint8_t i = 0; i < 8; i++)
-			{
-				sprite_shifter_pattern_lo[i] = 0;
-				sprite_shifter_pattern_hi[i] = 0;
-			}
+	if (scanline == -1 && cycle >= 280 && cycle < 305)
+	{
+		// End of vertical blank period so reset the Y address ready for rendering
+		TransferAddressY();
+	}
 
-			// Thirdly, Evaluate which sprites are visible in the next scanline. We need
-			// to iterate through the OAM until we have found 8 sprites that have Y-positions
-			// and heights that are within vertical range of the next scanline. Once we have
-			// found 8 or exhausted the OAM we stop. Now, notice I count to 9 sprites. This
-			// is so I can set the sprite overflow flag in the event of there being > 8 sprites.
-			uint8_t nOAMEntry = 0;
 
-			// New set of sprites. Sprite zero may not exist in the new set, so clear this
-			// flag.
-			bSpriteZeroHitPossible = false;
+	// Foreground Rendering ========================================================
+	// I'm gonna cheat a bit here, which may reduce compatibility, but greatly
+	// simplifies delivering an intuitive understanding of what exactly is going
+	// on. The PPU loads sprite information successively during the region that
+	// background tiles are not being drawn. Instead, I'm going to perform
+	// all sprite evaluation in one hit. THE NES DOES NOT DO IT LIKE THIS! This makes
+	// it easier to see the process of sprite evaluation.
+	if (cycle == 257 && scanline >= 0)
+	{
+		// We've reached the end of a visible scanline. It is now time to determine
+		// which sprites are visible on the next scanline, and preload this info
+		// into buffers that we can work with while the scanline scans the row.
+
+		// Firstly, clear out the sprite memory. This memory is used to store the
+		// sprites to be rendered. It is not the OAM.
+		std::memset(spriteScanline, 0xFF, 8 * sizeof(sObjectAttributeEntry));
+
+		// The NES supports a maximum number of sprites per scanline. Nominally
+		// this is 8 or fewer sprites. This is why in some games you see sprites
+		// flicker or disappear when the scene gets busy.
+		sprite_count = 0;
+
+		// Secondly, clear out any residual information in sprite pattern shifters
+		sprite_dot = SpriteLineEnd;
+
+		// Thirdly, Evaluate which sprites are visible in the next scanline. We need
+		// to iterate through the OAM until we have found 8 sprites that have Y-positions
+		// and heights that are within vertical range of the next scanline. Once we have
+		// found 8 or exhausted the OAM we stop. Now, notice I count to 9 sprites. This
+		// is so I can set the sprite overflow flag in the event of there being > 8 sprites.
+		uint8_t nOAMEntry = 0;
+
+		// New set of sprites. Sprite zero may not exist in the new set, so clear this
+		// flag.
+		bSpriteZeroHitPossible = false;
+
+		while (nOAMEntry < 64 && sprite_count < 9)
+		{
+			// Note the conversion to signed numbers here
+			int16_t diff = ((int16_t)scanline - (int16_t)OAM[nOAMEntry].y);
 
-			while (nOAMEntry < 64 && sprite_count < 9)
+			// If the difference is positive then the scanline is at least at the
+			// same height as the sprite, so check if it resides in the sprite vertically
+			// depending on the current "sprite height mode"
+			// FLAGGED
+			
+			if (diff >= 0 && diff < (control.sprite_size ? 16 : 8))
 			{
-				// Note the conversion to signed numbers here
-				int16_t diff = ((int16_t)scanline - (int16_t)OAM[nOAMEntry].y);
-
-				// If the difference is positive then the scanline is at least at the
-				// same height as the sprite, so check if it resides in the sprite vertically
-				// depending on the current "sprite height mode"
-				// FLAGGED
-				
-				if (diff >= 0 && diff < (control.sprite_size ? 16 : 8))
+				// Sprite is visible, so copy the attribute entry over to our
+				// scanline sprite cache. Ive added < 8 here to guard the array
+				// being written to.
+				if (sprite_count < 8)
 				{
-					// Sprite is visible, so copy the attribute entry over to our
-					// scanline sprite cache. Ive added < 8 here to guard the array
-					// being written to.
-					if (sprite_count < 8)
+					// Is this sprite sprite zero?
+					if (nOAMEntry == 0)
 					{
-						// Is this sprite sprite zero?
-						if (nOAMEntry == 0)
-						{
-							// It is, so its possible it may trigger a 
-							// sprite zero hit when drawn
-							bSpriteZeroHitPossible = true;
-						}
-
-						memcpy(&spriteScanline[sprite_count], &OAM[nOAMEntry], sizeof(sObjectAttributeEntry));
-                        sprite_count++;
+						// It is, so its possible it may trigger a 
+						// sprite zero hit when drawn
+						bSpriteZeroHitPossible = true;
 					}
+
+					memcpy(&spriteScanline[sprite_count], &OAM[nOAMEntry], sizeof(sObjectAttributeEntry));
+                    sprite_count++;
 				}
-				nOAMEntry++;
-			} // End of sprite evaluation for next scanline
+			}
+			nOAMEntry++;
+		} // End of sprite evaluation for next scanline
 
-			// Set sprite overflow flag
-			status.sprite_overflow = (sprite_count > 8);
+		// Set sprite overflow flag
+		status.sprite_overflow = (sprite_count > 8);
 
-			// Now we have an array of the 8 visible sprites for the next scanline. By 
-			// the nature of this search, they are also ranked in priority, because
-			// those lower down in the OAM have the higher priority.
+		// Now we have an array of the 8 visible sprites for the next scanline. By 
+		// the nature of this search, they are also ranked in priority, because
+		// those lower down in the OAM have the higher priority.
 
-			// We also guarantee that "Sprite Zero" will exist in spriteScanline[0] if
-			// it is evaluated to be visible. 
-		}
+		// We also guarantee that "Sprite Zero" will exist in spriteScanline[0] if
+		// it is evaluated to be visible. 
+	}
+
+	if (cycle == 340)
+	{
+		// Now we're at the very end of the scanline, I'm going to prepare the 
+		// sprite line buffer with the 8 or less selected sprites.
+		LoadSpriteLine();
+	}
+}
+
+// Fetch the patterns of the sprites selected for the next scanline and
+// draw them into its line buffer. Lower numbered sprites win, which
+// drawing them in reverse order takes care of.
+void NesPPU::LoadSpriteLine()
+{
+	sprite_dot = SpriteLineEnd;
+	if (sprite_count == 0)
+		return;
 
-		if (cycle == 340)
+	std::memset(sprite_line, 0, sizeof(sprite_line));
+	for (int i = sprite_count - 1; i >= 0; i--)
+	{
+		// We need to extract the 8-bit row patterns of the sprite with the
+		// correct vertical offset. The "Sprite Mode" also affects this as
+		// the sprites may be 8 or 16 rows high. Additionally, the sprite
+		// can be flipped both vertically and horizontally. So there's a lot
+		// going on here :P
+
+		uint16_t sprite_pattern_addr_lo;
+
+		// Determine the memory addresses that contain the byte of pattern data. We
+		// only need the lo pattern address, because the hi pattern address is always
+		// offset by 8 from the lo address.
+		if (!control.sprite_size)
 		{
-			// Now we're at the very end of the scanline, I'm going to prepare the 
-			// sprite shifters with the 8 or less selected sprites.
+			// 8x8 Sprite Mode - The control register determines the pattern table
+			if (!(spriteScanline[i].attribute & 0x80))
+			{
+				// Sprite is NOT flipped vertically, i.e. normal    
+				sprite_pattern_addr_lo = 
+				  (control.pattern_sprite << 12  )  // Which Pattern Table? 0KB or 4KB offset
+				| (spriteScanline[i].id   << 4   )  // Which Cell? Tile ID * 16 (16 bytes per tile)
+				| (scanline - spriteScanline[i].y); // Which Row in cell? (0->7)
+										
+			}
+			else
+			{
+				// Sprite is flipped vertically, i.e. upside down
+				sprite_pattern_addr_lo = 
+				  (control.pattern_sprite << 12  )  // Which Pattern Table? 0KB or 4KB offset
+				| (spriteScanline[i].id   << 4   )  // Which Cell? Tile ID * 16 (16 bytes per tile)
+				| (7 - (scanline - spriteScanline[i].y)); // Which Row in cell? (7->0)
+			}
 
-			for (uint8_t i = 0; i < sprite_count; i++)
+		}
+		else
+		{
+			// 8x16 Sprite Mode - The sprite attribute determines the pattern table
+			if (!(spriteScanline[i].attribute & 0x80))
 			{
-				// We need to extract the 8-bit row patterns of the sprite with the
-				// correct vertical offset. The "Sprite Mode" also affects this as
-				// the sprites may be 8 or 16 rows high. Additionally, the sprite
-				// can be flipped both vertically and horizontally. So there's a lot
-				// going on here :P
-
-				uint8_t sprite_pattern_bits_lo, sprite_pattern_bits_hi;
-				uint16_t sprite_pattern_addr_lo, sprite_pattern_addr_hi;
-
-				// Determine the memory addresses that contain the byte of pattern data. We
-				// only need the lo pattern address, because the hi pattern address is always
-				// offset by 8 from the lo address.
-				if (!control.sprite_size)
+				// Sprite is NOT flipped vertically, i.e. normal
+				if (scanline - spriteScanline[i].y < 8)
 				{
-					// 8x8 Sprite Mode - The control register determines the pattern table
-					if (!(spriteScanline[i].attribute & 0x80))
-					{
-						// Sprite is NOT flipped vertically, i.e. normal    
-						sprite_pattern_addr_lo = 
-						  (control.pattern_sprite << 12  )  // Which Pattern Table? 0KB or 4KB offset
-						| (spriteScanline[i].id   << 4   )  // Which Cell? Tile ID * 16 (16 bytes per tile)
-						| (scanline - spriteScanline[i].y); // Which Row in cell? (0->7)
-												
-					}
-					else
-					{
-						// Sprite is flipped vertically, i.e. upside down
-						sprite_pattern_addr_lo = 
-						  (control.pattern_sprite << 12  )  // Which Pattern Table? 0KB or 4KB offset
-						| (spriteScanline[i].id   << 4   )  // Which Cell? Tile ID * 16 (16 bytes per tile)
-						| (7 - (scanline - spriteScanline[i].y)); // Which Row in cell? (7->0)
-					}
-
+					// Reading Top half Tile
+					sprite_pattern_addr_lo = 
+					  ((spriteScanline[i].id & 0x01)      << 12)  // Which Pattern Table? 0KB or 4KB offset
+					| ((spriteScanline[i].id & 0xFE)      << 4 )  // Which Cell? Tile ID * 16 (16 bytes per tile)
+					| ((scanline - spriteScanline[i].y) & 0x07 ); // Which Row in cell? (0->7)
 				}
 				else
 				{
-					// 8x16 Sprite Mode - The sprite attribute determines the pattern table
-					if (!(spriteScanline[i].attribute & 0x80))
-					{
-						// Sprite is NOT flipped vertically, i.e. normal
-						if (scanline - spriteScanline[i].y < 8)
-						{
-							// Reading Top half Tile
-							sprite_pattern_addr_lo = 
-							  ((spriteScanline[i].id & 0x01)      << 12)  // Which Pattern Table? 0KB or 4KB offset
-							| ((spriteScanline[i].id & 0xFE)      << 4 )  // Which Cell? Tile ID * 16 (16 bytes per tile)
-							| ((scanline - spriteScanline[i].y) & 0x07 ); // Which Row in cell? (0->7)
-						}
-						else
-						{
-							// Reading Bottom Half Tile
-							sprite_pattern_addr_lo = 
-							  ( (spriteScanline[i].id & 0x01)      << 12)  // Which Pattern Table? 0KB or 4KB offset
-							| (((spriteScanline[i].id & 0xFE) + 1) << 4 )  // Which Cell? Tile ID * 16 (16 bytes per tile)
-							| ((scanline - spriteScanline[i].y) & 0x07  ); // Which Row in cell? (0->7)
-						}
-					}
-					else
-					{
-						// Sprite is flipped vertically, i.e. upside down
-						if (scanline - spriteScanline[i].y < 8)
-						{
-							// Reading Top half Tile
-							sprite_pattern_addr_lo = 
-							  ( (spriteScanline[i].id & 0x01)      << 12)    // Which Pattern Table? 0KB or 4KB offset
-							| (((spriteScanline[i].id & 0xFE) + 1) << 4 )    // Which Cell? Tile ID * 16 (16 bytes per tile)
-							| (7 - (scanline - spriteScanline[i].y) & 0x07); // Which Row in cell? (0->7)
-						}
-						else
-						{
-							// Reading Bottom Half Tile
-							sprite_pattern_addr_lo = 
-							  ((spriteScanline[i].id & 0x01)       << 12)    // Which Pattern Table? 0KB or 4KB offset
-							| ((spriteScanline[i].id & 0xFE)       << 4 )    // Which Cell? Tile ID * 16 (16 bytes per tile)
-							| (7 - (scanline - spriteScanline[i].y) & 0x07); // Which Row in cell? (0->7)
-						}
-					}
+					// Reading Bottom Half Tile
+					sprite_pattern_addr_lo = 
+					  ( (spriteScanline[i].id & 0x01)      << 12)  // Which Pattern Table? 0KB or 4KB offset
+					| (((spriteScanline[i].id & 0xFE) + 1) << 4 )  // Which Cell? Tile ID * 16 (16 bytes per tile)
+					| ((scanline - spriteScanline[i].y) & 0x07  ); // Which Row in cell? (0->7)
 				}
-
-				// Phew... XD I'm absolutely certain you can use some fantastic bit 
-				// manipulation to reduce all of that to a few one liners, but in this
-				// form it's easy to see the processes required for the different
-				// sizes and vertical orientations
-
-				// Hi bit plane equivalent is always offset by 8 bytes from lo bit plane
-				sprite_pattern_addr_hi = sprite_pattern_addr_lo + 8;
-
-				// Now we have the address of the sprite patterns, we can read them
-				sprite_pattern_bits_lo = ppuRead(sprite_pattern_addr_lo);
-				sprite_pattern_bits_hi = ppuRead(sprite_pattern_addr_hi);
-
-				// If the sprite is flipped horizontally, we need to flip the 
-				// pattern bytes. 
-				if (spriteScanline[i].attribute & 0x40)
+			}
+			else
+			{
+				// Sprite is flipped vertically, i.e. upside down
+				if (scanline - spriteScanline[i].y < 8)
 				{
-					// This little lambda function "flips" a byte
-					// so 0b11100000 becomes 0b00000111. It's very
-					// clever, and stolen completely from here:
-					// https://stackoverflow.com/a/2602885
-					auto flipbyte = [](uint8_t b)
-					{
-						b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-						b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-						b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-						return b;
-					};
-
-					// Flip Patterns Horizontally
-					sprite_pattern_bits_lo = flipbyte(sprite_pattern_bits_lo);
-					sprite_pattern_bits_hi = flipbyte(sprite_pattern_bits_hi);
+					// Reading Top half Tile
+					sprite_pattern_addr_lo = 
+					  ( (spriteScanline[i].id & 0x01)      << 12)    // Which Pattern Table? 0KB or 4KB offset
+					| (((spriteScanline[i].id & 0xFE) + 1) << 4 )    // Which Cell? Tile ID * 16 (16 bytes per tile)
+					| (7 - (scanline - spriteScanline[i].y) & 0x07); // Which Row in cell? (0->7)
+				}
+				else
+				{
+					// Reading Bottom Half Tile
+					sprite_pattern_addr_lo = 
+					  ((spriteScanline[i].id & 0x01)       << 12)    // Which Pattern Table? 0KB or 4KB offset
+					| ((spriteScanline[i].id & 0xFE)       << 4 )    // Which Cell? Tile ID * 16 (16 bytes per tile)
+					| (7 - (scanline - spriteScanline[i].y) & 0x07); // Which Row in cell? (0->7)
 				}
-
-				// Finally! We can load the pattern into our sprite shift registers
-				// ready for rendering on the next scanline
-				sprite_shifter_pattern_lo[i] = sprite_pattern_bits_lo;
-				sprite_shifter_pattern_hi[i] = sprite_pattern_bits_hi;
 			}
 		}
-	}
 
-	if (scanline == 240)
-	{
-		// Post Render Scanline - Do Nothing!
-	}
-
-	if (scanline >= 241 && scanline < 261)
-	{
-		if (scanline == 241 && cycle == 1)
+		// Phew... XD I'm absolutely certain you can use some fantastic bit 
+		// manipulation to reduce all of that to a few one liners, but in this
+		// form it's easy to see the processes required for the different
+		// sizes and vertical orientations
+
+		// Now we have the address of the sprite patterns, we can read them,
+		// as a row of 8 pixels already flipped horizontally if need be.
+		// Hi bit plane equivalent is always offset by 8 bytes from lo bit
+		// plane. The sprites of the last visible scanline are fetched again
+		// on the pre-render one, and their rows can land anywhere, so read
+		// those through the bus.
+		const bool bFlip = (spriteScanline[i].attribute & 0x40) != 0;
+		const uint64_t row = (sprite_pattern_addr_lo & 0xE008) == 0
+			? patternRow(sprite_pattern_addr_lo, bFlip)
+			: NesTileCache::DecodeRow(ppuRead(sprite_pattern_addr_lo), ppuRead(sprite_pattern_addr_lo + 8), bFlip);
+
+		// A sprite covers the 8 pixels from its x, those past the
+		// right edge are never shown
+		const uint8_t attrib = ((spriteScanline[i].attribute & 0x03) + 0x04) << 2
+			| ((spriteScanline[i].attribute & 0x20) == 0) << 5
+			| (i == 0) << 6;
+		for (int x = 0; x < 8 && spriteScanline[i].x + x < 256; x++)
 		{
-			// Effectively end of frame, so set vertical blank flag
-			status.vertical_blank = 1;
-
-			// If the control register tells us to emit a NMI when
-			// entering vertical blanking period, do it! The CPU
-			// will be informed that rendering is complete so it can
-			// perform operations with the PPU knowing it wont
-			// produce visible artefacts
-			if (control.enable_nmi) 
-				nmi = true;
+			const uint8_t pixel = (uint8_t)(row >> (x * 8));
+			if (pixel != 0)
+				sprite_line[spriteScanline[i].x + x] = pixel | attrib;
 		}
 	}
 
+	sprite_dot = 0;
+}
 
-
-	// Composition - We now have background & foreground pixel information for this cycle
-
+// Combine the background and sprite pixels of the current dot. Returns the
+// palette in bits 2-3 and the pixel within it in bits 0-1.
+uint8_t NesPPU::composeDot()
+{
 	// Background =============================================================
 	uint8_t bg_pixel = 0x00;   // The 2-bit pixel to be rendered
 	uint8_t bg_palette = 0x00; // The 3-bit index of the palette the pixel indexes
@@ -1058,7 +1154,8 @@ void NesPPU::clock()
 	// the current background colour in effect
 	if (mask.render_background)
 	{
-		// if (mask.render_background_left || (cycle >= 9))
+		// The leftmost 8 pixels can be clipped
+		if (mask.render_background_left || (cycle >= 9))
 		{
 			// Handle Pixel Selection by selecting the relevant bit
 			// depending upon fine x scolling. This has the effect of
@@ -1088,49 +1185,18 @@ void NesPPU::clock()
 							   // more important than the background
 	if (mask.render_sprites)
 	{
-		// Iterate through all sprites for this scanline. This is to maintain
-		// sprite priority. As soon as we find a non transparent pixel of
-		// a sprite we can abort
-		// if (mask.render_sprites_left || (cycle >= 9))
+		// The sprites were drawn into the line buffer in priority order
+		// when they were fetched, so the pixel is already decided. Note
+		// Fine X scrolling does not apply to sprites, the game should
+		// maintain their relationship with the background.
+		if (mask.render_sprites_left || (cycle >= 9))
 		{
-
-			bSpriteZeroBeingRendered = false;
-
-			for (uint8_t i = 0; i < sprite_count; i++)
-			{
-				// Scanline cycle has "collided" with sprite, shifters taking over
-				if (spriteScanline[i].x == 0)
-				{
-					// Note Fine X scrolling does not apply to sprites, the game
-					// should maintain their relationship with the background. So
-					// we'll just use the MSB of the shifter
-
-					// Determine the pixel value...
-					uint8_t fg_pixel_lo = (sprite_shifter_pattern_lo[i] & 0x80) > 0;
-					uint8_t fg_pixel_hi = (sprite_shifter_pattern_hi[i] & 0x80) > 0;
-					fg_pixel = (fg_pixel_hi << 1) | fg_pixel_lo;
-
-					// Extract the palette from the bottom two bits. Recall
-					// that foreground palettes are the latter 4 in the 
-					// palette memory.
-					fg_palette = (spriteScanline[i].attribute & 0x03) + 0x04;
-					fg_priority = (spriteScanline[i].attribute & 0x20) == 0;
-
-					// If pixel is not transparent, we render it, and dont
-					// bother checking the rest because the earlier sprites
-					// in the list are higher priority
-					if (fg_pixel != 0)
-					{
-						if (i == 0) // Is this sprite zero?
-						{
-							bSpriteZeroBeingRendered = true;
-						}
-
-						break;
-					}
-				}
-			}
-		}		
+			const uint8_t fg = sprite_dot < SpriteLineEnd ? sprite_line[sprite_dot] : 0x00;
+			fg_pixel = fg & 0x03;
+			fg_palette = (fg >> 2) & 0x07;
+			fg_priority = (fg >> 5) & 0x01;
+			bSpriteZeroBeingRendered = (fg & 0x40) != 0;
+		}
 	}
 
 	// Now we have a background pixel and a foreground pixel. They need
@@ -1192,31 +1258,21 @@ void NesPPU::clock()
 			{
 				// The left edge of the screen has specific switches to control
 				// its appearance. This is used to smooth inconsistencies when
-				// scrolling (since sprites x coord must be >= 0)
-				if (!(mask.render_background_left | mask.render_sprites_left))
+				// scrolling (since sprites x coord must be >= 0). Whichever
+				// is clipped there is transparent, so cannot hit.
+				if (cycle >= 1 && cycle < 258)
 				{
-					if (cycle >= 9 && cycle < 258)
-					{
-						status.sprite_zero_hit = 1;
-					}
-				}
-				else
-				{
-					if (cycle >= 1 && cycle < 258)
-					{
-						status.sprite_zero_hit = 1;
-					}
+					status.sprite_zero_hit = 1;
 				}
 			}
 		}
 	}
 
-	// Now we have a final pixel colour, and a palette for this cycle
-	// of the current scanline. Let's at long last, draw that ^&%*er :P
-    if (cycle - 1 >= 0 && cycle -1 < 256 && scanline >= 0 && scanline < 240) {
-        sprScreen[scanline*256 + cycle - 1] = GetColourFromPaletteRam(palette, pixel);
-    }
+	return (palette << 2) | pixel;
+}
 
+void NesPPU::advanceDot()
+{
 	// Advance renderer - it never stops, it's relentless
 	cycle++;
 	if(mask.render_background || mask.render_sprites) {
@@ -1238,3 +1294,230 @@ void NesPPU::clock()
 		}
 	}
 }
+
+void NesPPU::Run(uint32_t nClocks)
+{
+	while (nClocks > 0)
+	{
+		if (cycle == 0 && bScanlineRenderer)
+		{
+			if (scanline >= 0 && scanline < 240)
+			{
+				// Scanline 0 is a dot short on odd frames while rendering
+				const uint32_t nLine = (scanline == 0 && odd_frame && (mask.render_background || mask.render_sprites)) ? 340 : 341;
+				if (nClocks >= nLine)
+				{
+					renderScanline();
+					nClocks -= nLine;
+					continue;
+				}
+			}
+			else if (scanline >= 240 && nClocks >= 341)
+			{
+				idleScanline();
+				nClocks -= 341;
+				continue;
+			}
+		}
+
+		clock();
+		nClocks--;
+	}
+}
+
+void NesPPU::renderScanline()
+{
+	// Background =============================================================
+	// The shifters hand out one pixel per dot from a continuous run of
+	// tiles, offset by fine x. The first 16 pixels of the run are what the
+	// shifters were preloaded with at the end of the last scanline, and
+	// the rest are the tiles fetched along this one, which are fetched
+	// here in the same order, at the same addresses.
+	// Without a picture to draw the pixels only matter to sprite zero
+	// hits, and only until one is found
+	const bool bPicture = !bSkipPicture && pScreen != nullptr;
+	const bool bSpriteZeroHitEnabled = bSpriteZeroHitPossible && mask.render_background && mask.render_sprites;
+	const bool bCompose = bPicture || (bSpriteZeroHitEnabled && !status.sprite_zero_hit);
+
+	alignas(32) uint8_t bgLine[16 + 32 * 8]; // Pixel in bits 0-1, palette in bits 2-3
+	for (int p = 0; bCompose && p < 16; p++)
+	{
+		const uint16_t bit_mux = 0x8000 >> p;
+		bgLine[p] = ((bg_shifter_pattern_lo & bit_mux) > 0)
+			| (((bg_shifter_pattern_hi & bit_mux) > 0) << 1)
+			| (((bg_shifter_attrib_lo & bit_mux) > 0) << 2)
+			| (((bg_shifter_attrib_hi & bit_mux) > 0) << 3);
+	}
+
+	// Tiles 30 and 31 are left in the shifters at dot 256
+	uint8_t tile_lsb[32], tile_msb[32], tile_attrib[32];
+	for (int tile = 0; tile < 32; tile++)
+	{
+		// Fetching has no side effects for any of the mappers, so when
+		// nothing is composed only the tiles that are left behind in the
+		// shifters and latches need to be read
+		if (!bCompose && tile < 29)
+		{
+			IncrementScrollX();
+			continue;
+		}
+
+		// The first tile ID was read at the end of the last scanline, the
+		// others as the previous tile was loaded into the shifters
+		if (tile > 0)
+			bg_next_tile_id = nametableRead(0x2000 | (vram_addr.reg & 0x0FFF));
+
+		bg_next_tile_attrib = nametableRead(0x23C0 | (vram_addr.nametable_y << 11) 
+			                                 | (vram_addr.nametable_x << 10) 
+			                                 | ((vram_addr.coarse_y >> 2) << 3) 
+			                                 | (vram_addr.coarse_x >> 2));
+		if (vram_addr.coarse_y & 0x02) bg_next_tile_attrib >>= 4;
+		if (vram_addr.coarse_x & 0x02) bg_next_tile_attrib >>= 2;
+		bg_next_tile_attrib &= 0x03;
+
+		const uint16_t addr = (control.pattern_background << 12) 
+			                + ((uint16_t)bg_next_tile_id << 4) 
+			                + (vram_addr.fine_y);
+		bg_next_tile_lsb = ppuRead(addr + 0);
+		bg_next_tile_msb = ppuRead(addr + 8);
+		tile_lsb[tile] = bg_next_tile_lsb;
+		tile_msb[tile] = bg_next_tile_msb;
+		tile_attrib[tile] = bg_next_tile_attrib;
+
+		if (bCompose)
+		{
+			const uint64_t row = patternRow(addr, false) | (0x0101010101010101ull * (bg_next_tile_attrib << 2));
+			for (int x = 0; x < 8; x++)
+				bgLine[16 + tile * 8 + x] = (uint8_t)(row >> (x * 8));
+		}
+
+		IncrementScrollX();
+	}
+	IncrementScrollY();
+
+	// Leave the shifters as they would be after dot 256, the last tile
+	// being loaded at dot 257
+	auto shifter = [&](uint16_t current, uint8_t hi, uint8_t lo)
+	{
+		if (mask.render_background)
+			return (uint16_t)((hi << 8 | lo) << 7);
+		return (uint16_t)((current & 0xFF00) | lo);
+	};
+	auto inflate = [](uint8_t attrib, uint8_t bit) -> uint8_t { return (attrib & bit) ? 0xFF : 0x00; };
+	bg_shifter_pattern_lo = shifter(bg_shifter_pattern_lo, tile_lsb[29], tile_lsb[30]);
+	bg_shifter_pattern_hi = shifter(bg_shifter_pattern_hi, tile_msb[29], tile_msb[30]);
+	bg_shifter_attrib_lo = shifter(bg_shifter_attrib_lo, inflate(tile_attrib[29], 0b01), inflate(tile_attrib[30], 0b01));
+	bg_shifter_attrib_hi = shifter(bg_shifter_attrib_hi, inflate(tile_attrib[29], 0b10), inflate(tile_attrib[30], 0b10));
+
+	// Foreground =============================================================
+	// The sprites were drawn into their line buffer as they were fetched
+	// and have not moved yet. Sprite evaluation at dot 257 leaves the
+	// buffer empty whether or not they would have moved.
+	const bool bSprites = mask.render_sprites && sprite_dot == 0;
+
+	// Composition ============================================================
+	alignas(32) uint8_t colours[32];
+	for (uint8_t palette = 0; bPicture && palette < 8; palette++)
+		for (uint8_t pixel = 0; pixel < 4; pixel++)
+			colours[(palette << 2) | pixel] = GetPaletteIndex(palette, pixel);
+
+	if (bPicture)
+		sprScreenEmphasis[scanline] = mask.reg >> 5;
+	if (bCompose)
+	{
+		NesCompositor::Line line;
+		line.pBackground = bgLine + fine_x;
+		line.pSprites = bSprites ? sprite_line : noSprites;
+		line.bBackground = mask.render_background;
+		line.bBackgroundLeft = mask.render_background_left;
+		line.bSpritesLeft = mask.render_sprites_left;
+		line.pColours = colours;
+		line.pOut = bPicture ? pScreen + scanline * 256 : nullptr;
+		if (NesCompositor::Compose(line) && bSpriteZeroHitEnabled)
+			status.sprite_zero_hit = 1;
+	}
+
+	// The rest of the line draws nothing and fetches ahead for the next
+	// one, apart from the final dot every pixel is composed from empty
+	// sprite shifters, so only fetching needs to run
+	cycle = 257;
+	while (cycle < 340)
+	{
+		fetchDot();
+		advanceDot();
+	}
+	fetchDot();
+	composeDot();
+	advanceDot();
+}
+
+void NesPPU::idleScanline()
+{
+	// Nothing is fetched outside the visible scanlines and the shifters
+	// stand still, so every dot of the line composes the same pixel. One
+	// dot from the range where sprite zero hits count stands in for all.
+	if (scanline == 241)
+	{
+		status.vertical_blank = 1;
+		if (control.enable_nmi) 
+			nmi = true;
+	}
+
+	cycle = 9;
+	composeDot();
+
+	cycle = 340;
+	advanceDot();
+}
+
+void NesPPU::clock()
+{
+	// As we progress through scanlines and cycles, the PPU is effectively
+	// a state machine going through the motions of fetching background 
+	// information and sprite information, compositing them into a pixel
+	// to be output.
+
+	// All but 1 of the secanlines is visible to the user. The pre-render scanline
+	// at -1, is used to configure the "shifters" for the first visible scanline, 0.
+	if (scanline >= -1 && scanline < 240)
+		fetchDot();
+
+	if (scanline == 240)
+	{
+		// Post Render Scanline - Do Nothing!
+	}
+
+	if (scanline >= 241 && scanline < 261)
+	{
+		if (scanline == 241 && cycle == 1)
+		{
+			// Effectively end of frame, so set vertical blank flag
+			status.vertical_blank = 1;
+
+			// If the control register tells us to emit a NMI when
+			// entering vertical blanking period, do it! The CPU
+			// will be informed that rendering is complete so it can
+			// perform operations with the PPU knowing it wont
+			// produce visible artefacts
+			if (control.enable_nmi) 
+				nmi = true;
+		}
+	}
+
+
+
+	// Composition - We now have background & foreground pixel information for this cycle
+	const uint8_t composed = composeDot();
+	const uint8_t palette = composed >> 2;
+	const uint8_t pixel = composed & 0x03;
+
+	// Now we have a final pixel colour, and a palette for this cycle
+	// of the current scanline. Let's at long last, draw that ^&%*er :P
+    if (!bSkipPicture && pScreen != nullptr && cycle - 1 >= 0 && cycle -1 < 256 && scanline >= 0 && scanline < 240) {
+        if (cycle == 1)
+            sprScreenEmphasis[scanline] = mask.reg >> 5;
+        pScreen[scanline*256 + cycle - 1] = GetPaletteIndex(palette, pixel);
+    }
+
+	advanceDot();
+}
@@ -0,0 +1,274 @@
+#include "NesResampler.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NESRESAMPLER_X86
+#include <immintrin.h>
+#endif
+
+// As in NesCompositor, the SIMD versions are built for their instruction
+// set whatever the compiler is targeting
+#if defined(NESRESAMPLER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define NESRESAMPLER_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NESRESAMPLER_TARGET(isa)
+#endif
+
+namespace
+{
+
+using Kernel = NesResampler::Kernel;
+using Level = NesResampler::Level;
+
+constexpr int Taps = NesResampler::Taps;
+constexpr int Phases = NesResampler::Phases;
+constexpr int KernelBits = NesResampler::KernelBits;
+
+// The phase is the top bits of the position's fraction
+constexpr int PhaseShift = 32 - 8;
+static_assert(Phases == 1 << 8, "The phase is taken from the top 8 bits of the fraction");
+
+// The kernel for a cutoff given as a fraction of the input's Nyquist
+// frequency, in 1/65536ths
+std::shared_ptr<const Kernel> makeKernel(uint32_t nCutoff)
+{
+	auto pKernel = std::make_shared<Kernel>();
+
+	const double pi = 3.14159265358979323846;
+	const double cutoff = nCutoff / 65536.0;
+	for (int p = 0; p < Phases; p++)
+	{
+		double sinc_taps[Taps];
+		double sum = 0.0;
+		for (int i = 0; i < Taps; i++)
+		{
+			const double t = i - (Taps / 2 - 1) - (double)p / Phases;
+			const double x = pi * cutoff * t;
+			const double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+			const double window = 0.42 + 0.5 * std::cos(2.0 * pi * t / Taps) + 0.08 * std::cos(4.0 * pi * t / Taps);
+			sinc_taps[i] = sinc * window;
+			sum += sinc_taps[i];
+		}
+
+		// Every phase passes a constant level through unchanged
+		int32_t total = 0;
+		int nLargest = 0;
+		for (int i = 0; i < Taps; i++)
+		{
+			pKernel->taps[p][i] = (int16_t)std::lround(sinc_taps[i] / sum * (1 << KernelBits));
+			total += pKernel->taps[p][i];
+			if (pKernel->taps[p][i] > pKernel->taps[p][nLargest])
+				nLargest = i;
+		}
+		pKernel->taps[p][nLargest] += (int16_t)((1 << KernelBits) - total);
+	}
+	return pKernel;
+}
+
+// Kernels in use, by cutoff, so machines running at the same rates share one
+std::shared_ptr<const Kernel> kernel(uint32_t nCutoff)
+{
+	static std::mutex mutex;
+	static std::map<uint32_t, std::weak_ptr<const Kernel>> kernels;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& entry = kernels[nCutoff];
+	std::shared_ptr<const Kernel> pKernel = entry.lock();
+	if (pKernel == nullptr)
+	{
+		pKernel = makeKernel(nCutoff);
+		entry = pKernel;
+	}
+	return pKernel;
+}
+
+int16_t output(int32_t nSum)
+{
+	return (int16_t)std::clamp<int32_t>((nSum + (1 << (KernelBits - 1))) >> KernelBits, -32768, 32767);
+}
+
+// Everything a version needs to run, the position moving along as it goes
+struct Run
+{
+	const int16_t* pInput;
+	size_t nInput;
+	const Kernel* pKernel;
+	uint64_t nPosition;
+	uint64_t nStep;
+	int16_t* pOut;
+	size_t nMax;
+};
+
+size_t processScalar(Run& run)
+{
+	size_t nOut = 0;
+	while (nOut < run.nMax)
+	{
+		const size_t i = (size_t)(run.nPosition >> 32);
+		if (i + Taps > run.nInput)
+			break;
+
+		const int16_t* pIn = run.pInput + i;
+		const int16_t* pTaps = run.pKernel->taps[(run.nPosition >> PhaseShift) & (Phases - 1)];
+		int32_t nSum = 0;
+		for (int t = 0; t < Taps; t++)
+			nSum += pIn[t] * pTaps[t];
+
+		run.pOut[nOut++] = output(nSum);
+		run.nPosition += run.nStep;
+	}
+	return nOut;
+}
+
+#if defined(NESRESAMPLER_X86)
+
+// 8 taps to a multiply-add
+NESRESAMPLER_TARGET("sse2")
+size_t processSSE2(Run& run)
+{
+	size_t nOut = 0;
+	while (nOut < run.nMax)
+	{
+		const size_t i = (size_t)(run.nPosition >> 32);
+		if (i + Taps > run.nInput)
+			break;
+
+		const int16_t* pIn = run.pInput + i;
+		const int16_t* pTaps = run.pKernel->taps[(run.nPosition >> PhaseShift) & (Phases - 1)];
+		__m128i vSum = _mm_setzero_si128();
+		for (int t = 0; t < Taps; t += 8)
+			vSum = _mm_add_epi32(vSum, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(pIn + t)), _mm_loadu_si128((const __m128i*)(pTaps + t))));
+		vSum = _mm_add_epi32(vSum, _mm_shuffle_epi32(vSum, 0x4E));
+		vSum = _mm_add_epi32(vSum, _mm_shuffle_epi32(vSum, 0xB1));
+
+		run.pOut[nOut++] = output(_mm_cvtsi128_si32(vSum));
+		run.nPosition += run.nStep;
+	}
+	return nOut;
+}
+
+// 16 taps to a multiply-add
+NESRESAMPLER_TARGET("avx2")
+size_t processAVX2(Run& run)
+{
+	size_t nOut = 0;
+	while (nOut < run.nMax)
+	{
+		const size_t i = (size_t)(run.nPosition >> 32);
+		if (i + Taps > run.nInput)
+			break;
+
+		const int16_t* pIn = run.pInput + i;
+		const int16_t* pTaps = run.pKernel->taps[(run.nPosition >> PhaseShift) & (Phases - 1)];
+		__m256i vSum = _mm256_setzero_si256();
+		for (int t = 0; t < Taps; t += 16)
+			vSum = _mm256_add_epi32(vSum, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(pIn + t)), _mm256_loadu_si256((const __m256i*)(pTaps + t))));
+		__m128i vHalf = _mm_add_epi32(_mm256_castsi256_si128(vSum), _mm256_extracti128_si256(vSum, 1));
+		vHalf = _mm_add_epi32(vHalf, _mm_shuffle_epi32(vHalf, 0x4E));
+		vHalf = _mm_add_epi32(vHalf, _mm_shuffle_epi32(vHalf, 0xB1));
+
+		run.pOut[nOut++] = output(_mm_cvtsi128_si32(vHalf));
+		run.nPosition += run.nStep;
+	}
+	return nOut;
+}
+
+#endif
+
+using ProcessFunction = size_t (*)(Run&);
+
+ProcessFunction function(Level level)
+{
+	switch (level)
+	{
+#if defined(NESRESAMPLER_X86)
+	case Level::AVX2: return processAVX2;
+	case Level::SSE2: return processSSE2;
+#endif
+	default: return processScalar;
+	}
+}
+
+// Chosen on first use, NesCompositor may not have asked the CPU yet
+// while globals are being initialised
+struct Dispatch
+{
+	Level level;
+	ProcessFunction pProcess;
+};
+
+Dispatch& dispatch()
+{
+	static Dispatch d = { NesCompositor::BestLevel(), function(NesCompositor::BestLevel()) };
+	return d;
+}
+
+}
+
+NesResampler::NesResampler()
+{
+	SetRates(1, 1);
+}
+
+void NesResampler::SetRates(uint32_t nInputRate, uint32_t nOutputRate)
+{
+	this->nInputRate = nInputRate;
+	this->nOutputRate = nOutputRate;
+
+	// Cut off a little below the lower Nyquist frequency, as the blip
+	// buffer does
+	const double dCutoff = 0.9 * std::min(1.0, (double)nOutputRate / nInputRate);
+	pKernel = kernel((uint32_t)std::lround(dCutoff * 65536.0));
+
+	SetRateScale(dScale);
+	Clear();
+}
+
+void NesResampler::SetRateScale(double dScale)
+{
+	this->dScale = dScale;
+	nStep = (uint64_t)std::llround((double)nInputRate / nOutputRate * dScale * 4294967296.0);
+}
+
+void NesResampler::Clear()
+{
+	// The centre of the kernel falls on the first input sample
+	vInput.assign(Taps / 2 - 1, 0);
+	nPosition = 0;
+}
+
+size_t NesResampler::MaxOutput(size_t nCount) const
+{
+	const uint64_t nEnd = (uint64_t)(vInput.size() + nCount) << 32;
+	return nEnd > nPosition ? (size_t)((nEnd - nPosition) / nStep) + 1 : 0;
+}
+
+size_t NesResampler::Process(const int16_t* pIn, size_t nCount, int16_t* pOut, size_t nMax)
+{
+	vInput.insert(vInput.end(), pIn, pIn + nCount);
+
+	Run run = { vInput.data(), vInput.size(), pKernel.get(), nPosition, nStep, pOut, nMax };
+	const size_t nOut = dispatch().pProcess(run);
+
+	// Drop the input no output will reach back to
+	const size_t nUsed = std::min((size_t)(run.nPosition >> 32), vInput.size());
+	vInput.erase(vInput.begin(), vInput.begin() + nUsed);
+	nPosition = run.nPosition - ((uint64_t)nUsed << 32);
+	return nOut;
+}
+
+NesResampler::Level NesResampler::GetLevel()
+{
+	return dispatch().level;
+}
+
+void NesResampler::SetLevel(Level level)
+{
+	const Level best = NesCompositor::BestLevel();
+	Dispatch& d = dispatch();
+	d.level = (int)level > (int)best ? best : level;
+	d.pProcess = function(d.level);
+}
@@ -0,0 +1,288 @@
+#include "NesRewind.h"
+#include "Nes.h"
+#include "Util/Stopwatch.h"
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+
+// Zero bytes inside a literal run are cheaper to copy than to end the
+// run for, up to this many in a row
+constexpr size_t MinZeroRun = 4;
+
+uint8_t* putVarint(uint8_t* out, size_t v)
+{
+	while (v >= 0x80)
+	{
+		*out++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*out++ = (uint8_t)v;
+	return out;
+}
+
+bool getVarint(const uint8_t*& p, const uint8_t* pEnd, size_t& v)
+{
+	v = 0;
+	for (int shift = 0; p < pEnd && shift < 64; shift += 7)
+	{
+		const uint8_t b = *p++;
+		v |= (size_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+size_t countZeros(const uint8_t* p, size_t i, size_t n)
+{
+	// A word at a time through the long runs
+	while (i + 8 <= n)
+	{
+		uint64_t w;
+		std::memcpy(&w, p + i, 8);
+		if (w != 0)
+			break;
+		i += 8;
+	}
+	while (i < n && p[i] == 0)
+		i++;
+	return i;
+}
+
+// The encoding is the uncompressed size followed by pairs of runs, a
+// run of zero bytes and then a run of literal bytes:
+//   size { zeros literals byte... }
+void encode(const uint8_t* p, size_t n, std::vector<uint8_t>& out)
+{
+	// Every pair but the last covers at least MinZeroRun + 1 bytes, so
+	// this is the most the encoding can grow to
+	const size_t nPairs = n / (MinZeroRun + 1) + 1;
+	out.resize(10 + n + nPairs * 20);
+	uint8_t* pOut = putVarint(out.data(), n);
+
+	size_t i = 0;
+	while (i < n)
+	{
+		const size_t nLiteral = countZeros(p, i, n);
+
+		// The literals carry on until the next worthwhile run of zeros
+		size_t nEnd = nLiteral;
+		size_t nZeros = 0;
+		while (nEnd < n && nZeros < MinZeroRun)
+		{
+			// A word at a time while there are no zero bytes at all
+			if (nZeros == 0 && nEnd + 8 <= n)
+			{
+				uint64_t w;
+				std::memcpy(&w, p + nEnd, 8);
+				if (((w - 0x0101010101010101ull) & ~w & 0x8080808080808080ull) == 0)
+				{
+					nEnd += 8;
+					continue;
+				}
+			}
+			nZeros = p[nEnd] == 0 ? nZeros + 1 : 0;
+			nEnd++;
+		}
+		if (nZeros == MinZeroRun)
+			nEnd -= MinZeroRun;
+
+		pOut = putVarint(pOut, nLiteral - i);
+		pOut = putVarint(pOut, nEnd - nLiteral);
+		std::memcpy(pOut, p + nLiteral, nEnd - nLiteral);
+		pOut += nEnd - nLiteral;
+		i = nEnd;
+	}
+	out.resize(pOut - out.data());
+}
+
+// Decode into dst, either replacing it or XORing into it
+bool decode(const uint8_t* p, size_t nSize, std::vector<uint8_t>& dst, bool bXor)
+{
+	const uint8_t* pEnd = p + nSize;
+	size_t n = 0;
+	if (!getVarint(p, pEnd, n))
+		return false;
+
+	if (!bXor)
+		dst.assign(n, 0);
+	else if (dst.size() != n)
+		return false;
+
+	size_t i = 0;
+	while (p < pEnd)
+	{
+		size_t nZeros = 0, nLiteral = 0;
+		if (!getVarint(p, pEnd, nZeros) || !getVarint(p, pEnd, nLiteral))
+			return false;
+		i += nZeros;
+		if (i + nLiteral > n || nLiteral > (size_t)(pEnd - p))
+			return false;
+
+		uint8_t* pOut = dst.data() + i;
+		if (bXor)
+		{
+			for (size_t k = 0; k < nLiteral; k++)
+				pOut[k] ^= p[k];
+		}
+		else
+			std::memcpy(pOut, p, nLiteral);
+		p += nLiteral;
+		i += nLiteral;
+	}
+	return true;
+}
+
+}
+
+NesRewind::NesRewind(size_t nCapacity, uint32_t nKeyframeInterval)
+	: vRing(nCapacity)
+	, nKeyframeInterval(nKeyframeInterval > 0 ? nKeyframeInterval : 1)
+{
+}
+
+void NesRewind::Clear()
+{
+	vEntries.clear();
+	vCurrent.clear();
+	nHead = 0;
+	nBytesUsed = 0;
+	nPushed = 0;
+}
+
+void NesRewind::Push(const Nes& nes)
+{
+	stream.seekp((size_t)0);
+	if (!nes.SaveState(stream))
+		return;
+
+	const uint8_t* pState = (const uint8_t*)stream.data();
+	const size_t nState = stream.tellp();
+
+	// The state that was the newest goes into the ring, described in
+	// terms of the one replacing it
+	if (!vCurrent.empty())
+	{
+		const bool bKeyframe = (nPushed - 1) % nKeyframeInterval == 0 || vCurrent.size() != nState;
+		if (!bKeyframe)
+		{
+			// Through a plain pointer, a byte store through the vector
+			// could alias its own data pointer and stop vectorization
+			uint8_t* pCurrent = vCurrent.data();
+			for (size_t i = 0; i < nState; i++)
+				pCurrent[i] ^= pState[i];
+		}
+		encode(vCurrent.data(), vCurrent.size(), vCompressed);
+
+		size_t nOffset = 0;
+		if (reserve(vCompressed.size(), nOffset))
+		{
+			std::memcpy(vRing.data() + nOffset, vCompressed.data(), vCompressed.size());
+			vEntries.push_back({ nOffset, (uint32_t)vCompressed.size(), bKeyframe });
+			nBytesUsed += vCompressed.size();
+			nHead = nOffset + vCompressed.size();
+		}
+		else
+		{
+			// Larger than the whole ring, the history cannot continue
+			vEntries.clear();
+			nHead = 0;
+			nBytesUsed = 0;
+		}
+	}
+
+	vCurrent.assign(pState, pState + nState);
+	nPushed++;
+}
+
+bool NesRewind::reserve(size_t nSize, size_t& nOffset)
+{
+	if (nSize > vRing.size())
+		return false;
+
+	// The entries sit in the ring oldest first, from the tail to the
+	// head, possibly wrapping around its end
+	while (!vEntries.empty())
+	{
+		const size_t nTail = vEntries.front().nOffset;
+		if (nHead > nTail)
+		{
+			// Free space after the head, and before the tail
+			if (vRing.size() - nHead >= nSize)
+			{
+				nOffset = nHead;
+				return true;
+			}
+			if (nTail >= nSize)
+			{
+				nOffset = 0;
+				return true;
+			}
+		}
+		else if (nTail - nHead >= nSize)
+		{
+			// Wrapped, the free space is between the head and the tail
+			nOffset = nHead;
+			return true;
+		}
+
+		nBytesUsed -= vEntries.front().nSize;
+		vEntries.pop_front();
+	}
+
+	nOffset = 0;
+	return true;
+}
+
+bool NesRewind::Rewind(Nes& nes, uint32_t nFrames)
+{
+	if (vCurrent.empty() || nFrames > vEntries.size())
+		return false;
+
+	Util::Stopwatch sw;
+	sw.Start();
+
+	// Start from the newest keyframe at or after the target if there
+	// is one, otherwise from the newest state
+	const size_t nTarget = vEntries.size() - nFrames;
+	size_t nFrom = vEntries.size();
+	for (size_t i = nTarget; i < vEntries.size(); i++)
+	{
+		if (vEntries[i].bKeyframe)
+		{
+			nFrom = i;
+			break;
+		}
+	}
+
+	bool bOk = true;
+	if (nFrom < vEntries.size())
+		bOk = decode(vRing.data() + vEntries[nFrom].nOffset, vEntries[nFrom].nSize, vCurrent, false);
+	for (size_t i = nFrom; bOk && i-- > nTarget; )
+		bOk = decode(vRing.data() + vEntries[i].nOffset, vEntries[i].nSize, vCurrent, true);
+
+	if (nFrames > 0)
+	{
+		nHead = vEntries[nTarget].nOffset;
+		for (size_t i = nTarget; i < vEntries.size(); i++)
+			nBytesUsed -= vEntries[i].nSize;
+		vEntries.resize(nTarget);
+		nPushed -= nFrames;
+	}
+
+	if (bOk)
+	{
+		stream.seekp((size_t)0);
+		stream.write((const char*)vCurrent.data(), vCurrent.size());
+		stream.seekg((size_t)0);
+		bOk = nes.LoadState(stream);
+	}
+	if (!bOk)
+		Clear();
+
+	sw.Stop();
+	dLastRewindMicroseconds = std::chrono::duration<double, std::micro>(sw.GetElapsed()).count();
+	return bOk;
+}
\ No newline at end of file
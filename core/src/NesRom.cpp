@@ -1,4 +1,5 @@
 #include "NesRom.h"
+#include "NesArchive.h"
 
 class Mapper_000 : public Mapper
 {
@@ -68,6 +69,11 @@ public:
 	void reset() override
     {
     }
+
+	std::shared_ptr<Mapper> clone() const override
+	{
+		return std::make_shared<Mapper_000>(*this);
+	}
 };
 
 
@@ -76,7 +82,6 @@ class Mapper_001 : public Mapper
 public:
 	Mapper_001(uint8_t prgBanks, uint8_t chrBanks) : Mapper(prgBanks, chrBanks)
     {
-       	vRAMStatic.resize(32 * 1024);
     }
 	~Mapper_001(){}
 
@@ -87,8 +92,8 @@ public:
             // Read is from static ram on cartridge
             mapped_addr = 0xFFFFFFFF;
 
-            // Read data from RAM
-            data = vRAMStatic[addr & 0x1FFF];
+            // Read data from RAM, which reads as zeros until it is used
+            data = vRAMStatic.empty() ? 0x00 : vRAMStatic[addr & 0x1FFF];
 
             // Signal mapper has handled request
             return true;
@@ -129,7 +134,13 @@ public:
             // Write is to static ram on cartridge
             mapped_addr = 0xFFFFFFFF;
 
-            // Write data to RAM
+            // Write data to RAM, allocating it first if this is the
+            // first write. The bus can then map it directly.
+            if (vRAMStatic.empty())
+            {
+                vRAMStatic.resize(RAMStaticSize);
+                nMapDirty |= MAPDIRTY_PRG;
+            }
             vRAMStatic[addr & 0x1FFF] = data;
 
             // Signal mapper has handled request
@@ -164,6 +175,7 @@ public:
                     {
                         // Set Control Register
                         nControlRegister = nLoadRegister & 0x1F;
+                        nMapDirty |= MAPDIRTY_ALL;
 
                         switch (nControlRegister & 0x03)
                         {
@@ -176,6 +188,7 @@ public:
                     else if (nTargetRegister == 1) // 0xA000 - 0xBFFF
                     {
                         // Set CHR Bank Lo
+                        nMapDirty |= MAPDIRTY_CHR;
                         if (nControlRegister & 0b10000) 
                         {
                             // 4K CHR Bank at PPU 0x0000
@@ -190,6 +203,7 @@ public:
                     else if (nTargetRegister == 2) // 0xC000 - 0xDFFF
                     {
                         // Set CHR Bank Hi
+                        nMapDirty |= MAPDIRTY_CHR;
                         if (nControlRegister & 0b10000)
                         {
                             // 4K CHR Bank at PPU 0x1000
@@ -200,6 +214,7 @@ public:
                     {
                         // Configure PRG Banks
                         uint8_t nPRGMode = (nControlRegister >> 2) & 0x03;
+                        nMapDirty |= MAPDIRTY_PRG;
 
                         if (nPRGMode == 0 || nPRGMode == 1)
                         {
@@ -302,11 +317,42 @@ public:
         nPRGBankSelect16Lo = 0;
         nPRGBankSelect16Hi = nPRGBanks - 1;
     }
+
+	std::shared_ptr<Mapper> clone() const override
+	{
+		return std::make_shared<Mapper_001>(*this);
+	}
+
 	MIRROR mirror()
     {
        	return mirrormode;
     }
 
+	uint8_t* prgRam() override
+    {
+        return vRAMStatic.empty() ? nullptr : vRAMStatic.data();
+    }
+
+	void Serialize(NesArchive& ar) override
+	{
+		ar.Value(nCHRBankSelect4Lo);
+		ar.Value(nCHRBankSelect4Hi);
+		ar.Value(nCHRBankSelect8);
+		ar.Value(nPRGBankSelect16Lo);
+		ar.Value(nPRGBankSelect16Hi);
+		ar.Value(nPRGBankSelect32);
+		ar.Value(nLoadRegister);
+		ar.Value(nLoadRegisterCount);
+		ar.Value(nControlRegister);
+		ar.Value(mirrormode);
+		ar.OptionalBuffer(vRAMStatic, RAMStaticSize);
+	}
+
+	size_t privateBytes() const override
+	{
+		return vRAMStatic.capacity();
+	}
+
 private:
 	uint8_t nCHRBankSelect4Lo = 0x00;
 	uint8_t nCHRBankSelect4Hi = 0x00;
@@ -322,6 +368,9 @@ private:
 
 	MIRROR mirrormode = MIRROR::HORIZONTAL;
 
+	// 8KB at 0x6000 -> 0x7FFF, allocated on the first write. Most games
+	// never use it.
+	static constexpr size_t RAMStaticSize = 8 * 1024;
 	std::vector<uint8_t> vRAMStatic;
 };
 
@@ -359,7 +408,7 @@ public:
         if (addr >= 0x8000 && addr <= 0xFFFF)
         {		
             nPRGBankSelectLo = data & 0x0F;
-            return true;
+            nMapDirty |= MAPDIRTY_PRG;
         }
 
         // Mapper has handled write, but do not update ROMs
@@ -393,6 +442,17 @@ public:
         nPRGBankSelectHi = nPRGBanks - 1;
     }
 
+	std::shared_ptr<Mapper> clone() const override
+	{
+		return std::make_shared<Mapper_002>(*this);
+	}
+
+	void Serialize(NesArchive& ar) override
+	{
+		ar.Value(nPRGBankSelectLo);
+		ar.Value(nPRGBankSelectHi);
+	}
+
 private:
 	uint8_t nPRGBankSelectLo = 0x00;
 	uint8_t nPRGBankSelectHi = 0x00;
@@ -429,6 +489,7 @@ public:
         if (addr >= 0x8000 && addr <= 0xFFFF)
         {
             nCHRBankSelect = data & 0x03;
+            nMapDirty |= MAPDIRTY_CHR;
             mapped_addr = addr;		
         }
 
@@ -454,6 +515,16 @@ public:
         nCHRBankSelect = 0;
     }
 
+	std::shared_ptr<Mapper> clone() const override
+	{
+		return std::make_shared<Mapper_003>(*this);
+	}
+
+	void Serialize(NesArchive& ar) override
+	{
+		ar.Value(nCHRBankSelect);
+	}
+
 private:
 	uint8_t nCHRBankSelect = 0x00;
 };
@@ -464,7 +535,6 @@ class Mapper_004 : public Mapper
 public:
 	Mapper_004(uint8_t prgBanks, uint8_t chrBanks) : Mapper(prgBanks, chrBanks)
     {
-
     }
 	~Mapper_004()
     {
@@ -478,8 +548,8 @@ public:
             // Write is to static ram on cartridge
             mapped_addr = 0xFFFFFFFF;
 
-            // Write data to RAM
-            data = vRAMStatic[addr & 0x1FFF];
+            // Read data from RAM, which reads as zeros until it is used
+            data = vRAMStatic.empty() ? 0x00 : vRAMStatic[addr & 0x1FFF];
 
             // Signal mapper has handled request
             return true;
@@ -520,7 +590,13 @@ public:
             // Write is to static ram on cartridge
             mapped_addr = 0xFFFFFFFF;
 
-            // Write data to RAM
+            // Write data to RAM, allocating it first if this is the
+            // first write. The bus can then map it directly.
+            if (vRAMStatic.empty())
+            {
+                vRAMStatic.resize(RAMStaticSize);
+                nMapDirty |= MAPDIRTY_PRG;
+            }
             vRAMStatic[addr & 0x1FFF] = data;
 
             // Signal mapper has handled request
@@ -578,6 +654,7 @@ public:
 
                 pPRGBank[1] = (pRegister[7] & 0x3F) * 0x2000;
                 pPRGBank[3] = (nPRGBanks * 2 - 1) * 0x2000;
+                nMapDirty |= MAPDIRTY_PRG | MAPDIRTY_CHR;
 
             }
 
@@ -593,6 +670,7 @@ public:
                     mirrormode = MIRROR::HORIZONTAL;
                 else
                     mirrormode = MIRROR::VERTICAL;
+                nMapDirty |= MAPDIRTY_MIRROR;
             }
             else
             {
@@ -710,6 +788,11 @@ public:
         pPRGBank[3] = (nPRGBanks * 2 - 1) * 0x2000;        
     }
 
+	std::shared_ptr<Mapper> clone() const override
+	{
+		return std::make_shared<Mapper_004>(*this);
+	}
+
 	bool irqState() override
     {
     	return bIRQActive;
@@ -733,11 +816,50 @@ public:
             bIRQActive = true;
         }        
     }
+
+	uint32_t scanlinesUntilIrq() const override
+	{
+		if (bIRQActive)
+			return 0;
+		if (!bIRQEnable)
+			return NoIrq;
+
+		// A counter at zero is reloaded by the next scanline rather
+		// than counted down
+		return nIRQCounter == 0 ? nIRQReload + 1 : nIRQCounter;
+	}
 	MIRROR mirror() override
     {
         return mirrormode;
     }
 
+	uint8_t* prgRam() override
+    {
+        return vRAMStatic.empty() ? nullptr : vRAMStatic.data();
+    }
+
+	void Serialize(NesArchive& ar) override
+	{
+		ar.Value(nTargetRegister);
+		ar.Value(bPRGBankMode);
+		ar.Value(bCHRInversion);
+		ar.Value(mirrormode);
+		ar.Value(pRegister);
+		ar.Value(pCHRBank);
+		ar.Value(pPRGBank);
+		ar.Value(bIRQActive);
+		ar.Value(bIRQEnable);
+		ar.Value(bIRQUpdate);
+		ar.Value(nIRQCounter);
+		ar.Value(nIRQReload);
+		ar.OptionalBuffer(vRAMStatic, RAMStaticSize);
+	}
+
+	size_t privateBytes() const override
+	{
+		return vRAMStatic.capacity();
+	}
+
 private:
 	// Control variables
 	uint8_t nTargetRegister = 0x00;
@@ -755,6 +877,9 @@ private:
 	uint16_t nIRQCounter = 0x0000;
 	uint16_t nIRQReload = 0x0000;
 
+	// 8KB at 0x6000 -> 0x7FFF, allocated on the first write. Most games
+	// never use it.
+	static constexpr size_t RAMStaticSize = 8 * 1024;
 	std::vector<uint8_t> vRAMStatic;
 };
 
@@ -782,6 +907,7 @@ public:
         {
             nCHRBankSelect = data & 0x03;
             nPRGBankSelect = (data & 0x30) >> 4;
+            nMapDirty |= MAPDIRTY_PRG | MAPDIRTY_CHR;
         }
         
         // Mapper has handled write, but do not update ROMs
@@ -807,6 +933,17 @@ public:
         nPRGBankSelect = 0;
     }
 
+	std::shared_ptr<Mapper> clone() const override
+	{
+		return std::make_shared<Mapper_066>(*this);
+	}
+
+	void Serialize(NesArchive& ar) override
+	{
+		ar.Value(nCHRBankSelect);
+		ar.Value(nPRGBankSelect);
+	}
+
 private:
 	uint8_t nCHRBankSelect = 0x00;
 	uint8_t nPRGBankSelect = 0x00;
@@ -815,95 +952,83 @@ private:
 
 NesRom::NesRom(const std::string& sFileName)
 {
-	// iNES Format Header
-	struct sHeader
-	{
-		char name[4];
-		uint8_t prg_rom_chunks;
-		uint8_t chr_rom_chunks;
-		uint8_t mapper1;
-		uint8_t mapper2;
-		uint8_t prg_ram_size;
-		uint8_t tv_system1;
-		uint8_t tv_system2;
-		char unused[5];
-	} header;
-
 	bImageValid = false;
 
-	std::ifstream ifs;
-	ifs.open(sFileName, std::ifstream::binary);
-	if (ifs.is_open())
-	{
-		// Read file header
-		ifs.read((char*)&header, sizeof(sHeader));
-
-		// If a "trainer" exists we just need to read past
-		// it before we get to the good stuff
-		if (header.mapper1 & 0x04)
-			ifs.seekg(512, std::ios_base::cur);
-
-		// Determine Mapper ID
-		nMapperID = ((header.mapper2 >> 4) << 4) | (header.mapper1 >> 4);
-		hw_mirror = (header.mapper1 & 0x01) ? VERTICAL : HORIZONTAL;
-
-		// "Discover" File Format
-		uint8_t nFileType = 1;
-		if ((header.mapper2 & 0x0C) == 0x08) nFileType = 2;
-
-		if (nFileType == 0)
-		{
-
-		}
+	pImage = NesRomImage::Open(sFileName);
+	if (pImage == nullptr)
+		return;
 
-		if (nFileType == 1)
-		{
-			nPRGBanks = header.prg_rom_chunks;
-			vPRGMemory.resize(nPRGBanks * 16384);
-			ifs.read((char*)vPRGMemory.data(), vPRGMemory.size());
-
-			nCHRBanks = header.chr_rom_chunks;
-			if (nCHRBanks == 0)
-			{
-				// Create CHR RAM
-				vCHRMemory.resize(8192);
-			}
-			else
-			{
-				// Allocate for ROM
-				vCHRMemory.resize(nCHRBanks * 8192);
-			}
-			ifs.read((char*)vCHRMemory.data(), vCHRMemory.size());
-		}
-
-		if (nFileType == 2)
-		{
-			nPRGBanks = ((header.prg_ram_size & 0x07) << 8) | header.prg_rom_chunks;
-			vPRGMemory.resize(nPRGBanks * 16384);
-			ifs.read((char*)vPRGMemory.data(), vPRGMemory.size());
+	nMapperID = pImage->MapperID();
+	nPRGBanks = pImage->PRGBanks();
+	nCHRBanks = pImage->CHRBanks();
+	hw_mirror = pImage->VerticalMirror() ? VERTICAL : HORIZONTAL;
+	if (pImage->FourScreen())
+	{
+		hw_mirror = FOURSCREEN;
+		vNameRam.resize(2048);
+	}
+	nChecksum = pImage->Checksum();
 
-			nCHRBanks = ((header.prg_ram_size & 0x38) << 8) | header.chr_rom_chunks;
-			vCHRMemory.resize(nCHRBanks * 8192);
-			ifs.read((char*)vCHRMemory.data(), vCHRMemory.size());
-		}
+	pPRG = pImage->PRG();
+	nPRGSize = pImage->PRGSize();
 
-		// Load appropriate mapper
-		switch (nMapperID)
-		{
-		case   0: pMapper = std::make_shared<Mapper_000>(nPRGBanks, nCHRBanks); break;
-		case   1: pMapper = std::make_shared<Mapper_001>(nPRGBanks, nCHRBanks); break;
-		case   2: pMapper = std::make_shared<Mapper_002>(nPRGBanks, nCHRBanks); break;
-		case   3: pMapper = std::make_shared<Mapper_003>(nPRGBanks, nCHRBanks); break;
-		case   4: pMapper = std::make_shared<Mapper_004>(nPRGBanks, nCHRBanks); break;
-		case  66: pMapper = std::make_shared<Mapper_066>(nPRGBanks, nCHRBanks); break;
+	// Load appropriate mapper
+	switch (nMapperID)
+	{
+	case   0: pMapper = std::make_shared<Mapper_000>(nPRGBanks, nCHRBanks); break;
+	case   1: pMapper = std::make_shared<Mapper_001>(nPRGBanks, nCHRBanks); break;
+	case   2: pMapper = std::make_shared<Mapper_002>(nPRGBanks, nCHRBanks); break;
+	case   3: pMapper = std::make_shared<Mapper_003>(nPRGBanks, nCHRBanks); break;
+	case   4: pMapper = std::make_shared<Mapper_004>(nPRGBanks, nCHRBanks); break;
+	case  66: pMapper = std::make_shared<Mapper_066>(nPRGBanks, nCHRBanks); break;
 
-		}
-        pMapper->reset();
+	}
 
+	if (pMapper)
+	{
+		pMapper->reset();
+		useCHR();
 		bImageValid = true;
-		ifs.close();
 	}
+}
+
+NesRom::NesRom(const NesRom& other)
+	: bImageValid(other.bImageValid)
+	, hw_mirror(other.hw_mirror)
+	, nMapperID(other.nMapperID)
+	, nPRGBanks(other.nPRGBanks)
+	, nCHRBanks(other.nCHRBanks)
+	, nChecksum(other.nChecksum)
+	, pImage(other.pImage)
+	, pPRG(other.pPRG)
+	, nPRGSize(other.nPRGSize)
+	, vCHRRam(other.vCHRRam)
+	, vNameRam(other.vNameRam)
+{
+	if (other.pMapper)
+	{
+		pMapper = other.pMapper->clone();
+		pMapper->nMapDirty |= MAPDIRTY_ALL;
+		useCHR();
+	}
+}
 
+void NesRom::useCHR()
+{
+	if (nCHRBanks == 0)
+	{
+		// Create CHR RAM
+		vCHRRam.resize(8192);
+		pCHR = vCHRRam.data();
+		nCHRSize = vCHRRam.size();
+		tileCache.Reset(pCHR, nCHRSize);
+	}
+	else
+	{
+		pCHR = pImage->CHR();
+		nCHRSize = pImage->CHRSize();
+		tileCache.Reset(pImage->Tiles());
+	}
 }
 
 NesRom::~NesRom()
@@ -911,6 +1036,11 @@ NesRom::~NesRom()
 
 }
 
+bool NesRom::ImageValid()
+{
+	return bImageValid;
+}
+
 bool NesRom::cpuRead(uint16_t addr, uint8_t &data)
 {
 	uint32_t mapped_addr = 0;
@@ -924,7 +1054,7 @@ bool NesRom::cpuRead(uint16_t addr, uint8_t &data)
 		else
 		{
 			// Mapper has produced an offset into cartridge bank memory
-			data = vPRGMemory[mapped_addr];
+			data = pPRG[mapped_addr];
 		}
 		return true;
 	}
@@ -937,16 +1067,9 @@ bool NesRom::cpuWrite(uint16_t addr, uint8_t data)
 	uint32_t mapped_addr = 0;
 	if (pMapper->cpuMapWrite(addr, mapped_addr, data))
 	{
-		if (mapped_addr == 0xFFFFFFFF)
-		{
-			// Mapper has actually set the data value, for example cartridge based RAM
-			return true;
-		}
-		else
-		{
-			// Mapper has produced an offset into cartridge bank memory
-			vPRGMemory[mapped_addr] = data;
-		}
+		// Either the mapper has taken the value itself, for example into
+		// cartridge RAM, or the write is to ROM, which ignores it. ROM
+		// is shared with other machines, see NesRomImage.
 		return true;
 	}
 	else
@@ -958,7 +1081,7 @@ bool NesRom::ppuRead(uint16_t addr, uint8_t & data)
 	uint32_t mapped_addr = 0;
 	if (pMapper->ppuMapRead(addr, mapped_addr))
 	{
-		data = vCHRMemory[mapped_addr];
+		data = pCHR[mapped_addr];
 		return true;
 	}
 	else
@@ -970,7 +1093,12 @@ bool NesRom::ppuWrite(uint16_t addr, uint8_t data)
 	uint32_t mapped_addr = 0;
 	if (pMapper->ppuMapWrite(addr, mapped_addr))
 	{
-		vCHRMemory[mapped_addr] = data;
+		// Pattern tables in ROM ignore writes, like PRG ROM
+		if (!vCHRRam.empty())
+		{
+			vCHRRam[mapped_addr] = data;
+			tileCache.Invalidate(mapped_addr);
+		}
 		return true;
 	}
 	else
@@ -983,11 +1111,36 @@ void NesRom::reset()
 	// Note: This does not reset the ROM contents,
 	// but does reset the mapper.
 	if (pMapper != nullptr)
+	{
 		pMapper->reset();
+		pMapper->nMapDirty |= MAPDIRTY_ALL;
+	}
+}
+
+void NesRom::Serialize(NesArchive& ar)
+{
+	// Without CHR ROM the pattern tables are RAM on the cartridge
+	if (nCHRBanks == 0)
+		ar.Buffer(vCHRRam);
+	if (hw_mirror == FOURSCREEN)
+		ar.Buffer(vNameRam);
+
+	pMapper->Serialize(ar);
+
+	if (ar.Loading())
+	{
+		pMapper->nMapDirty |= MAPDIRTY_ALL;
+		if (nCHRBanks == 0)
+			tileCache.InvalidateAll();
+	}
 }
 
 MIRROR NesRom::Mirror()
 {
+	// Four-screen boards have no use for the mapper's mirroring
+	if (hw_mirror == FOURSCREEN)
+		return hw_mirror;
+
 	MIRROR m = pMapper->mirror();
 	if (m == MIRROR::HARDWARE)
 	{
@@ -1003,6 +1156,106 @@ MIRROR NesRom::Mirror()
 	}
 }
 
+void NesRom::MapCpuPages(const uint8_t* pRead[64], uint8_t* pWrite[64])
+{
+	uint8_t* pRAM = pMapper->prgRam();
+
+	for (uint16_t page = 0x10; page < 0x40; page++)
+	{
+		uint16_t addr = page << 10;
+		pRead[page] = nullptr;
+		pWrite[page] = nullptr;
+
+		if (addr >= 0x6000 && addr <= 0x7FFF)
+		{
+			// Cartridge RAM, if present, is plain memory
+			if (pRAM != nullptr)
+			{
+				pRead[page] = pRAM + (addr & 0x1FFF);
+				pWrite[page] = pRAM + (addr & 0x1FFF);
+			}
+		}
+		else if (addr >= 0x8000)
+		{
+			// Ask the mapper where both ends of the page land. If they
+			// are a page apart in PRG memory, the whole page can be read
+			// directly. Writes always go to the mapper, they are how
+			// banks get switched.
+			uint32_t mapped_lo = 0, mapped_hi = 0;
+			uint8_t data = 0;
+			if (pMapper->cpuMapRead(addr, mapped_lo, data) &&
+				pMapper->cpuMapRead(addr | 0x03FF, mapped_hi, data) &&
+				mapped_lo != 0xFFFFFFFF && mapped_hi == mapped_lo + 0x03FF &&
+				mapped_hi < nPRGSize)
+			{
+				pRead[page] = pPRG + mapped_lo;
+			}
+		}
+	}
+
+	pMapper->nMapDirty &= ~MAPDIRTY_PRG;
+}
+
+void NesRom::MapPpuPages(const uint8_t* pRead[8], uint32_t nOffset[8])
+{
+	for (uint16_t page = 0; page < 8; page++)
+	{
+		uint16_t addr = page << 10;
+		pRead[page] = nullptr;
+		nOffset[page] = 0;
+
+		// As for PRG, a page is direct if both of its ends are a page
+		// apart in CHR memory. Writes are left to the mapper so that
+		// CHR RAM can keep the tile cache up to date.
+		uint32_t mapped_lo = 0, mapped_hi = 0;
+		if (pMapper->ppuMapRead(addr, mapped_lo) &&
+			pMapper->ppuMapRead(addr | 0x03FF, mapped_hi) &&
+			mapped_hi == mapped_lo + 0x03FF &&
+			mapped_hi < nCHRSize)
+		{
+			pRead[page] = pCHR + mapped_lo;
+			nOffset[page] = mapped_lo;
+		}
+	}
+
+	pMapper->nMapDirty &= ~MAPDIRTY_CHR;
+}
+
+void NesRom::MapNametables(uint8_t* pSlot[4], uint8_t* pVRAM)
+{
+	uint8_t* pLo = pVRAM;
+	uint8_t* pHi = pVRAM + 0x0400;
+
+	switch (Mirror())
+	{
+	case MIRROR::VERTICAL:
+		pSlot[0] = pLo; pSlot[1] = pHi; pSlot[2] = pLo; pSlot[3] = pHi;
+		break;
+	case MIRROR::ONESCREEN_LO:
+		pSlot[0] = pLo; pSlot[1] = pLo; pSlot[2] = pLo; pSlot[3] = pLo;
+		break;
+	case MIRROR::ONESCREEN_HI:
+		pSlot[0] = pHi; pSlot[1] = pHi; pSlot[2] = pHi; pSlot[3] = pHi;
+		break;
+	case MIRROR::FOURSCREEN:
+		pSlot[0] = pLo; pSlot[1] = pHi; pSlot[2] = vNameRam.data(); pSlot[3] = vNameRam.data() + 0x0400;
+		break;
+	default:
+		pSlot[0] = pLo; pSlot[1] = pLo; pSlot[2] = pHi; pSlot[3] = pHi;
+		break;
+	}
+
+	pMapper->nMapDirty &= ~MAPDIRTY_MIRROR;
+}
+
+size_t NesRom::PrivateBytes() const
+{
+	size_t nBytes = sizeof(NesRom) + vCHRRam.capacity() + vNameRam.capacity() + tileCache.PrivateBytes();
+	if (pMapper)
+		nBytes += pMapper->privateBytes();
+	return nBytes;
+}
+
 std::shared_ptr<Mapper> NesRom::GetMapper()
 {
 	return pMapper;
@@ -0,0 +1,226 @@
+#include "NesRomImage.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+// Images that are open, by file. Entries expire along with the last
+// cartridge using them, and are replaced if the file has changed since.
+struct Registry
+{
+	struct Entry
+	{
+		std::weak_ptr<const NesRomImage> pImage;
+		std::filesystem::file_time_type time;
+	};
+
+	std::mutex mutex;
+	std::map<std::string, Entry> entries;
+};
+
+Registry& registry()
+{
+	static Registry r;
+	return r;
+}
+
+}
+
+std::shared_ptr<const NesRomImage> NesRomImage::Open(const std::string& sFileName)
+{
+	std::error_code ec;
+	const std::filesystem::path path = std::filesystem::weakly_canonical(sFileName, ec);
+	const std::string sKey = ec ? sFileName : path.string();
+	const auto time = std::filesystem::last_write_time(sFileName, ec);
+
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+
+	auto it = r.entries.find(sKey);
+	if (it != r.entries.end())
+	{
+		if (auto pImage = it->second.pImage.lock())
+		{
+			if (it->second.time == time)
+				return pImage;
+		}
+	}
+
+	std::shared_ptr<NesRomImage> pImage(new NesRomImage());
+	if (!pImage->load(sFileName))
+		return nullptr;
+
+	r.entries[sKey] = Registry::Entry{ pImage, time };
+
+	// Forget the files nobody is using any more
+	for (auto e = r.entries.begin(); e != r.entries.end(); )
+		e = e->second.pImage.expired() ? r.entries.erase(e) : std::next(e);
+
+	return pImage;
+}
+
+NesRomImage::~NesRomImage()
+{
+	unmap();
+}
+
+bool NesRomImage::load(const std::string& sFileName)
+{
+	// iNES Format Header
+	struct sHeader
+	{
+		char name[4];
+		uint8_t prg_rom_chunks;
+		uint8_t chr_rom_chunks;
+		uint8_t mapper1;
+		uint8_t mapper2;
+		uint8_t prg_ram_size;
+		uint8_t tv_system1;
+		uint8_t tv_system2;
+		char unused[5];
+	} header;
+
+	if (!map(sFileName))
+	{
+		// Read the file instead
+		std::ifstream ifs(sFileName, std::ifstream::binary);
+		if (!ifs.is_open())
+			return false;
+		vCopy.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+		nFileSize = vCopy.size();
+	}
+
+	const uint8_t* pFile = pView != nullptr ? pView : vCopy.data();
+	std::memset(&header, 0, sizeof(sHeader));
+	std::memcpy(&header, pFile, std::min(nFileSize, sizeof(sHeader)));
+
+	// If a "trainer" exists we just need to skip past
+	// it before we get to the good stuff
+	size_t nOffset = sizeof(sHeader);
+	if (header.mapper1 & 0x04)
+		nOffset += 512;
+
+	// Determine Mapper ID
+	nMapperID = ((header.mapper2 >> 4) << 4) | (header.mapper1 >> 4);
+	bVerticalMirror = (header.mapper1 & 0x01) != 0;
+	bFourScreen = (header.mapper1 & 0x08) != 0;
+
+	// "Discover" File Format
+	if ((header.mapper2 & 0x0C) == 0x08)
+	{
+		nPRGBanks = ((header.prg_ram_size & 0x07) << 8) | header.prg_rom_chunks;
+		nCHRBanks = ((header.prg_ram_size & 0x38) << 8) | header.chr_rom_chunks;
+	}
+	else
+	{
+		nPRGBanks = header.prg_rom_chunks;
+		nCHRBanks = header.chr_rom_chunks;
+	}
+
+	nPRGSize = nPRGBanks * 16384;
+	nCHRSize = nCHRBanks * 8192;
+
+	// A truncated file reads as zeros past its end, so it needs a copy
+	// it can be padded in
+	const size_t nNeeded = nOffset + nPRGSize + nCHRSize;
+	if (nFileSize < nNeeded)
+	{
+		if (pView != nullptr)
+		{
+			vCopy.assign(pView, pView + nFileSize);
+			unmap();
+		}
+		vCopy.resize(nNeeded, 0);
+		pFile = vCopy.data();
+	}
+
+	pPRG = pFile + nOffset;
+	pCHR = nCHRSize > 0 ? pFile + nOffset + nPRGSize : nullptr;
+
+	// FNV-1a over the ROM contents
+	nChecksum = 2166136261u;
+	for (size_t i = 0; i < nPRGSize + nCHRSize; i++)
+		nChecksum = (nChecksum ^ pPRG[i]) * 16777619u;
+
+	if (pCHR != nullptr)
+		NesTileCache::Decode(pCHR, nCHRSize, tiles);
+
+	return true;
+}
+
+bool NesRomImage::map(const std::string& sFileName)
+{
+#if defined(_WIN32)
+	HANDLE hFile = CreateFileA(sFileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE hMap = nullptr;
+	if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0)
+		hMap = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(hFile);
+	if (hMap == nullptr)
+		return false;
+
+	void* p = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+	if (p == nullptr)
+	{
+		CloseHandle(hMap);
+		return false;
+	}
+
+	pView = (const uint8_t*)p;
+	nFileSize = (size_t)size.QuadPart;
+	hMapping = hMap;
+	return true;
+#else
+	const int fd = ::open(sFileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		return false;
+
+	pView = (const uint8_t*)p;
+	nFileSize = (size_t)st.st_size;
+	return true;
+#endif
+}
+
+void NesRomImage::unmap()
+{
+	if (pView == nullptr)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(pView);
+	CloseHandle((HANDLE)hMapping);
+	hMapping = nullptr;
+#else
+	munmap((void*)pView, nFileSize);
+#endif
+	pView = nullptr;
+}
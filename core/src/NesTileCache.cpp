@@ -0,0 +1,56 @@
+#include "NesTileCache.h"
+
+void NesTileCache::Reset(const uint8_t* pCHR, size_t nSize)
+{
+	this->pCHR = pCHR;
+	vTiles.assign(nSize / 16, Tile{});
+	vValid.assign(nSize / 16, 0);
+	pTiles = vTiles.data();
+	pValid = vValid.data();
+}
+
+void NesTileCache::Reset(const Shared& shared)
+{
+	pCHR = nullptr;
+	vTiles.clear();
+	vTiles.shrink_to_fit();
+	vValid.clear();
+	vValid.shrink_to_fit();
+	pTiles = shared.vTiles.data();
+	pValid = shared.vValid.data();
+}
+
+void NesTileCache::Decode(const uint8_t* pCHR, size_t nSize, Shared& shared)
+{
+	NesTileCache cache;
+	cache.Reset(pCHR, nSize);
+	for (uint32_t nTile = 0; nTile < nSize / 16; nTile++)
+		cache.decode(nTile);
+	shared.vTiles = std::move(cache.vTiles);
+	shared.vValid = std::move(cache.vValid);
+}
+
+uint64_t NesTileCache::DecodeRow(uint8_t lo, uint8_t hi, bool bFlip)
+{
+	// Bit 7 of each plane is the leftmost pixel
+	uint64_t row = 0;
+	for (int x = 0; x < 8; x++)
+	{
+		const int bit = bFlip ? x : 7 - x;
+		const uint64_t pixel = ((lo >> bit) & 0x01) | (((hi >> bit) & 0x01) << 1);
+		row |= pixel << (x * 8);
+	}
+	return row;
+}
+
+void NesTileCache::decode(uint32_t nTile)
+{
+	const uint8_t* pTile = pCHR + nTile * 16;
+	Tile& tile = vTiles[nTile];
+	for (int y = 0; y < 8; y++)
+	{
+		tile.row[y] = DecodeRow(pTile[y], pTile[y + 8], false);
+		tile.row_flipped[y] = DecodeRow(pTile[y], pTile[y + 8], true);
+	}
+	vValid[nTile] = 1;
+}
@@ -2,7 +2,10 @@
 
 #include <stdx/assert.h>
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
+#include <utility>
 
 namespace ByteIO
 {
@@ -2,6 +2,7 @@
 
 #include <stdx/compiler.h>
 
+#include <cstddef>
 #include <type_traits>
 
 namespace Math
@@ -26,7 +27,7 @@ class FixedPoint
 	static_assert( FractionBits <= sizeof( T ) * 8 - IsSigned );
 
 	template <typename U, size_t F>
-	friend class FixedPoint<U, F>;
+	friend class FixedPoint;
 
 public:
 	FixedPoint() noexcept = default;
@@ -37,7 +38,7 @@ public:
 	explicit constexpr FixedPoint( U value ) noexcept : m_value{ static_cast<T>( value * One ) } {}
 
 	template <typename U, size_t F>
-	explicit constexpr FixedPoint( FixedPoint<U, F> other ) noexcept : m_value{ static_cast<T>( ( other.m_value * One ) / other::One ) } {}
+	explicit constexpr FixedPoint( FixedPoint<U, F> other ) noexcept : m_value{ static_cast<T>( ( other.m_value * One ) / FixedPoint<U, F>::One ) } {}
 
 	constexpr FixedPoint( FromRaw_t, T value ) : m_value{ value } {}
 
@@ -99,28 +100,28 @@ public:
 	template <typename U, size_t F>
 	constexpr FixedPoint& operator+=( FixedPoint<U, F> other ) noexcept
 	{
-		m_value += static_cast<T>( ( other.m_value * One ) / other::One );
+		m_value += static_cast<T>( ( other.m_value * One ) / FixedPoint<U, F>::One );
 		return *this;
 	}
 
 	template <typename U, size_t F>
 	constexpr FixedPoint& operator-=( FixedPoint<U, F> other ) noexcept
 	{
-		m_value -= static_cast<T>( ( other.m_value * One ) / other::One );
+		m_value -= static_cast<T>( ( other.m_value * One ) / FixedPoint<U, F>::One );
 		return *this;
 	}
 
 	template <typename U, size_t F>
 	constexpr FixedPoint& operator*=( FixedPoint<U, F> other ) noexcept
 	{
-		m_value = static_cast<T>( ( m_value * other.m_value ) / other::One );
+		m_value = static_cast<T>( ( m_value * other.m_value ) / FixedPoint<U, F>::One );
 		return *this;
 	}
 
 	template <typename U, size_t F>
 	constexpr FixedPoint& operator/=( FixedPoint<U, F> other ) noexcept
 	{
-		m_value = static_cast<T>( ( m_value * other::One ) / other.m_value );
+		m_value = static_cast<T>( ( m_value * FixedPoint<U, F>::One ) / other.m_value );
 		return *this;
 	}
 
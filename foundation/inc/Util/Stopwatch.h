@@ -21,6 +21,8 @@ public:
 
 	Duration GetElapsed() const
 	{
+		if ( m_stopped )
+			return m_duration;
 		return m_duration + ( Clock::now() - m_start );
 	}
 
@@ -37,7 +37,11 @@
 #define dbLogError( ... )	LogError( __VA_ARGS__ )
 #define dbLogWarning( ... )	LogWarning( __VA_ARGS__ )
 
+#if defined _MSC_VER
 #define dbBreak() __debugbreak()
+#else
+#define dbBreak() __builtin_trap()
+#endif
 
 #define dbBreakMessage( ... )	\
 	MULTI_LINE_MACRO_BEGIN	\
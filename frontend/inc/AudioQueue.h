@@ -4,9 +4,13 @@
 
 #include <SDL.h>
 
+#include <atomic>
 #include <memory>
-#include <mutex>
 
+// Single producer, single consumer sample ring. The emulation thread is
+// the only one that pushes and the SDL audio callback the only one that
+// pops, so the two sides only meet through the read and write counters
+// and neither ever waits on the other.
 class AudioQueue
 {
 public:
@@ -34,13 +38,23 @@ public:
 
 	private:
 		AudioQueue& m_queue;
-		std::lock_guard<std::mutex> m_lock;
 		const int16_t* m_start = nullptr;
 		int16_t* m_pos = nullptr;
 		size_t m_batchSize = 0;
 		size_t m_size = 0;
 	};
 
+	// Glitch counters. An underrun is a device callback that found fewer
+	// samples queued than it needed, an overrun a push that found the
+	// queue full and dropped what did not fit.
+	struct Statistics
+	{
+		uint64_t underruns = 0;
+		uint64_t underrunSamples = 0;
+		uint64_t overruns = 0;
+		uint64_t overrunSamples = 0;
+	};
+
 public:
 	using SampleType = int16_t;
 
@@ -67,16 +81,16 @@ public:
 	bool Initialize( int frequency = DefaultSampleRate, uint8_t channels = DefaultChannelCount, uint16_t bufferSize = DefaultBufferSize );
 
 	void SetPaused( bool pause );
-	bool GetPaused() const { return m_paused; }
+	bool GetPaused() const { return m_paused.load( std::memory_order_relaxed ); }
 
 	void PushSamples( const int16_t* samples, size_t count );
 	void PushSilenceFrames( size_t count );
 
+	// the samples are dropped by the audio callback the next time it runs
 	void IgnoreSamples( size_t count );
 
 	void Clear()
 	{
-		std::unique_lock lock{ m_queueMutex };
 		ClearInternal();
 	}
 
@@ -87,14 +101,13 @@ public:
 
 	size_t Capacity() const
 	{
-		std::unique_lock lock{ m_queueMutex };
-		return m_bufferSize - m_size;
+		return m_bufferSize - Size();
 	}
 
 	size_t Size() const
 	{
-		std::unique_lock lock{ m_queueMutex };
-		return m_size;
+		const size_t read = m_read.load( std::memory_order_acquire );
+		return m_write.load( std::memory_order_acquire ) - read;
 	}
 
 	// returns buffer size in frames (total samples / channels)
@@ -103,6 +116,15 @@ public:
 		return m_settings.samples;
 	}
 
+	// the rate the device was opened at, which may not be the one asked for
+	int GetFrequency() const
+	{
+		return m_settings.freq;
+	}
+
+	Statistics GetStatistics() const;
+	void ResetStatistics();
+
 private:
 	template <typename DestType>
 	void ReadSamples( DestType* samples, size_t count );
@@ -115,24 +137,37 @@ private:
 
 	void ClearInternal();
 
+	// space the producer may write into, counting an overrun if it
+	// is less than count
+	size_t ReserveSamples( size_t count );
+
+	// make written samples visible to the audio callback
+	void CommitSamples( size_t count );
+
 	// pop samples from queue to output iterator
 	template <typename T>
 	void PopSamples( T* dest, size_t count );
 
-	// put popped samples back into the queue
-	void UnpopSamples( size_t count );
-
 private:
 	SDL_AudioDeviceID m_deviceId = 0;
 	SDL_AudioSpec m_settings = {};
-	bool m_paused = false;
+	std::atomic<bool> m_paused = false;
 	bool m_waitForFullBuffer = true;
 
-	mutable std::mutex m_queueMutex;
-
 	std::unique_ptr<int16_t[]> m_queue;
 	size_t m_bufferSize = 0;
-	size_t m_size = 0;
-	size_t m_first = 0;
-	size_t m_last = 0;
+
+	// Running totals of samples written and read. Each is stored by one
+	// side only, and on its own cache line so the two do not contend.
+	alignas( 64 ) std::atomic<size_t> m_write = 0;
+	alignas( 64 ) std::atomic<size_t> m_read = 0;
+	std::atomic<size_t> m_ignore = 0;
+
+	// the last sample handed to the device, held through underruns
+	int16_t m_lastSample = 0;
+
+	std::atomic<uint64_t> m_underruns = 0;
+	std::atomic<uint64_t> m_underrunSamples = 0;
+	std::atomic<uint64_t> m_overruns = 0;
+	std::atomic<uint64_t> m_overrunSamples = 0;
 };
\ No newline at end of file
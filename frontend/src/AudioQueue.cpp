@@ -0,0 +1,270 @@
+#include "AudioQueue.h"
+
+#include <algorithm>
+
+AudioQueue::BatchWriter::BatchWriter( AudioQueue& queue ) : m_queue{ queue }
+{
+	const size_t last = m_queue.m_write.load( std::memory_order_relaxed ) % m_queue.m_bufferSize;
+	m_start = m_pos = m_queue.m_queue.get() + last;
+	m_batchSize = std::min( m_queue.m_bufferSize - last, m_queue.Capacity() );
+}
+
+AudioQueue::BatchWriter::~BatchWriter()
+{
+	if ( !m_queue.GetPaused() )
+	{
+		const size_t count = GetCount();
+
+		// dbAssert( count <= m_batchSize );
+
+		m_queue.CommitSamples( count );
+	}
+}
+
+void AudioQueue::Destroy()
+{
+	if ( m_deviceId != 0 )
+	{
+		SDL_CloseAudioDevice( m_deviceId );
+		m_deviceId = 0;
+	}
+}
+
+bool AudioQueue::Initialize( int frequency, uint8_t channels, uint16_t bufferSize )
+{
+	if ( channels != 1 && channels != 2 )
+	{
+		dbLogError( "AudioQueue::AudioQueue -- Invalid number of channels [%u]", (uint32_t)channels );
+		return false;
+	}
+
+	SDL_AudioSpec request;
+	request.freq = frequency;
+	request.format = AUDIO_S16;
+	request.channels = channels;
+	request.samples = bufferSize;
+	request.callback = &StaticFillAudioDeviceBuffer;
+	request.userdata = this;
+
+	// the device may run at a rate of its own, the emulator resamples to it
+	SDL_AudioSpec obtained;
+	const auto deviceId = SDL_OpenAudioDevice( nullptr, 0, &request, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE );
+
+	if ( deviceId == 0 )
+	{
+		dbLogError( "AudioQueue::AudioQueue -- Cannot open audio device [%s]", SDL_GetError() );
+		return false;
+	}
+
+	if ( request.format != obtained.format || request.channels != obtained.channels )
+	{
+		dbLogError( "AudioQueue::AudioQueue -- Obtained audio settings do not match requested settings" );
+		SDL_CloseAudioDevice( deviceId );
+		return false;
+	}
+
+	Log( "audio rate: %d, buffer size: %u", obtained.freq, (uint32_t)obtained.samples );
+
+	m_deviceId = deviceId;
+	m_settings = obtained;
+
+	m_bufferSize = static_cast<size_t>( m_settings.freq * m_settings.channels );
+	m_queue = std::make_unique<int16_t[]>( m_bufferSize );
+
+	ClearInternal();
+
+	SDL_PauseAudioDevice( m_deviceId, true );
+
+	return true;
+}
+
+void AudioQueue::SetPaused( bool pause )
+{
+	dbAssert( m_deviceId > 0 );
+	if ( GetPaused() != pause )
+	{
+		ClearInternal();
+		m_paused.store( pause, std::memory_order_relaxed );
+	}
+}
+
+template <typename DestType>
+inline void AudioQueue::ReadSamples( DestType* samples, size_t count )
+{
+	if ( GetPaused() )
+	{
+		std::fill_n( samples, count, DestType( 0 ) );
+		return;
+	}
+
+	const size_t ignore = m_ignore.exchange( 0, std::memory_order_relaxed );
+	if ( ignore > 0 )
+	{
+		const size_t read = m_read.load( std::memory_order_relaxed );
+		m_read.store( read + std::min( ignore, Size() ), std::memory_order_release );
+	}
+
+	const size_t available = std::min( count, Size() );
+	PopSamples<DestType>( samples, available );
+
+	const size_t remaining = count - available;
+	if ( remaining > 0 )
+	{
+		// hold the last sample across the gap. Old samples cannot be
+		// replayed from the ring, the producer may already be reusing them
+		std::fill_n( samples + available, remaining, DestType( m_lastSample ) );
+
+		m_underruns.fetch_add( 1, std::memory_order_relaxed );
+		m_underrunSamples.fetch_add( remaining, std::memory_order_relaxed );
+	}
+}
+
+void AudioQueue::StaticFillAudioDeviceBuffer( void* userData, uint8_t* buffer, int length )
+{
+	reinterpret_cast<AudioQueue*>( userData )->FillAudioDeviceBuffer( buffer, length );
+}
+
+void AudioQueue::FillAudioDeviceBuffer( uint8_t* buffer, int bufferLength )
+{
+	switch ( m_settings.format )
+	{
+		case AUDIO_S16:
+			ReadSamples( reinterpret_cast<int16_t*>( buffer ), static_cast<size_t>( bufferLength ) / sizeof( int16_t ) );
+			break;
+
+		default:
+			dbBreak();
+			break;
+	}
+}
+
+void AudioQueue::PushSamples( const int16_t* samples, size_t count )
+{
+	if ( GetPaused() )
+		return;
+
+	count = ReserveSamples( count );
+	if ( count == 0 )
+		return;
+
+	const size_t last = m_write.load( std::memory_order_relaxed ) % m_bufferSize;
+	const size_t seg1Count = std::min( count, m_bufferSize - last );
+	const size_t seg2Count = count - seg1Count;
+
+	std::copy_n( samples, seg1Count, m_queue.get() + last );
+	std::copy_n( samples + seg1Count, seg2Count, m_queue.get() );
+
+	CommitSamples( count );
+}
+
+void AudioQueue::PushSilenceFrames( size_t count )
+{
+	if ( GetPaused() )
+		return;
+
+	count = ReserveSamples( count * m_settings.channels );
+
+	const size_t last = m_write.load( std::memory_order_relaxed ) % m_bufferSize;
+	const size_t seg1Count = std::min( count, m_bufferSize - last );
+	const size_t seg2Count = count - seg1Count;
+
+	std::fill_n( m_queue.get() + last, seg1Count, SampleType( 0 ) );
+	std::fill_n( m_queue.get(), seg2Count, SampleType( 0 ) );
+
+	CommitSamples( count );
+}
+
+void AudioQueue::IgnoreSamples( size_t count )
+{
+	// only the audio callback moves the read position
+	m_ignore.fetch_add( count, std::memory_order_relaxed );
+}
+
+size_t AudioQueue::ReserveSamples( size_t count )
+{
+	const size_t capacity = Capacity();
+	if ( capacity < count )
+	{
+		dbLogWarning( "AudioQueue::ReserveSamples -- Exceeding queue capacity" );
+		m_overruns.fetch_add( 1, std::memory_order_relaxed );
+		m_overrunSamples.fetch_add( count - capacity, std::memory_order_relaxed );
+		count = capacity;
+	}
+	return count;
+}
+
+void AudioQueue::CommitSamples( size_t count )
+{
+	dbAssert( Size() + count <= m_bufferSize );
+
+	m_write.store( m_write.load( std::memory_order_relaxed ) + count, std::memory_order_release );
+
+	CheckFullBuffer();
+}
+
+void AudioQueue::ClearInternal()
+{
+	// pausing the device waits for a running callback to return, after
+	// which nothing reads the ring until it is unpaused again
+	SDL_PauseAudioDevice( m_deviceId, true );
+	m_waitForFullBuffer = true;
+	m_write.store( 0, std::memory_order_relaxed );
+	m_read.store( 0, std::memory_order_relaxed );
+	m_ignore.store( 0, std::memory_order_relaxed );
+}
+
+void AudioQueue::CheckFullBuffer()
+{
+	if ( m_waitForFullBuffer && Size() >= static_cast<size_t>( m_settings.samples * m_settings.channels ) )
+	{
+		m_waitForFullBuffer = false;
+
+		if ( !GetPaused() )
+			SDL_PauseAudioDevice( m_deviceId, false );
+	}
+}
+
+AudioQueue::Statistics AudioQueue::GetStatistics() const
+{
+	Statistics stats;
+	stats.underruns = m_underruns.load( std::memory_order_relaxed );
+	stats.underrunSamples = m_underrunSamples.load( std::memory_order_relaxed );
+	stats.overruns = m_overruns.load( std::memory_order_relaxed );
+	stats.overrunSamples = m_overrunSamples.load( std::memory_order_relaxed );
+	return stats;
+}
+
+void AudioQueue::ResetStatistics()
+{
+	m_underruns.store( 0, std::memory_order_relaxed );
+	m_underrunSamples.store( 0, std::memory_order_relaxed );
+	m_overruns.store( 0, std::memory_order_relaxed );
+	m_overrunSamples.store( 0, std::memory_order_relaxed );
+}
+
+template <typename T>
+void AudioQueue::PopSamples( T* dest, size_t count )
+{
+	dbExpects( Size() >= count );
+
+	if ( count == 0 )
+		return;
+
+	const size_t read = m_read.load( std::memory_order_relaxed );
+	const size_t first = read % m_bufferSize;
+	const size_t seg1Size = std::min( count, m_bufferSize - first );
+	const size_t seg2Size = count - seg1Size;
+
+	if constexpr ( std::is_same_v<T, int16_t> )
+	{
+		std::copy_n( m_queue.get() + first, seg1Size, dest );
+		std::copy_n( m_queue.get(), seg2Size, dest + seg1Size );
+		m_lastSample = dest[ count - 1 ];
+	}
+	else
+	{
+		dbBreak(); // TODO
+	}
+
+	m_read.store( read + count, std::memory_order_release );
+}
\ No newline at end of file
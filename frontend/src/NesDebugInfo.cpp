@@ -27,7 +27,7 @@ void DrawVram(NesBus* bus, int nAddr, int nRows, int nColumns)
         std::string sOffset = "$" + hex(nAddr,4) + ":";
         for (int col = 0; col < nColumns; col++)
         {
-            uint8_t v = bus->ppu->ppuRead(nAddr, true);
+            uint8_t v = bus->ppu.ppuRead(nAddr, true);
             sOffset += " " + hex(v,2);
             nAddr += 1;
         }
@@ -37,7 +37,7 @@ void DrawVram(NesBus* bus, int nAddr, int nRows, int nColumns)
 
 void DrawCpu(NesBus* bus)
 {
-    NesCPU* cpu = bus->cpu;
+    NesCPU* cpu = &bus->cpu;
     ImVec4 colGreen(0,1,0,1), colRed(1,0,0,1);
     ImGui::Text("STATUS: ");
     ImGui::SameLine();
@@ -71,7 +71,7 @@ void ImGuiNesDebug(Nes* nes)
     DrawVram(nes->bus, 0x2000, 16, 16);
     DrawCpu(nes->bus);
 
-    ImGui::Text("Audio: %f", nes->bus->apu->GetOutputSample());
+    ImGui::Text("Audio: %f", nes->bus->apu.GetOutputSample());
 
     ImGui::End();
 }
\ No newline at end of file
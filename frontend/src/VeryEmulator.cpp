@@ -7,9 +7,35 @@
 #include "Renderer.h"
 #include "Nes.h"
 #include "NesDebugInfo.h"
+#include "AudioQueue.h"
+#include <algorithm>
+#include <map>
 
 bool quitting = false;
 
+const std::map<SDL_Scancode, uint8_t> keyMapper = {
+    {SDL_SCANCODE_X, 0x80},
+    {SDL_SCANCODE_Z, 0x40},
+    {SDL_SCANCODE_A, 0x20},
+    {SDL_SCANCODE_S, 0x10},
+
+    {SDL_SCANCODE_UP, 0x08},
+    {SDL_SCANCODE_DOWN, 0x04},
+    {SDL_SCANCODE_LEFT, 0x02},
+    {SDL_SCANCODE_RIGHT, 0x01},
+};
+
+uint8_t ReadKeyboard()
+{
+    uint8_t buttons = 0;
+    const uint8_t* keystates = SDL_GetKeyboardState(NULL);
+    for (auto &&i : keyMapper)
+    {
+        buttons |= (keystates[i.first] ? i.second : 0);
+    }
+    return buttons;
+}
+
 void PollEvents()
 {
 	SDL_Event event;
@@ -28,7 +54,7 @@ void PollEvents()
     }
 }
 
-SDLMAIN_DECLSPEC int SDL_main(int argc, char *argv[])
+int main(int argc, char *argv[])
 {
 	if ( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER ) < 0 )
 	{
@@ -92,8 +118,13 @@ SDLMAIN_DECLSPEC int SDL_main(int argc, char *argv[])
     Renderer *renderer = new Renderer();
     renderer->Initialize();
 
+    AudioQueue audioSystem;
+    audioSystem.Initialize(44100, 1);
+
     Nes* nes = new Nes();
     nes->Initialize();
+    if (audioSystem.GetFrequency() > 0)
+        nes->SetSampleFrequency(audioSystem.GetFrequency());
     nes->LoadGame("Roms/kage.nes");
     // nes->LoadGame("Roms/nestest.nes");
 
@@ -128,6 +159,16 @@ SDLMAIN_DECLSPEC int SDL_main(int argc, char *argv[])
             ImGui::Text("counter = %d", counter);
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+
+            // Frames emulated ahead of the one shown, to hide input lag
+            static int runAhead = 0;
+            if (ImGui::SliderInt("Run-ahead frames", &runAhead, 0, 4))
+                nes->SetRunAhead(runAhead);
+
+            const AudioQueue::Statistics audioStats = audioSystem.GetStatistics();
+            ImGui::Text("Audio underruns %llu (%llu samples), overruns %llu (%llu samples)",
+                (unsigned long long)audioStats.underruns, (unsigned long long)audioStats.underrunSamples,
+                (unsigned long long)audioStats.overruns, (unsigned long long)audioStats.overrunSamples);
             ImGui::End();
         }
 
@@ -135,14 +176,23 @@ SDLMAIN_DECLSPEC int SDL_main(int argc, char *argv[])
         ImGui::Render();
 
         // run emu
+        nes->SetControllerState(0, ReadKeyboard());
         nes->Tick();
+        audioSystem.PushSamples(nes->GetAudioSamples(), nes->GetAudioSampleCount());
+
+        // The display and the sound card do not run quite in step with
+        // the NES, so play the audio a little faster or slower to keep
+        // about two device buffers queued
+        const double targetQueued = 2.0 * audioSystem.GetDeviceBufferSize();
+        nes->SetAudioRateScale(std::clamp(1.0 + 0.005 * ((double)audioSystem.Size() - targetQueued) / targetQueued, 0.995, 1.005));
         
         // render
        	glClearColor( clear_color.x, clear_color.y, clear_color.z, clear_color.w );
         glClear( GL_COLOR_BUFFER_BIT );
 
         // renderer->DisplayFrame();
-        nes->Present(renderer);
+        renderer->UpdateDisplayFrame(256, 240, nes->GetScreen());
+        renderer->DisplayFrame();
 
         glViewport( 0, 0, winWidth, winHeight );
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -154,6 +204,9 @@ SDLMAIN_DECLSPEC int SDL_main(int argc, char *argv[])
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 
+    delete nes;
+    delete renderer;
+
     SDL_GL_DeleteContext(m_glContext);
     SDL_DestroyWindow(m_window);
     SDL_Quit();
@@ -0,0 +1,901 @@
+#include "Nes.h"
+#include "NesBatchRunner.h"
+#include "NesBus.h"
+#include "NesCompositor.h"
+#include "NesResampler.h"
+#include "NesRewind.h"
+#include "NesRom.h"
+#include "NesRomImage.h"
+
+#include <Util/CommandLine.h>
+#include <Util/Stopwatch.h>
+#include <stdx/log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+// VeryEmuBench - headless benchmarks and self checks for the emulation core
+//
+//   VeryEmuBench mode=cpu    [rom=Roms/nestest.nes] [instructions=20000000] [start=0xC000]
+//   VeryEmuBench mode=verify [rom=Roms/nestest.nes] [instructions=2000000]  [start=0xC000]
+//   VeryEmuBench mode=rewind [rom=Roms/kage.NES] [frames=3600] [capacity=8388608] [keyframes=60]
+//   VeryEmuBench mode=runahead [rom=Roms/kage.NES] [frames=3600] [ahead=2]
+//   VeryEmuBench mode=clone  [rom=Roms/kage.NES] [copies=200000] [slots=64]
+//   VeryEmuBench mode=batch  [rom=Roms/kage.NES] [instances=64] [threads=0] [steps=300] [k=1] [pin=0]
+//   VeryEmuBench mode=memory [rom=Roms/Contra (U).nes] [instances=512] [picture=1]
+//   VeryEmuBench mode=compose [rom=Roms/kage.NES] [lines=4096] [repeat=200] [frames=600]
+//   VeryEmuBench mode=mixer  [rom=Roms/Contra (U).nes] [frames=3600]
+//   VeryEmuBench mode=apu    [rom=Roms/Contra (U).nes] [frames=3600]
+//   VeryEmuBench mode=resample [seconds=60] [chunk=1864]
+//
+// cpu     Instructions per second of the legacy and fused 6502 cores.
+// verify  Runs the legacy and fused cores in lockstep and stops at the
+//         first instruction where registers, cycle counts or RAM differ.
+// rewind  Plays a game with scripted input while recording a NesRewind
+//         history, then reports how much play it retains per byte and
+//         how long rewinding takes. Every single frame step back is
+//         checked against a save state taken at the time.
+// runahead Time per frame with each run-ahead up to ahead frames, and
+//         what a hidden frame costs next to a shown one. A run-ahead
+//         machine is also checked against a plain one: their states
+//         must match every frame, and the picture shown must be the
+//         one the plain machine shows ahead frames later.
+// clone   Forks a running game into preallocated slots, reporting the
+//         cost of Clone() and copies per second of CopyStateFrom(). Each
+//         slot is then played on alongside the original and checked to
+//         stay in the same state.
+// batch   Steps many instances through NesBatchRunner, each with its own
+//         scripted input, and reports frames per second overall and for
+//         each worker. Some instances are replayed alone afterwards and
+//         their RAM compared with what the batch returned.
+// memory  Loads the same game into many machines, each with LoadGame(),
+//         and prints the byte budget of one machine, part by part, next
+//         to what one more machine costs in resident memory and the ROM
+//         image they all share. picture=0 runs them without a picture.
+// compose Time per scanline of each NesCompositor version this CPU can
+//         run, on random lines that every version must compose the same
+//         as the scalar one. The game is then played with each version
+//         and with the dot by dot renderer, and every picture compared.
+// mixer   Plays the game three times: as it is, mixing with the exact
+//         formulas instead of the APU's lookup tables, and filtering the
+//         output in double instead of fixed point. Reports the time per
+//         frame of each and how far the other two are from the first.
+// apu     Plays the game with the APU clocked every cycle and with it
+//         skipping ahead to the cycles where its output can change,
+//         checking every frame's samples and picture are the same, and
+//         reports the time per frame of each, also while running ahead.
+// resample Feeds a minute of noise at the APU's native rate through the
+//         resampler to 44.1, 48 and 96kHz, a frame's worth at a time with
+//         the rate scale wandering by up to half a percent, and reports
+//         the samples per second of each version this CPU can run. Every
+//         version must produce the same samples as the scalar one.
+//
+// By default the CPU is started at 0xC000, nestest's automated mode, which
+// runs through every official instruction without needing the PPU. The run
+// is restarted every NestestRunLength instructions. Pass start=0 to begin
+// from the reset vector instead.
+
+using Util::CommandLine::CommandLineOptions;
+
+namespace
+{
+
+// Length of the nestest automated run
+constexpr uint32_t NestestRunLength = 8991;
+
+double Seconds(const Util::Stopwatch& sw)
+{
+    return std::chrono::duration<double>(sw.GetElapsed()).count();
+}
+
+bool LoadRom(Nes& nes, const std::string& rom)
+{
+    nes.Initialize();
+    if (!nes.LoadGame(rom))
+    {
+        LogError("Failed to load [%s]", rom.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Buttons for a given frame, so that runs are repeatable
+uint8_t ScriptedInput(uint32_t frame)
+{
+    if ((frame / 30) % 4 == 1)
+        return 0x10; // Start
+    return (frame / 7) % 3 == 0 ? 0x81 : 0x40; // A and Right, or B
+}
+
+void Restart(NesCPU& cpu, uint16_t start)
+{
+    cpu.Reset();
+    if (start != 0)
+    {
+        cpu.pc = start;
+        cpu.status = 0x24;
+    }
+}
+
+int BenchCpu(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/nestest.nes"));
+    const uint64_t nInstructions = cl.GetOption<uint64_t>("instructions", 20000000);
+    const uint16_t start = cl.GetOption<uint16_t>("start", 0xC000);
+
+    Nes nes;
+    if (!LoadRom(nes, rom))
+        return 1;
+
+    NesCPU& cpu = nes.bus->cpu;
+
+    // Time one core over the whole instruction budget. step() runs a
+    // batch of instructions and returns the cycles they took.
+    auto measure = [&](const char* name, auto&& step)
+    {
+        uint64_t nCycles = 0;
+        Util::Stopwatch sw;
+        sw.Start();
+        for (uint64_t done = 0; done < nInstructions; )
+        {
+            const uint32_t batch = (uint32_t)std::min<uint64_t>(NestestRunLength, nInstructions - done);
+            Restart(cpu, start);
+            nCycles += step(batch);
+            done += batch;
+        }
+        sw.Stop();
+
+        const double secs = Seconds(sw);
+        Log("%-16s %9.2f M instructions/s %9.2f M cycles/s", name, nInstructions / secs / 1e6, nCycles / secs / 1e6);
+        return secs;
+    };
+
+    Log("%s, %llu instructions", rom.c_str(), (unsigned long long)nInstructions);
+
+    const double legacy = measure("legacy", [&](uint32_t n)
+    {
+        uint64_t c = 0;
+        while (n-- > 0)
+            c += cpu.StepLegacy();
+        return c;
+    });
+
+    const double step = measure("fused Step()", [&](uint32_t n)
+    {
+        uint64_t c = 0;
+        while (n-- > 0)
+            c += cpu.Step();
+        return c;
+    });
+
+    const double run = measure("fused Run()", [&](uint32_t n)
+    {
+        return (uint64_t)cpu.Run(n);
+    });
+
+    Log("speedup over legacy: Step() %.2fx, Run() %.2fx", legacy / step, legacy / run);
+    return 0;
+}
+
+int VerifyCpu(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/nestest.nes"));
+    const uint64_t nInstructions = cl.GetOption<uint64_t>("instructions", 2000000);
+    const uint16_t start = cl.GetOption<uint16_t>("start", 0xC000);
+
+    Nes legacyNes, fusedNes;
+    if (!LoadRom(legacyNes, rom) || !LoadRom(fusedNes, rom))
+        return 1;
+
+    NesBus& legacyBus = *legacyNes.bus;
+    NesBus& fusedBus = *fusedNes.bus;
+    NesCPU& legacy = legacyBus.cpu;
+    NesCPU& fused = fusedBus.cpu;
+
+    for (uint64_t i = 0; i < nInstructions; i++)
+    {
+        if (i % NestestRunLength == 0)
+        {
+            if (std::memcmp(legacyBus.cpuRam, fusedBus.cpuRam, sizeof(legacyBus.cpuRam)) != 0)
+            {
+                LogError("RAM differs after %llu instructions", (unsigned long long)i);
+                return 1;
+            }
+            Restart(legacy, start);
+            Restart(fused, start);
+        }
+
+        const uint16_t pc = legacy.pc;
+        const uint8_t legacyCycles = legacy.StepLegacy();
+        const uint8_t fusedCycles = fused.Step();
+
+        if (legacy.a != fused.a || legacy.x != fused.x || legacy.y != fused.y ||
+            legacy.stkp != fused.stkp || legacy.pc != fused.pc || legacy.status != fused.status ||
+            legacyCycles != fusedCycles)
+        {
+            LogError("Cores disagree at instruction %llu, PC:%04X opcode %02X", (unsigned long long)i, pc, legacy.opcode);
+            LogError("  legacy A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X cycles %d",
+                legacy.a, legacy.x, legacy.y, legacy.status, legacy.stkp, legacy.pc, legacyCycles);
+            LogError("  fused  A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X cycles %d",
+                fused.a, fused.x, fused.y, fused.status, fused.stkp, fused.pc, fusedCycles);
+            return 1;
+        }
+    }
+
+    Log("%s: legacy and fused cores agree over %llu instructions", rom.c_str(), (unsigned long long)nInstructions);
+    return 0;
+}
+
+int BenchRewind(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/kage.NES"));
+    const uint32_t nFrames = cl.GetOption<uint32_t>("frames", 3600);
+    const size_t nCapacity = cl.GetOption<size_t>("capacity", NesRewind::DefaultCapacity);
+    const uint32_t nKeyframes = cl.GetOption<uint32_t>("keyframes", NesRewind::DefaultKeyframeInterval);
+
+    Nes nes;
+    if (!LoadRom(nes, rom))
+        return 1;
+
+    // The states of the last few frames, uncompressed, to check against
+    const size_t nChecked = std::min<size_t>(nKeyframes * 2, nFrames);
+    std::deque<std::vector<char>> vRecent;
+    ByteIO::ByteStream state;
+
+    NesRewind rewind(nCapacity, nKeyframes);
+    Util::Stopwatch sw;
+    for (uint32_t f = 0; f < nFrames; f++)
+    {
+        nes.SetControllerState(0, ScriptedInput(f));
+        nes.Tick();
+
+        sw.Resume();
+        rewind.Push(nes);
+        sw.Stop();
+
+        state.seekp((size_t)0);
+        nes.SaveState(state);
+        vRecent.emplace_back(state.data(), state.data() + state.tellp());
+        if (vRecent.size() > nChecked)
+            vRecent.pop_front();
+    }
+
+    Log("%s, %u frames into %zu bytes, keyframe every %u", rom.c_str(), nFrames, nCapacity, nKeyframes);
+    Log("retained   %zu frames, %.1f s in %zu bytes", rewind.Frames(), rewind.SecondsRetained(), rewind.BytesUsed());
+    Log("rate       %.0f bytes/s, %.0f bytes/frame, state %zu bytes", rewind.BytesPerSecond(), rewind.BytesUsed() / (double)rewind.Frames(), vRecent.back().size());
+    Log("push       %.2f us/frame", Seconds(sw) * 1e6 / nFrames);
+
+    // Step back one frame at a time through the checked states
+    double dTotal = 0.0, dWorst = 0.0;
+    vRecent.pop_back();
+    uint32_t nSteps = 0;
+    while (!vRecent.empty() && rewind.Frames() > 1)
+    {
+        if (!rewind.Rewind(nes, 1))
+        {
+            LogError("Rewind failed after %u steps", nSteps);
+            return 1;
+        }
+        dTotal += rewind.LastRewindMicroseconds();
+        dWorst = std::max(dWorst, rewind.LastRewindMicroseconds());
+        nSteps++;
+
+        state.seekp((size_t)0);
+        nes.SaveState(state);
+        const std::vector<char>& expected = vRecent.back();
+        if (expected.size() != state.tellp() || std::memcmp(expected.data(), state.data(), expected.size()) != 0)
+        {
+            LogError("State %u frames back does not match the one recorded", nSteps);
+            return 1;
+        }
+        vRecent.pop_back();
+    }
+    Log("step back  %.2f us average, %.2f us worst over %u frames, all states match", dTotal / std::max(nSteps, 1u), dWorst, nSteps);
+
+    // And all the way back to the oldest state held
+    const uint32_t nDeep = (uint32_t)rewind.Frames() - 1;
+    if (nDeep > 0 && !rewind.Rewind(nes, nDeep))
+    {
+        LogError("Rewind by %u frames failed", nDeep);
+        return 1;
+    }
+    Log("seek back  %.2f us for %u frames", rewind.LastRewindMicroseconds(), nDeep);
+    return 0;
+}
+
+int BenchRunAhead(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/kage.NES"));
+    const uint32_t nFrames = cl.GetOption<uint32_t>("frames", 3600);
+    const uint32_t nAhead = cl.GetOption<uint32_t>("ahead", 2);
+
+    Log("%s, %u frames", rom.c_str(), nFrames);
+    double dPlain = 0.0;
+    for (uint32_t ahead = 0; ahead <= nAhead; ahead++)
+    {
+        Nes nes;
+        if (!LoadRom(nes, rom))
+            return 1;
+        nes.SetRunAhead(ahead);
+
+        Util::Stopwatch sw;
+        sw.Start();
+        for (uint32_t f = 0; f < nFrames; f++)
+        {
+            nes.SetControllerState(0, ScriptedInput(f));
+            nes.Tick();
+        }
+        sw.Stop();
+
+        const double dFrame = Seconds(sw) * 1e6 / nFrames;
+        if (ahead == 0)
+        {
+            dPlain = dFrame;
+            Log("ahead 0    %.1f us/frame", dFrame);
+        }
+        else
+        {
+            // The real frame is hidden too, and there is a save and a load
+            const double dHidden = (dFrame - dPlain) / ahead;
+            Log("ahead %u    %.1f us/frame, %.1f us per hidden frame (%.0f%% of a shown one)", ahead, dFrame, dHidden, dHidden * 100.0 / dPlain);
+        }
+    }
+
+    if (nAhead == 0)
+        return 0;
+
+    Nes plain, ahead;
+    if (!LoadRom(plain, rom) || !LoadRom(ahead, rom))
+        return 1;
+    ahead.SetRunAhead(nAhead);
+
+    // The plain machine runs nAhead frames in front, keeping the
+    // pictures it showed until the run-ahead one catches up
+    std::deque<std::vector<uint8_t>> vPictures;
+    std::deque<std::vector<char>> vStates;
+    ByteIO::ByteStream plainState, aheadState;
+    uint32_t nPictures = 0;
+    for (uint32_t f = 0; f < nFrames + nAhead; f++)
+    {
+        plain.SetControllerState(0, ScriptedInput(f));
+        plain.Tick();
+        vPictures.emplace_back(plain.GetIndexedScreen(), plain.GetIndexedScreen() + 256 * 240);
+
+        plainState.seekp((size_t)0);
+        plain.SaveState(plainState);
+        vStates.emplace_back(plainState.data(), plainState.data() + plainState.tellp());
+        if (f < nAhead)
+            continue;
+
+        const uint32_t g = f - nAhead;
+        ahead.SetControllerState(0, ScriptedInput(g));
+        ahead.Tick();
+
+        aheadState.seekp((size_t)0);
+        ahead.SaveState(aheadState);
+        const std::vector<char>& expected = vStates.front();
+        if (expected.size() != aheadState.tellp() || std::memcmp(expected.data(), aheadState.data(), expected.size()) != 0)
+        {
+            LogError("Frame %u, the run-ahead machine does not match the plain one", g);
+            return 1;
+        }
+        vStates.pop_front();
+
+        // Only when the input held through the frames run ahead
+        bool bSameInput = true;
+        for (uint32_t i = 1; i <= nAhead; i++)
+            bSameInput = bSameInput && ScriptedInput(g + i) == ScriptedInput(g);
+        if (bSameInput)
+        {
+            if (std::memcmp(vPictures.back().data(), ahead.GetIndexedScreen(), 256 * 240) != 0)
+            {
+                LogError("Frame %u, the picture shown is not the one %u frames ahead", g, nAhead);
+                return 1;
+            }
+            nPictures++;
+        }
+        vPictures.pop_front();
+    }
+    Log("checked    %u states and %u pictures %u frames ahead, all match", nFrames, nPictures, nAhead);
+    return 0;
+}
+
+int BenchClone(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/kage.NES"));
+    const uint32_t nCopies = cl.GetOption<uint32_t>("copies", 200000);
+    const uint32_t nSlots = std::max(cl.GetOption<uint32_t>("slots", 64), 1u);
+
+    Nes nes;
+    if (!LoadRom(nes, rom))
+        return 1;
+    for (uint32_t f = 0; f < 600; f++)
+    {
+        nes.SetControllerState(0, ScriptedInput(f));
+        nes.Tick();
+    }
+
+    Util::Stopwatch sw;
+    sw.Start();
+    std::vector<std::unique_ptr<Nes>> vSlots;
+    for (uint32_t i = 0; i < nSlots; i++)
+        vSlots.push_back(nes.Clone());
+    sw.Stop();
+    Log("%s, %u slots", rom.c_str(), nSlots);
+    Log("Clone()         %.2f us each", Seconds(sw) * 1e6 / nSlots);
+
+    sw.Reset();
+    sw.Start();
+    for (uint32_t i = 0; i < nCopies; i++)
+    {
+        if (!vSlots[i % nSlots]->CopyStateFrom(nes))
+        {
+            LogError("CopyStateFrom failed");
+            return 1;
+        }
+    }
+    sw.Stop();
+    Log("CopyStateFrom() %.2f us each, %.0f copies/s", Seconds(sw) * 1e6 / nCopies, nCopies / Seconds(sw));
+
+    // Every slot has to carry on exactly as the original does
+    ByteIO::ByteStream expected, actual;
+    for (uint32_t f = 600; f < 660; f++)
+    {
+        nes.SetControllerState(0, ScriptedInput(f));
+        nes.Tick();
+        expected.seekp((size_t)0);
+        nes.SaveState(expected);
+
+        for (auto& pSlot : vSlots)
+        {
+            pSlot->SetControllerState(0, ScriptedInput(f));
+            pSlot->Tick();
+            actual.seekp((size_t)0);
+            pSlot->SaveState(actual);
+            if (actual.tellp() != expected.tellp() || std::memcmp(actual.data(), expected.data(), expected.tellp()) != 0)
+            {
+                LogError("Frame %u, a clone does not match the original", f);
+                return 1;
+            }
+        }
+    }
+    Log("checked         %u slots over 60 frames, all match", nSlots);
+    return 0;
+}
+
+// Resident memory of the process, 0 where it cannot be found
+size_t ResidentBytes()
+{
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr)
+        return 0;
+    unsigned long nSize = 0, nResident = 0;
+    const int n = fscanf(f, "%lu %lu", &nSize, &nResident);
+    fclose(f);
+    return n == 2 ? (size_t)nResident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+int BenchMemory(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/Contra (U).nes"));
+    const uint32_t nInstances = std::max(cl.GetOption<uint32_t>("instances", 512), 1u);
+    const bool bPicture = cl.GetOption<uint32_t>("picture", 1) != 0;
+
+    auto pImage = NesRomImage::Open(rom);
+    if (pImage == nullptr)
+    {
+        LogError("Failed to load [%s]", rom.c_str());
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Nes>> vMachines;
+    vMachines.reserve(nInstances);
+    const size_t nBefore = ResidentBytes();
+    for (uint32_t i = 0; i < nInstances; i++)
+    {
+        vMachines.push_back(std::make_unique<Nes>());
+        if (!LoadRom(*vMachines.back(), rom))
+            return 1;
+        if (!bPicture)
+            vMachines.back()->DisableScreen();
+        vMachines.back()->Tick();
+    }
+    const size_t nAfter = ResidentBytes();
+
+    const Nes::MemoryUsage usage = vMachines.front()->GetMemoryUsage();
+    Log("%s, %u machines%s", rom.c_str(), nInstances, bPicture ? "" : " without a picture");
+    Log("image      %zu bytes of file, %s, PRG %zu, CHR %zu, decoded CHR %zu",
+        pImage->FileBytes(), pImage->Mapped() ? "mapped" : "copied", pImage->PRGSize(), pImage->CHRSize(),
+        pImage->Tiles().vTiles.size() * sizeof(NesTileCache::Tile));
+    Log("machine    %8zu bytes  CPU, PPU, APU and RAM", usage.machine);
+    Log("cartridge  %8zu bytes", usage.cartridge);
+    Log("picture    %8zu bytes", usage.picture);
+    Log("audio      %8zu bytes", usage.audio);
+    Log("states     %8zu bytes", usage.states);
+    Log("total      %8zu bytes per machine, and %zu shared", usage.Total(), usage.shared);
+    if (nAfter > nBefore)
+        Log("resident   %.1f KB per machine", (nAfter - nBefore) / 1024.0 / nInstances);
+
+    for (const auto& pMachine : vMachines)
+    {
+        if (!pMachine->rom->SharesImage(*vMachines.front()->rom))
+        {
+            LogError("Machines loaded from one file do not share its image");
+            return 1;
+        }
+    }
+    Log("checked    all machines share one image");
+    return 0;
+}
+
+int BenchBatch(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/kage.NES"));
+    const uint32_t nInstances = std::max(cl.GetOption<uint32_t>("instances", 64), 1u);
+    const uint32_t nThreads = cl.GetOption<uint32_t>("threads", 0);
+    const uint32_t nSteps = cl.GetOption<uint32_t>("steps", 300);
+    const uint32_t nFramesPerStep = std::max(cl.GetOption<uint32_t>("k", 1), 1u);
+    const bool bPin = cl.GetOption<uint32_t>("pin", 0) != 0;
+
+    NesBatchRunner runner(rom, nInstances, nThreads, bPin);
+    if (!runner.Ok())
+    {
+        LogError("Failed to load [%s]", rom.c_str());
+        return 1;
+    }
+
+    // Each instance plays the script from its own offset, so they drift apart
+    auto action = [](uint32_t instance, uint32_t step) { return ScriptedInput(step + instance * 11); };
+
+    std::vector<uint8_t> vActions(nInstances);
+    std::vector<uint8_t> vFrames(nInstances * NesBatchRunner::FrameBytes);
+    std::vector<uint8_t> vRam(nInstances * NesBatchRunner::RamBytes);
+
+    Util::Stopwatch sw;
+    sw.Start();
+    for (uint32_t step = 0; step < nSteps; step++)
+    {
+        for (uint32_t i = 0; i < nInstances; i++)
+            vActions[i] = action(i, step);
+        runner.Step(vActions.data(), nFramesPerStep, vFrames.data(), vRam.data());
+    }
+    sw.Stop();
+
+    const double nTotal = (double)nInstances * nSteps * nFramesPerStep;
+    Log("%s, %u instances, %zu threads%s, %u steps of %u frames", rom.c_str(), nInstances, runner.Threads(), bPin ? " pinned" : "", nSteps, nFramesPerStep);
+    Log("overall    %.0f frames/s, %.2f ms per step", nTotal / Seconds(sw), Seconds(sw) * 1e3 / nSteps);
+    const auto vStats = runner.GetStatistics();
+    for (size_t w = 0; w < vStats.size(); w++)
+    {
+        Log("worker %2zu  core %2d  %8.0f frames/s  %6llu frames  %5llu stolen", w, vStats[w].core, vStats[w].FramesPerSecond(),
+            (unsigned long long)vStats[w].frames, (unsigned long long)vStats[w].stolen);
+    }
+
+    // Replay a few instances on their own
+    uint32_t nChecked = 0;
+    for (uint32_t i = 0; i < nInstances; i += std::max(nInstances / 4, 1u))
+    {
+        Nes nes;
+        if (!LoadRom(nes, rom))
+            return 1;
+        for (uint32_t step = 0; step < nSteps; step++)
+        {
+            nes.SetControllerState(0, action(i, step));
+            for (uint32_t f = 0; f < nFramesPerStep; f++)
+                nes.Tick();
+        }
+        if (std::memcmp(nes.GetRam(), vRam.data() + i * NesBatchRunner::RamBytes, NesBatchRunner::RamBytes) != 0 ||
+            std::memcmp(nes.GetIndexedScreen(), vFrames.data() + i * NesBatchRunner::FrameBytes, NesBatchRunner::FrameBytes) != 0)
+        {
+            LogError("Instance %u does not match a replay of its input", i);
+            return 1;
+        }
+        nChecked++;
+    }
+    Log("checked    %u instances against a replay, all match", nChecked);
+    return 0;
+}
+
+int BenchCompose(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/kage.NES"));
+    const uint32_t nLines = std::max(cl.GetOption<uint32_t>("lines", 4096), 1u);
+    const uint32_t nRepeat = std::max(cl.GetOption<uint32_t>("repeat", 200), 1u);
+    const uint32_t nFrames = cl.GetOption<uint32_t>("frames", 600);
+
+    // Random lines, with a fair share of transparent, clipped, hidden and
+    // sprite zero pixels
+    std::mt19937 rng(2024);
+    std::vector<uint8_t> vBackground(nLines * 256), vSprites(nLines * 256), vColours(nLines * 32), vFlags(nLines);
+    for (uint32_t i = 0; i < nLines * 256; i++)
+    {
+        const uint32_t r = rng();
+        vBackground[i] = r & 0x0F;
+        vSprites[i] = (r >> 8) % 3 == 0 ? (uint8_t)(((r >> 16) & 0x1F) | 0x10 | ((r >> 24) & 0x60)) : 0;
+        if ((vSprites[i] & 0x03) == 0)
+            vSprites[i] = 0;
+    }
+    for (uint32_t i = 0; i < nLines * 32; i++)
+        vColours[i] = rng() & 0x3F;
+    for (uint32_t i = 0; i < nLines; i++)
+        vFlags[i] = rng() & 0x07;
+
+    auto line = [&](uint32_t i, uint8_t* pOut)
+    {
+        NesCompositor::Line l;
+        l.pBackground = vBackground.data() + i * 256;
+        l.pSprites = vSprites.data() + i * 256;
+        l.bBackground = vFlags[i] != 0;
+        l.bBackgroundLeft = (vFlags[i] & 0x02) != 0;
+        l.bSpritesLeft = (vFlags[i] & 0x04) != 0;
+        l.pColours = vColours.data() + i * 32;
+        l.pOut = pOut;
+        return l;
+    };
+
+    const NesCompositor::Level best = NesCompositor::BestLevel();
+    Log("%u random lines, best version %s", nLines, NesCompositor::LevelName(best));
+    std::vector<uint8_t> vExpected(nLines * 256), vOut(nLines * 256);
+    std::vector<uint8_t> vExpectedHit(nLines), vHit(nLines);
+    for (int level = 0; level <= (int)best; level++)
+    {
+        NesCompositor::SetLevel((NesCompositor::Level)level);
+        uint8_t* pOut = level == 0 ? vExpected.data() : vOut.data();
+        uint8_t* pHit = level == 0 ? vExpectedHit.data() : vHit.data();
+
+        Util::Stopwatch sw;
+        sw.Start();
+        for (uint32_t r = 0; r < nRepeat; r++)
+            for (uint32_t i = 0; i < nLines; i++)
+                pHit[i] = NesCompositor::Compose(line(i, pOut + i * 256));
+        sw.Stop();
+
+        Log("%-8s   %.1f ns/line", NesCompositor::LevelName((NesCompositor::Level)level), Seconds(sw) * 1e9 / ((double)nLines * nRepeat));
+        if (level > 0 && (vOut != vExpected || vHit != vExpectedHit))
+        {
+            LogError("%s does not compose the same as the scalar version", NesCompositor::LevelName((NesCompositor::Level)level));
+            return 1;
+        }
+    }
+
+    // The whole game, against the dot renderer that never uses it
+    std::vector<std::unique_ptr<Nes>> vMachines;
+    for (int level = 0; level <= (int)best + 1; level++)
+    {
+        vMachines.push_back(std::make_unique<Nes>());
+        if (!LoadRom(*vMachines.back(), rom))
+            return 1;
+    }
+    vMachines.back()->bus->ppu.bScanlineRenderer = false;
+
+    for (uint32_t f = 0; f < nFrames; f++)
+    {
+        for (size_t m = 0; m < vMachines.size(); m++)
+        {
+            if (m <= (size_t)best)
+                NesCompositor::SetLevel((NesCompositor::Level)m);
+            vMachines[m]->SetControllerState(0, ScriptedInput(f));
+            vMachines[m]->Tick();
+        }
+        for (size_t m = 0; m + 1 < vMachines.size(); m++)
+        {
+            if (std::memcmp(vMachines[m]->GetIndexedScreen(), vMachines.back()->GetIndexedScreen(), 256 * 240) != 0)
+            {
+                LogError("Frame %u, the %s picture is not the one drawn dot by dot", f, NesCompositor::LevelName((NesCompositor::Level)m));
+                return 1;
+            }
+        }
+    }
+    NesCompositor::SetLevel(best);
+    Log("checked    %u frames of %s with every version, all match", nFrames, rom.c_str());
+    return 0;
+}
+
+int BenchMixer(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/Contra (U).nes"));
+    const uint32_t nFrames = cl.GetOption<uint32_t>("frames", 3600);
+
+    struct Variant
+    {
+        const char* name;
+        bool bMixerFormula;
+        bool bFilterDouble;
+    };
+    const Variant variants[] = {
+        { "tables", false, false },
+        { "formula", true, false },
+        { "double", false, true },
+    };
+
+    std::vector<int16_t> vSamples[3];
+    for (int v = 0; v < 3; v++)
+    {
+        Nes nes;
+        if (!LoadRom(nes, rom))
+            return 1;
+        nes.bus->apu.bMixerFormula = variants[v].bMixerFormula;
+        nes.bus->apu.bFilterDouble = variants[v].bFilterDouble;
+
+        Util::Stopwatch sw;
+        sw.Start();
+        for (uint32_t f = 0; f < nFrames; f++)
+        {
+            nes.SetControllerState(0, ScriptedInput(f));
+            nes.Tick();
+            vSamples[v].insert(vSamples[v].end(), nes.GetAudioSamples(), nes.GetAudioSamples() + nes.GetAudioSampleCount());
+        }
+        sw.Stop();
+        Log("%-8s   %.1f us/frame", variants[v].name, Seconds(sw) * 1e6 / nFrames);
+    }
+
+    for (int v = 1; v < 3; v++)
+    {
+        if (vSamples[0].size() != vSamples[v].size())
+        {
+            LogError("The %s and %s mixers produced different numbers of samples", variants[0].name, variants[v].name);
+            return 1;
+        }
+
+        int nPeak = 0;
+        double dSquares = 0.0;
+        for (size_t i = 0; i < vSamples[0].size(); i++)
+        {
+            const int nDiff = vSamples[0][i] - vSamples[v][i];
+            nPeak = std::max(nPeak, std::abs(nDiff));
+            dSquares += (double)nDiff * nDiff;
+        }
+        Log("%s, %zu samples, %s against %s: peak %d, rms %.2f", rom.c_str(), vSamples[0].size(), variants[0].name, variants[v].name, nPeak,
+            vSamples[0].empty() ? 0.0 : std::sqrt(dSquares / vSamples[0].size()));
+    }
+    return 0;
+}
+
+int BenchAPU(const CommandLineOptions& cl)
+{
+    const std::string rom(cl.GetOption("rom", "Roms/Contra (U).nes"));
+    const uint32_t nFrames = cl.GetOption<uint32_t>("frames", 3600);
+
+    // The APU clocked every cycle against it skipping to the cycles where
+    // something changes, in lockstep so the first frame to differ is the
+    // one reported. Frames run ahead are not heard, and skip further.
+    for (uint32_t nAhead = 0; nAhead < 2; nAhead++)
+    {
+        Nes machines[2];
+        double dSeconds[2] = {};
+        for (int every = 0; every < 2; every++)
+        {
+            if (!LoadRom(machines[every], rom))
+                return 1;
+            machines[every].bus->apu.bEveryCycle = every != 0;
+            machines[every].SetRunAhead(nAhead);
+        }
+
+        for (uint32_t f = 0; f < nFrames; f++)
+        {
+            for (int every = 0; every < 2; every++)
+            {
+                machines[every].SetControllerState(0, ScriptedInput(f));
+                Util::Stopwatch sw;
+                sw.Start();
+                machines[every].Tick();
+                sw.Stop();
+                dSeconds[every] += Seconds(sw);
+            }
+
+            if (machines[0].GetAudioSampleCount() != machines[1].GetAudioSampleCount() ||
+                std::memcmp(machines[0].GetAudioSamples(), machines[1].GetAudioSamples(), machines[0].GetAudioSampleCount() * sizeof(int16_t)) != 0 ||
+                std::memcmp(machines[0].GetIndexedScreen(), machines[1].GetIndexedScreen(), 256 * 240) != 0)
+            {
+                LogError("Frame %u, skipping ahead does not match clocking every cycle", f);
+                return 1;
+            }
+        }
+
+        Log("ahead=%u    every cycle %.1f us/frame, skipping %.1f us/frame", nAhead,
+            dSeconds[1] * 1e6 / nFrames, dSeconds[0] * 1e6 / nFrames);
+    }
+    Log("checked    %u frames of %s both ways, all match", nFrames, rom.c_str());
+    return 0;
+}
+
+}
+
+int BenchResample(const CommandLineOptions& cl)
+{
+    const uint32_t nSeconds = std::max(cl.GetOption<uint32_t>("seconds", 60), 1u);
+    const size_t nChunk = std::max(cl.GetOption<uint32_t>("chunk", 1864), 1u);
+
+    std::mt19937 rng(2024);
+    std::vector<int16_t> vInput((size_t)Nes::NativeSampleRate * nSeconds);
+    for (int16_t& sample : vInput)
+        sample = (int16_t)((int32_t)(rng() & 0xFFFF) - 0x8000);
+
+    const NesResampler::Level best = NesCompositor::BestLevel();
+    for (uint32_t nRate : { 44100u, 48000u, 96000u })
+    {
+        std::vector<int16_t> vExpected;
+        for (int level = 0; level <= (int)best; level++)
+        {
+            NesResampler::SetLevel((NesResampler::Level)level);
+            NesResampler resampler;
+            resampler.SetRates(Nes::NativeSampleRate, nRate);
+
+            std::vector<int16_t> vOut, vChunk;
+            vOut.reserve((size_t)nRate * nSeconds * 102 / 100);
+            Util::Stopwatch sw;
+            sw.Start();
+            for (size_t nPos = 0, nChunks = 0; nPos < vInput.size(); nPos += nChunk, nChunks++)
+            {
+                const size_t nCount = std::min(nChunk, vInput.size() - nPos);
+                resampler.SetRateScale(1.0 + 0.005 * std::sin(nChunks * 0.01));
+                vChunk.resize(resampler.MaxOutput(nCount));
+                vChunk.resize(resampler.Process(vInput.data() + nPos, nCount, vChunk.data(), vChunk.size()));
+                vOut.insert(vOut.end(), vChunk.begin(), vChunk.end());
+            }
+            sw.Stop();
+
+            Log("%5u Hz  %-8s %7.1f M samples/s out, %7.1f M in", nRate, NesCompositor::LevelName((NesResampler::Level)level),
+                vOut.size() / Seconds(sw) * 1e-6, vInput.size() / Seconds(sw) * 1e-6);
+            if (level == 0)
+                vExpected = std::move(vOut);
+            else if (vOut != vExpected)
+            {
+                LogError("%s does not resample the same as the scalar version", NesCompositor::LevelName((NesResampler::Level)level));
+                return 1;
+            }
+        }
+    }
+    NesResampler::SetLevel(best);
+    Log("checked    %u s of noise at %u Hz with every version, all match", nSeconds, Nes::NativeSampleRate);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    Util::CommandLine::Initialize(argc, argv);
+    const auto& cl = Util::CommandLine::Get();
+
+    const std::string_view mode = cl.GetOption("mode", "cpu");
+    if (mode == "cpu")
+        return BenchCpu(cl);
+    if (mode == "verify")
+        return VerifyCpu(cl);
+    if (mode == "rewind")
+        return BenchRewind(cl);
+    if (mode == "runahead")
+        return BenchRunAhead(cl);
+    if (mode == "clone")
+        return BenchClone(cl);
+    if (mode == "batch")
+        return BenchBatch(cl);
+    if (mode == "memory")
+        return BenchMemory(cl);
+    if (mode == "compose")
+        return BenchCompose(cl);
+    if (mode == "mixer")
+        return BenchMixer(cl);
+    if (mode == "apu")
+        return BenchAPU(cl);
+    if (mode == "resample")
+        return BenchResample(cl);
+
+    LogError("Unknown mode [%.*s]", (int)mode.size(), mode.data());
+    return 1;
+}